@@ -0,0 +1,191 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Heap allocation counter for the Performance Reports
+// Counting requires replacing the global operator new:
+// #define COUNT_ALLOCATIONS before including this header in exactly one translation unit (e.g. Example.cpp)
+// Plain, array, nothrow and (C++17) aligned forms are counted. The counter is shared by every thread: the count
+// of a query includes what its pool tasks allocate, and what any other thread allocates meanwhile
+
+// Number of heap allocations since program start
+inline std::atomic<std::size_t>& AllocationCounter()
+{
+	static std::atomic<std::size_t> counter{ 0 };
+	return counter;
+}
+
+inline std::size_t AllocationCount()
+{
+	return AllocationCounter().load(std::memory_order_relaxed);
+}
+
+// True if the replacement operator new is linked in
+inline bool& AllocationCountEnabled()
+{
+	static bool enabled{ false };
+	return enabled;
+}
+
+#ifdef COUNT_ALLOCATIONS
+
+// Kept out of line: a delete inlined next to its new would expose the free of a pointer that came from new
+#if defined(_MSC_VER)
+#define ALLOCATION_COUNTER_NOINLINE __declspec(noinline)
+#else
+#define ALLOCATION_COUNTER_NOINLINE __attribute__((noinline))
+#endif
+
+namespace
+{
+	struct EnableAllocationCount
+	{
+		EnableAllocationCount() { AllocationCountEnabled() = true; }
+	} enableAllocationCount;
+
+	// Every operator new ends here, every operator delete in the matching Release
+	void* CountedAllocate(std::size_t size) noexcept
+	{
+		AllocationCounter().fetch_add(1, std::memory_order_relaxed);
+		return std::malloc(size == 0 ? 1 : size);
+	}
+
+	void CountedRelease(void* p) noexcept
+	{
+		std::free(p);
+	}
+
+#if defined(__cpp_aligned_new)
+	// The block returned by malloc is stored right before the aligned one
+	void* CountedAllocate(std::size_t size, std::align_val_t alignment) noexcept
+	{
+		auto align = static_cast<std::size_t>(alignment);
+		auto raw = CountedAllocate(size + align + sizeof(void*));
+		if (raw == nullptr)
+			return nullptr;
+
+		auto aligned = (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*) + align - 1) & ~static_cast<std::uintptr_t>(align - 1);
+		reinterpret_cast<void**>(aligned)[-1] = raw;
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	void CountedRelease(void* p, std::align_val_t) noexcept
+	{
+		if (p != nullptr)
+			CountedRelease(static_cast<void**>(p)[-1]);
+	}
+#endif
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new(std::size_t size)
+{
+	if (void* p = CountedAllocate(size))
+		return p;
+
+	throw std::bad_alloc();
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* p) noexcept
+{
+	CountedRelease(p);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* p) noexcept
+{
+	CountedRelease(p);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* p, std::size_t) noexcept
+{
+	CountedRelease(p);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* p, std::size_t) noexcept
+{
+	CountedRelease(p);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	CountedRelease(p);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+	CountedRelease(p);
+}
+
+#if defined(__cpp_aligned_new)
+ALLOCATION_COUNTER_NOINLINE void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	if (void* p = CountedAllocate(size, alignment))
+		return p;
+
+	throw std::bad_alloc();
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size, alignment);
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return CountedAllocate(size, alignment);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* p, std::align_val_t alignment) noexcept
+{
+	CountedRelease(p, alignment);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* p, std::align_val_t alignment) noexcept
+{
+	CountedRelease(p, alignment);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+	CountedRelease(p, alignment);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+	CountedRelease(p, alignment);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	CountedRelease(p, alignment);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	CountedRelease(p, alignment);
+}
+#endif
+
+#endif
@@ -2,6 +2,8 @@
 #include <utility>
 #include <unordered_map>
 #include "UtilityFunctions.h"
+#include "VoteCounter.h"
+#include "ThreadPool.h"
 #include <string>
 #include <chrono>
 #include <functional>
@@ -32,7 +34,9 @@ public:
 	BKT(std::string name) :name_{ name } {}
 
 	// Build index from vector of Point Clouds
-	void Build(const std::vector<Cloud<T>>& pointClouds, std::function<unsigned(const std::pair<T, unsigned>&, const std::pair<T, unsigned>&)> dist)
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	void Build(const Clouds& pointClouds, std::function<unsigned(const std::pair<T, unsigned>&, const std::pair<T, unsigned>&)> dist)
 	{
 		std::vector<PointIdx> data;
 		int totalPoints = 0;
@@ -70,7 +74,7 @@ public:
 	{
 		std::vector<PointIdx> results;
 		std::vector<unsigned> distances;
-		std::unordered_map<unsigned, unsigned> count;
+		auto& count = VoteCounter<>::Local();
 		auto i = 0;
 		// K queries for every point in the PointCloud
 		for (const auto& point : queryCloud.Points)
@@ -80,26 +84,32 @@ public:
 			// Count the frequencies for the Clouds ID
 			for (const auto& item : results)
 			{
-				count[item.second]++;
+				count.Add(item.second);
 			}
 			results.clear();
 			distances.clear();
 		}
 
-		auto numberResults = 0;
-
-		if (count.size() > k)
-			numberResults = k;
-		else
-			numberResults = count.size();
+		// Get only the first K Point Clouds based in ID frequency.
+		return count.TopK(k);
+	}
 
-		std::vector<std::pair<unsigned, unsigned>> resultsID(numberResults);
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
+	// 4th Parameter: numThreads = Worker threads
+	std::vector<std::vector<std::pair<unsigned, unsigned>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const unsigned numThreads = DefaultThreads()) const
+	{
+		std::vector<std::vector<std::pair<unsigned, unsigned>>> results(queryClouds.size());
 
-		// Get only the first K Point Clouds based in ID frequency.
-		std::partial_sort_copy(std::begin(count), std::end(count), std::begin(resultsID), std::end(resultsID),
-			[](const std::pair<unsigned, unsigned>& left, const std::pair<unsigned, unsigned>& right) {return left.second>right.second; });
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
+		{
+			results[i] = KNN(queryClouds[i], k, internalK);
+		}, numThreads);
 
-		return resultsID;
+		return results;
 	}
 
 	// Performance report on KNN Search
@@ -115,14 +125,17 @@ public:
 		performance.QueriesTime.reserve(queryClouds.size());
 		performance.RecallAt.reserve(queryClouds.size());
 		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
 
 		// For every cloud in vector of PointClouds
 		for (const auto& cloud : queryClouds)
 		{
 			// Perform KNN search
+			allocations = AllocationCount();
 			start = std::chrono::high_resolution_clock::now();
 			auto result = KNN(cloud, k, internalK);
 			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
 
 			GetRecall(performance, result, recallAt, cloud.ID);
 
@@ -134,6 +147,7 @@ public:
 			pair.second = pair.second / static_cast<double>(queryClouds.size());
 		}
 		TimePerformance(performance);
+		AllocationPerformance(performance);
 		return performance;
 	}
 
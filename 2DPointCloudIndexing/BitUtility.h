@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Bit scan on 64 bit words
+
+// Index of the lowest set bit - word must not be 0
+inline unsigned CountTrailingZeros(std::uint64_t word)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return static_cast<unsigned>(index);
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanForward(&index, static_cast<unsigned long>(word)))
+		return static_cast<unsigned>(index);
+	_BitScanForward(&index, static_cast<unsigned long>(word >> 32));
+	return static_cast<unsigned>(index) + 32;
+#else
+	return static_cast<unsigned>(__builtin_ctzll(word));
+#endif
+}
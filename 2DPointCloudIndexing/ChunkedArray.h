@@ -0,0 +1,91 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+// Array of one value per ID shared by the snapshots of an index
+// Values live in chunks of 4096 held by shared pointers: a snapshot (Share) copies the chunk pointers only,
+// and Set copies a chunk before its first write after the last Share (copy on write)
+// Shared chunks are never written again, so readers of a snapshot need no synchronization
+// V: Value type - Missing values read as the default value given to the constructor
+template<typename V>
+class ChunkedArray
+{
+private:
+	static const std::size_t chunkBits = 12;
+	static const std::size_t chunkSize = std::size_t{ 1 } << chunkBits;
+
+	std::vector<std::shared_ptr<const std::vector<V>>> chunks_;
+
+	// Chunks created or copied by this array since the last Share - Written in place
+	std::vector<std::shared_ptr<std::vector<V>>> owned_;
+	V missing_;
+
+public:
+	explicit ChunkedArray(V missing = V()) :missing_(missing) {}
+
+	// Copies own no chunk: their first write to a chunk copies it
+	ChunkedArray(const ChunkedArray& other) :chunks_(other.chunks_), missing_(other.missing_) {}
+
+	ChunkedArray& operator=(const ChunkedArray& other)
+	{
+		chunks_ = other.chunks_;
+		owned_.clear();
+		missing_ = other.missing_;
+		return *this;
+	}
+
+	ChunkedArray(ChunkedArray&&) = default;
+	ChunkedArray& operator=(ChunkedArray&&) = default;
+
+	V Get(std::size_t i) const
+	{
+		auto chunk = i >> chunkBits;
+		if (chunk >= chunks_.size() || !chunks_[chunk])
+			return missing_;
+
+		return (*chunks_[chunk])[i & (chunkSize - 1)];
+	}
+
+	void Set(std::size_t i, V value)
+	{
+		auto chunk = i >> chunkBits;
+		if (chunk >= chunks_.size())
+		{
+			chunks_.resize(chunk + 1);
+			owned_.resize(chunk + 1);
+		}
+		else if (owned_.size() < chunks_.size())
+		{
+			owned_.resize(chunks_.size());
+		}
+
+		if (!owned_[chunk])
+		{
+			owned_[chunk] = chunks_[chunk] ? std::make_shared<std::vector<V>>(*chunks_[chunk]) : std::make_shared<std::vector<V>>(chunkSize, missing_);
+			chunks_[chunk] = owned_[chunk];
+		}
+
+		(*owned_[chunk])[i & (chunkSize - 1)] = value;
+	}
+
+	// Snapshot of the values - Later writes to this array no longer reach the chunks of the snapshot
+	ChunkedArray Share()
+	{
+		owned_.clear();
+		return ChunkedArray(*this);
+	}
+
+	// Number of IDs covered by the chunks (IDs beyond are missing)
+	std::size_t Capacity() const
+	{
+		return chunks_.size() * chunkSize;
+	}
+};
+
+// Definitions of the constants - chunkSize is bound to references (e.g. by std::make_shared)
+template<typename V>
+const std::size_t ChunkedArray<V>::chunkBits;
+
+template<typename V>
+const std::size_t ChunkedArray<V>::chunkSize;
@@ -0,0 +1,277 @@
+#pragma once
+#include "Cloud.h"
+#include "GetCloudsCSV.h"
+#include "IndexFile.h"
+#include "MappedFile.h"
+#include <boost/geometry.hpp>
+#include <vector>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+// Binary file of Point Clouds in columnar layout
+// Header: IndexFileHeader with magic "CLOUDSET" - NumClouds clouds, NumPostings points in total
+// Sections:
+//  Cloud table: one CloudFileEntry per cloud
+//  X: coordinate x of every point (float), the points of a cloud are contiguous
+//  Y: coordinate y of every point, same order as X
+// CloudSet maps the file and exposes the clouds as views over the mapping (no parsing, no copy)
+
+struct CloudFileEntry
+{
+	std::uint32_t ID;
+	std::uint32_t NumPoints;
+
+	// Position of the first point of the cloud in X and Y
+	std::uint64_t Offset;
+};
+
+static_assert(sizeof(CloudFileEntry) == 16, "CloudFileEntry must be 16 bytes");
+
+// Points of a cloud stored in a CloudSet - Read-only sequence of T
+// Points are built on access from the X and Y columns
+template<typename T>
+class CloudPoints
+{
+private:
+	const float* x_;
+	const float* y_;
+	std::size_t size_;
+
+public:
+	class iterator
+	{
+	private:
+		const float* x_;
+		const float* y_;
+
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const T*;
+		using reference = T;
+
+		iterator(const float* x, const float* y) :x_{ x }, y_{ y } {}
+
+		T operator*() const { return T(*x_, *y_); }
+		T operator[](difference_type n) const { return T(x_[n], y_[n]); }
+
+		iterator& operator++() { ++x_; ++y_; return *this; }
+		iterator operator++(int) { auto it = *this; ++*this; return it; }
+		iterator& operator--() { --x_; --y_; return *this; }
+		iterator operator--(int) { auto it = *this; --*this; return it; }
+		iterator& operator+=(difference_type n) { x_ += n; y_ += n; return *this; }
+		iterator& operator-=(difference_type n) { x_ -= n; y_ -= n; return *this; }
+		iterator operator+(difference_type n) const { return iterator(x_ + n, y_ + n); }
+		iterator operator-(difference_type n) const { return iterator(x_ - n, y_ - n); }
+		difference_type operator-(const iterator& other) const { return x_ - other.x_; }
+
+		bool operator==(const iterator& other) const { return x_ == other.x_; }
+		bool operator!=(const iterator& other) const { return x_ != other.x_; }
+		bool operator<(const iterator& other) const { return x_ < other.x_; }
+	};
+
+	using const_iterator = iterator;
+
+	CloudPoints(const float* x, const float* y, std::size_t size) :x_{ x }, y_{ y }, size_{ size } {}
+
+	iterator begin() const { return iterator(x_, y_); }
+	iterator end() const { return iterator(x_ + size_, y_ + size_); }
+	std::size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	T operator[](std::size_t i) const { return T(x_[i], y_[i]); }
+
+	// Raw columns
+	const float* X() const { return x_; }
+	const float* Y() const { return y_; }
+};
+
+// PointCloud stored in a CloudSet - Same fields as Cloud<T> (ID, Points)
+template<typename T>
+struct CloudView
+{
+	CloudView(unsigned id, CloudPoints<T> points) :Points{ points }, ID{ id } {}
+
+	// Copy of the cloud
+	Cloud<T> ToCloud() const
+	{
+		Cloud<T> cloud{ ID };
+		cloud.Points.assign(std::begin(Points), std::end(Points));
+		return cloud;
+	}
+
+	CloudPoints<T> Points;
+	unsigned ID;
+};
+
+// T: Point class(2D)
+
+template<typename T = boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>>
+class CloudSet
+{
+private:
+	std::shared_ptr<MappedFile> file_;
+	const CloudFileEntry* entries_ = nullptr;
+	const float* x_ = nullptr;
+	const float* y_ = nullptr;
+	std::size_t numClouds_ = 0;
+	std::size_t numPoints_ = 0;
+
+public:
+	class iterator
+	{
+	private:
+		const CloudSet* set_;
+		std::size_t i_;
+
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = CloudView<T>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const CloudView<T>*;
+		using reference = CloudView<T>;
+
+		iterator(const CloudSet* set, std::size_t i) :set_{ set }, i_{ i } {}
+
+		CloudView<T> operator*() const { return (*set_)[i_]; }
+		CloudView<T> operator[](difference_type n) const { return (*set_)[i_ + n]; }
+
+		iterator& operator++() { ++i_; return *this; }
+		iterator operator++(int) { auto it = *this; ++i_; return it; }
+		iterator& operator--() { --i_; return *this; }
+		iterator operator--(int) { auto it = *this; --i_; return it; }
+		iterator& operator+=(difference_type n) { i_ += n; return *this; }
+		iterator& operator-=(difference_type n) { i_ -= n; return *this; }
+		iterator operator+(difference_type n) const { return iterator(set_, i_ + n); }
+		iterator operator-(difference_type n) const { return iterator(set_, i_ - n); }
+		difference_type operator-(const iterator& other) const { return static_cast<difference_type>(i_) - static_cast<difference_type>(other.i_); }
+
+		bool operator==(const iterator& other) const { return i_ == other.i_; }
+		bool operator!=(const iterator& other) const { return i_ != other.i_; }
+		bool operator<(const iterator& other) const { return i_ < other.i_; }
+	};
+
+	using const_iterator = iterator;
+
+	// Map a file written by WriteClouds
+	// verify: Also check the checksum of the file (reads the whole file)
+	explicit CloudSet(const std::string& fileName, bool verify = false) :file_{ std::make_shared<MappedFile>(fileName) }
+	{
+		IndexFileReader reader(*file_, "CLOUDSET", 1, verify);
+		const auto& header = reader.Header();
+
+		numClouds_ = static_cast<std::size_t>(header.NumClouds);
+		numPoints_ = static_cast<std::size_t>(header.NumPostings);
+		entries_ = reader.Read<CloudFileEntry>(numClouds_);
+		x_ = reader.Read<float>(numPoints_);
+		y_ = reader.Read<float>(numPoints_);
+
+		for (std::size_t i = 0; i < numClouds_; i++)
+		{
+			if (entries_[i].Offset > numPoints_ || numPoints_ - entries_[i].Offset < entries_[i].NumPoints)
+				throw std::runtime_error("CloudSet: corrupted cloud table in " + fileName);
+		}
+	}
+
+	std::size_t size() const
+	{
+		return numClouds_;
+	}
+
+	bool empty() const
+	{
+		return numClouds_ == 0;
+	}
+
+	// Total points of all clouds
+	std::size_t NumPoints() const
+	{
+		return numPoints_;
+	}
+
+	CloudView<T> operator[](std::size_t i) const
+	{
+		const auto& entry = entries_[i];
+		auto offset = static_cast<std::size_t>(entry.Offset);
+		return CloudView<T>(entry.ID, CloudPoints<T>(x_ + offset, y_ + offset, entry.NumPoints));
+	}
+
+	iterator begin() const
+	{
+		return iterator(this, 0);
+	}
+
+	iterator end() const
+	{
+		return iterator(this, numClouds_);
+	}
+
+	// Copy of all clouds - e.g. query clouds for KNN
+	std::vector<Cloud<T>> ToClouds() const
+	{
+		std::vector<Cloud<T>> pointClouds;
+		pointClouds.reserve(numClouds_);
+
+		for (std::size_t i = 0; i < numClouds_; i++)
+		{
+			pointClouds.push_back((*this)[i].ToCloud());
+		}
+
+		return pointClouds;
+	}
+};
+
+// Write Point Clouds to a binary file readable by CloudSet
+// 1st Parameter: fileName - Full path of the binary file
+// 2nd Parameter: pointClouds - std::vector<Cloud<T>> or CloudSet<T>
+template<typename Clouds> void WriteClouds(const std::string& fileName, const Clouds& pointClouds)
+{
+	std::vector<CloudFileEntry> entries;
+	std::vector<float> x;
+	std::vector<float> y;
+
+	for (const auto& cloud : pointClouds)
+	{
+		CloudFileEntry entry;
+		entry.ID = cloud.ID;
+		entry.NumPoints = static_cast<std::uint32_t>(cloud.Points.size());
+		entry.Offset = x.size();
+		entries.push_back(entry);
+
+		for (const auto& point : cloud.Points)
+		{
+			x.push_back(static_cast<float>(boost::geometry::get<0>(point)));
+			y.push_back(static_cast<float>(boost::geometry::get<1>(point)));
+		}
+	}
+
+	IndexFileWriter writer(fileName, "CLOUDSET", 1);
+	auto& header = writer.Header();
+	header.NumClouds = entries.size();
+	header.NumPostings = x.size();
+
+	writer.Write(entries.data(), entries.size() * sizeof(CloudFileEntry));
+	writer.Write(x.data(), x.size() * sizeof(float));
+	writer.Write(y.data(), y.size() * sizeof(float));
+
+	writer.Close();
+}
+
+// Convert a CSV file (schema of ReadCSV) to a binary Point Cloud file
+// 1st Parameter: csvFileName - Full path of CSV file
+// 2nd Parameter: fileName - Full path of the binary file
+// 3rd Parameter: cmin - Minimum valid coordinate value
+// 4th Parameter: cmax - Maximum valid coordinate value
+// 5th Parameter: header - Flag to indicate that CSV file has a header row
+// Returns the number of clouds written
+inline std::size_t ConvertCSVToClouds(const std::string& csvFileName, const std::string& fileName, int cmin, int cmax, bool header)
+{
+	auto pointClouds = ReadCSV<boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>>(csvFileName, cmin, cmax, header);
+	WriteClouds(fileName, pointClouds);
+
+	return pointClouds.size();
+}
@@ -0,0 +1,356 @@
+#pragma once
+#include "Cloud.h"
+#include "PerformanceReport.h"
+#include "UtilityFunctions.h"
+#include "VoteCounter.h"
+#include "ThreadPool.h"
+#include "QueryCells.h"
+#include <boost/geometry.hpp>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+#include "codecfactory.h"
+
+// Compressed Inverted Grid Index for Point Clouds
+// Every cell keeps the sorted, deduplicated IDs of its clouds (as SuccinctIGI) delta-encoded with a
+// SIMDCompressionLib codec. All cells share one array of 32 bit words, addressed by cell in CSR layout.
+// At query time the list of a cell is decoded into a scratch buffer of the calling thread and voted.
+// T: Point class(2D)
+
+template<typename T = boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>>
+class CompressedIGI
+{
+private:
+	// Start of every cell in words_ - The stream of cell c is [offsets_[c], offsets_[c + 1])
+	std::vector<std::uint64_t> offsets_;
+	std::vector<std::uint32_t> words_;
+	std::unordered_map<unsigned, unsigned> sizeClouds;
+
+	// Streaming build - IDs of every cell until Finalize
+	std::unordered_map<unsigned, std::vector<std::uint32_t>> pendingCells_;
+	std::size_t longestList_ = 0;
+	std::size_t numPostings_ = 0;
+	bool finalized_ = false;
+
+	const std::string name_;
+	const std::string codecName_;
+	const unsigned cmax_;
+	const unsigned delta_;
+	const GridQuantizer grid_;
+
+	// New instance of a codec - CODECFactory::getFromName hands out one instance shared by every caller
+	// and codecs keep internal buffers, so every thread encodes and decodes with its own
+	// Delta coded codecs only, the decoded lists must come out sorted (nullptr for other names)
+	static std::shared_ptr<SIMDCompressionLib::IntegerCODEC> NewCodec(const std::string& name)
+	{
+		using namespace SIMDCompressionLib;
+
+		if (name == "s4-fastpfor-d1")
+			return std::shared_ptr<IntegerCODEC>(new CompositeCodec<SIMDFastPFor<RegularDeltaSIMD>, VariableByte<true>>());
+		if (name == "s4-fastpfor-d2")
+			return std::shared_ptr<IntegerCODEC>(new CompositeCodec<SIMDFastPFor<CoarseDelta2SIMD>, VariableByte<true>>());
+		if (name == "s4-fastpfor-d4")
+			return std::shared_ptr<IntegerCODEC>(new CompositeCodec<SIMDFastPFor<CoarseDelta4SIMD>, VariableByte<true>>());
+		if (name == "s4-fastpfor-dm")
+			return std::shared_ptr<IntegerCODEC>(new CompositeCodec<SIMDFastPFor<Max4DeltaSIMD>, VariableByte<true>>());
+		if (name == "s4-bp128-d1")
+			return std::shared_ptr<IntegerCODEC>(new CompositeCodec<SIMDBinaryPacking<SIMDIntegratedBlockPacker<RegularDeltaSIMD, true>>, VariableByte<true>>());
+		if (name == "s4-bp128-d2")
+			return std::shared_ptr<IntegerCODEC>(new CompositeCodec<SIMDBinaryPacking<SIMDIntegratedBlockPacker<CoarseDelta2SIMD, true>>, VariableByte<true>>());
+		if (name == "s4-bp128-d4")
+			return std::shared_ptr<IntegerCODEC>(new CompositeCodec<SIMDBinaryPacking<SIMDIntegratedBlockPacker<CoarseDelta4SIMD, true>>, VariableByte<true>>());
+		if (name == "s4-bp128-dm")
+			return std::shared_ptr<IntegerCODEC>(new CompositeCodec<SIMDBinaryPacking<SIMDIntegratedBlockPacker<Max4DeltaSIMD, true>>, VariableByte<true>>());
+
+		return nullptr;
+	}
+
+	// Every thread decodes with its own codec and scratch buffer
+	struct Decoder
+	{
+		std::string Name;
+		std::shared_ptr<SIMDCompressionLib::IntegerCODEC> Codec;
+		std::vector<std::uint32_t> Buffer;
+	};
+
+	Decoder& LocalDecoder() const
+	{
+		thread_local Decoder decoder;
+
+		if (decoder.Name != codecName_)
+		{
+			decoder.Codec = NewCodec(codecName_);
+			decoder.Name = codecName_;
+		}
+
+		// Block codecs may write up to a block past the last decoded value
+		auto capacity = longestList_ + 1024;
+		if (decoder.Buffer.size() < capacity)
+			decoder.Buffer.resize(capacity);
+
+		return decoder;
+	}
+
+	// Words of the stream of a cell (nullptr if the cell has no points)
+	const std::uint32_t* Stream(unsigned cell, std::size_t& length) const
+	{
+		length = 0;
+		if (static_cast<std::size_t>(cell) + 1 >= offsets_.size())
+			return nullptr;
+
+		length = static_cast<std::size_t>(offsets_[cell + 1] - offsets_[cell]);
+		return length == 0 ? nullptr : words_.data() + offsets_[cell];
+	}
+
+public:
+
+	// Empty index - Streaming build: Add clouds one at a time, then Finalize
+	// codec: SIMDCompressionLib codec with differential coding - "s4-fastpfor-d1" (PForDelta), "s4-fastpfor-d2",
+	// "s4-fastpfor-d4", "s4-fastpfor-dm", "s4-bp128-d1", "s4-bp128-d2", "s4-bp128-d4" or "s4-bp128-dm"
+	CompressedIGI(std::string name, const unsigned cmax, const unsigned delta, std::string codec = "s4-fastpfor-d1")
+		:name_{ name }, codecName_{ codec }, cmax_{ cmax }, delta_{ delta }, grid_{ cmax, delta }
+	{
+		// Fail early on an unknown codec name - getFromName would silently fall back to "copy"
+		auto names = SIMDCompressionLib::CODECFactory::allNames();
+		if (std::find(std::begin(names), std::end(names), codecName_) == std::end(names))
+			throw std::invalid_argument("CompressedIGI: unknown codec " + codecName_);
+		if (!NewCodec(codecName_))
+			throw std::invalid_argument("CompressedIGI: codec without differential coding " + codecName_);
+	}
+
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	CompressedIGI(const Clouds& pointClouds, std::string name, const unsigned cmax, const unsigned delta, std::string codec = "s4-fastpfor-d1")
+		:CompressedIGI(name, cmax, delta, codec)
+	{
+		AddRange(std::begin(pointClouds), std::end(pointClouds));
+		Finalize();
+	}
+
+	std::string GetName()
+	{
+		return name_;
+	}
+
+	// Add PointCloud to Index
+	// The cloud is searchable after Finalize
+	template<typename C>
+	CompressedIGI& Add(const C& pointCloud)
+	{
+		if (finalized_)
+			throw std::logic_error("CompressedIGI: Add on a finalized index");
+
+		// Get size of all PointCloud for calculate support
+		sizeClouds[pointCloud.ID] += static_cast<unsigned>(pointCloud.Points.size());
+
+		// Cell of every point
+		thread_local std::vector<unsigned> cells;
+		grid_.Cells(pointCloud.Points, cells);
+
+		for (auto cell : cells)
+		{
+			// Inverted Index - Consecutive points of a cloud often share the cell
+			auto& ids = pendingCells_[cell];
+			if (ids.empty() || ids.back() != pointCloud.ID)
+				ids.push_back(pointCloud.ID);
+		}
+
+		return *this;
+	}
+
+	// Add the clouds of [first, last) - e.g. a range of a CloudSet or a chunk read from a file
+	template<typename Iterator>
+	CompressedIGI& AddRange(Iterator first, Iterator last)
+	{
+		for (; first != last; ++first)
+		{
+			Add(*first);
+		}
+
+		return *this;
+	}
+
+	// End of a streaming build - Sort, deduplicate and encode the IDs of every cell
+	CompressedIGI& Finalize()
+	{
+		if (finalized_)
+			return *this;
+
+		finalized_ = true;
+
+		if (pendingCells_.empty())
+			return *this;
+
+		unsigned maxCell{ 0 };
+		for (const auto& pair : pendingCells_)
+		{
+			maxCell = std::max(maxCell, pair.first);
+		}
+
+		// Size in words of every cell
+		offsets_.assign(static_cast<std::size_t>(maxCell) + 2, 0);
+		std::vector<std::vector<std::uint32_t>> encoded(offsets_.size());
+		auto codec = NewCodec(codecName_);
+
+		for (auto& pair : pendingCells_)
+		{
+			auto& ids = pair.second;
+			std::sort(std::begin(ids), std::end(ids));
+			ids.erase(std::unique(std::begin(ids), std::end(ids)), std::end(ids));
+
+			longestList_ = std::max(longestList_, ids.size());
+			numPostings_ += ids.size();
+
+			// The codec applies the differences in place, ids is not used afterwards
+			auto& out = encoded[pair.first];
+			out.resize(ids.size() + 1024);
+			auto length = out.size();
+			codec->encodeArray(ids.data(), ids.size(), out.data(), length);
+
+			// Keep every stream 16 byte aligned for the SIMD decoders
+			out.resize((length + 3) & ~std::size_t{ 3 });
+			out.shrink_to_fit();
+			offsets_[pair.first + 1] = out.size();
+
+			std::vector<std::uint32_t>().swap(ids);
+		}
+
+		std::unordered_map<unsigned, std::vector<std::uint32_t>>().swap(pendingCells_);
+
+		// Prefix sum - Offset of every cell
+		for (std::size_t i = 1; i < offsets_.size(); i++)
+		{
+			offsets_[i] += offsets_[i - 1];
+		}
+
+		words_.reserve(static_cast<std::size_t>(offsets_.back()));
+		for (auto& out : encoded)
+		{
+			words_.insert(std::end(words_), std::begin(out), std::end(out));
+			std::vector<std::uint32_t>().swap(out);
+		}
+
+		return *this;
+	}
+
+	// Decode the IDs of a cell into the scratch buffer of the calling thread
+	// Returns the number of IDs, valid until the next call on the same thread
+	std::size_t Decode(unsigned cell, const std::uint32_t*& ids) const
+	{
+		std::size_t length;
+		auto stream = Stream(cell, length);
+
+		ids = nullptr;
+		if (stream == nullptr)
+			return 0;
+
+		auto& decoder = LocalDecoder();
+		std::size_t decoded = decoder.Buffer.size();
+		decoder.Codec->decodeArray(stream, length, decoder.Buffer.data(), decoded);
+
+		ids = decoder.Buffer.data();
+		return decoded;
+	}
+
+	// KNN Query
+	// First Parameter: queryCloud =  PointCloud
+	// Second Parameter: k = Nearest Neighbors
+	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k) const
+	{
+		auto& count = VoteCounter<>::Local();
+
+		const std::uint32_t* ids;
+
+		// For every distinct cell of the PointCloud - Votes weighted by its number of points
+		for (const auto& queryCell : QueryCells(queryCloud.Points, grid_))
+		{
+			// Decode the posting list of the cell and count frequency of ID's
+			auto size = Decode(queryCell.Cell, ids);
+			for (std::size_t i = 0; i < size; i++)
+			{
+				count.Add(ids[i], queryCell.Count);
+			}
+		}
+
+		// Get k approximate nearest neighbors
+		return count.TopK(k);
+	}
+
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: numThreads = Worker threads
+	std::vector<std::vector<std::pair<unsigned, unsigned>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned numThreads = DefaultThreads()) const
+	{
+		std::vector<std::vector<std::pair<unsigned, unsigned>>> results(queryClouds.size());
+
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
+		{
+			results[i] = KNN(queryClouds[i], k);
+		}, numThreads);
+
+		return results;
+	}
+
+	// Number of IDs stored over all cells
+	std::size_t NumPostings() const
+	{
+		return numPostings_;
+	}
+
+	// Bytes used by the posting lists (cell offsets + compressed words)
+	std::size_t SizeInBytes() const
+	{
+		return offsets_.size() * sizeof(std::uint64_t) + words_.size() * sizeof(std::uint32_t);
+	}
+
+	// Performance report on KNN Search
+	// Obtain Recall@
+	// Average query time, Standard deviation query time, max query time and min query time
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: recallAt = Vector for desired Recall@
+	template<typename D = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const std::vector<unsigned>& recallAt) const
+	{
+		PerformanceReport performance;
+		performance.QueriesTime.reserve(queryClouds.size());
+		performance.RecallAt.reserve(queryClouds.size());
+		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
+
+		// For every cloud in vector of PointClouds
+		for (const auto& cloud : queryClouds)
+		{
+			// Perform KNN search
+			allocations = AllocationCount();
+			start = std::chrono::high_resolution_clock::now();
+			auto result = KNN(cloud, k);
+			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
+
+			GetRecall(performance, result, recallAt, cloud.ID);
+
+			performance.QueriesTime.push_back(std::chrono::duration_cast<D>(end - start).count());
+		}
+		// Calculate Recall@
+		for (auto& pair : performance.RecallAt)
+		{
+			pair.second = pair.second / static_cast<double>(queryClouds.size());
+		}
+
+		TimePerformance(performance);
+		AllocationPerformance(performance);
+
+		return performance;
+	}
+
+};
@@ -1,3 +1,5 @@
+// Count heap allocations per query in the Performance Reports
+#define COUNT_ALLOCATIONS
 #include "Cloud.h"
 #include "Rtree.h"
 #include "IGI.h"
@@ -7,7 +9,12 @@
 #include "BKT.h"
 #include "ShazamHash.h"
 #include "SuccinctIGI.h"
+#include "CompressedIGI.h"
+#include "RoaringIGI.h"
+#include "PyramidIGI.h"
+#include "ShardIPC.h"
 #include "GetCloudsCSV.h"
+#include "CloudFile.h"
 #include "SarrayVPT.h"
 #include "SarrayMetrics.h"
 #include <iostream>
@@ -74,6 +81,42 @@ int main()
 	auto cloudsQuery = ReadCSV<Point>(queriesFileName, 0, 10000, true);
 	auto cloudsIndexing = ReadCSV<Point>(indexingFileName, 0, 10000, true);
 
+	/*/ Binary PointCloud File - Convert the CSV once, later runs map the file without parsing
+	ConvertCSVToClouds(indexingFileName, "nubes_1k.clouds", 0, 10000, true);
+	CloudSet<Point> cloudsIndexingMapped("nubes_1k.clouds");
+	IGI<Point> igiMapped(cloudsIndexingMapped, "IGI", 10000, 10);
+
+	// Streaming build - Clouds are added one at a time while the file is read (rows sorted by ID)
+	IGI<Point> igiStream("IGI", 10000, 10);
+	ForEachCloudCSV<Point>(indexingFileName, 0, 10000, true, [&igiStream](const Cloud<Point>& cloud) { igiStream.Add(cloud); });
+	igiStream.Finalize();
+
+	// Catalogue updates - Published together while queries keep running, removed postings purged by a background compaction
+	igiStream.Replace(cloudsIndexing[0]);
+	igiStream.Remove(cloudsIndexing[1].ID);
+	igiStream.Publish();
+	igiStream.WaitCompaction();
+
+	// Sharded IGI - 4 shards spread over the NUMA nodes, 2 pinned workers each, queries scattered to every shard
+	ShardedIGI<Point> igiSharded(cloudsIndexing, "ShardedIGI", 10000, 10, 4, 2);
+	auto reportSharded = igiSharded.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, { 1, 10, 30 });
+	PrintPerformanceReport(reportSharded, igiSharded.GetName(), "us");
+
+	// Shards in other processes (ShardIPC.h, POSIX) - Every process runs ShardServer<Point>::Listen(shard, path)
+	std::vector<std::unique_ptr<SocketShard<Point>>> remoteShards;
+	remoteShards.emplace_back(new SocketShard<Point>(std::string("/tmp/igi-shard0.sock")));
+	remoteShards.emplace_back(new SocketShard<Point>(std::string("/tmp/igi-shard1.sock")));
+	ShardedIGI<Point, SocketShard<Point>> igiRemote("ShardedIGI (sockets)", std::move(remoteShards));
+	igiRemote.AddRange(std::begin(cloudsIndexing), std::end(cloudsIndexing)).Publish();
+
+	// NUMA placement - One IGI per node built by a pinned thread, batch queries answered by workers of every node
+	// with the copy of their node. Throughput when routed to the local copy vs the copy of another node
+	NumaReplicas<IGI<Point>> igiReplicas([&cloudsIndexing] { IGI<Point> igi(cloudsIndexing, "IGI", 10000, 10); igi.Compact(); return igi; }, NumaPlacement::Replicated);
+	auto knn = [](const IGI<Point>& igi, const Cloud<Point>& cloud) { return igi.KNN(cloud, 1); };
+	auto resultsReplicas = igiReplicas.KNNBatch(cloudsQuery, knn);
+	auto numa = igiReplicas.LocalRemoteThroughput(cloudsQuery, knn);
+	std::cout << "IGI replicas (queries/s) - Local: " << numa.first << " Remote: " << numa.second << '\n';*/
+
 	std::cout << "--------------------------------------------------" << '\n';
 
 	//---------------------------------------------------------------------------
@@ -92,6 +135,7 @@ int main()
 
 	// Inverted Grid Index
 	IGI<Point> igi2(cloudsIndexing, "IGI", 10000, 10);
+	igi2.Compact();
 
 	// ShazamHash
 	ShazamHashParameters param2(1, 0, 500, 500, 10);
@@ -114,6 +158,15 @@ int main()
 	// SuccinctIGI
 	SuccinctIGI<Point> sIGI2(cloudsIndexing, "SuccinctIGI", 10000, 10);
 
+	// CompressedIGI
+	CompressedIGI<Point> cIGI2(cloudsIndexing, "CompressedIGI", 10000, 10);
+
+	// RoaringIGI
+	RoaringIGI<Point> rIGI2(cloudsIndexing, "RoaringIGI", 10000, 10);
+
+	// PyramidIGI - Grids of delta 10, 20 and 40 in one index
+	PyramidIGI<Point> pIGI2(cloudsIndexing, "PyramidIGI", 10000, 10, 3);
+
 	// SarrayVPT
 	//SarrayVPT<Point, HammingDistance> sarrayVPT2("SarrayVPT", 10000, 10);
 	//sarrayVPT2.Build(cloudsIndexing);*/
@@ -124,26 +177,52 @@ int main()
 
 	/*/ Performance Test
 	auto reportRtree = rtree2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, 1, recall);
-	auto reportIGI = igi2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, recall);
+	auto reportIGI = igi2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, { 1, 10, 30 });
+	// Also vote the 3x3 neighborhood of every query cell
+	auto reportIGIRange = igi2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, recall, Voting::Points, 1);
+	// Rank by support (votes / size of the cloud) instead of raw votes
+	auto reportIGISupport = igi2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, recall, Voting::Points, 0, Scoring::Support);
 	auto reportShazam = shazam2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, recall, param2);
 	auto reportVPT = vpt2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, 1, recall);
 	*/auto reportBKT = bkt2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, 1, recall);
 	/*auto reportIGIVpt = igiVPT2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, 1, recall);
 	auto reportIGIRtree = igiRtree2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, 1, recall);
-	auto reportSuccinctIGI = sIGI2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, recall);
+	auto reportSuccinctIGI = sIGI2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, { 1, 10, 30 });
+	auto reportCompressedIGI = cIGI2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, { 1, 10, 30 });
+	auto reportRoaringIGI = rIGI2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, { 1, 10, 30 });
+	auto reportPyramidIGI = pIGI2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, recall, 64);
 	//auto reportSarrayVPT = sarrayVPT2.KNNPerformanceReport<std::chrono::microseconds>(cloudsQuery, 1, 1, recall);
 
 
 	// Print Performance Report
 	PrintPerformanceReport(reportRtree, rtree2.GetName(), "us");
 	PrintPerformanceReport(reportIGI, igi2.GetName(), "us");
+	PrintPerformanceReport(reportIGIRange, igi2.GetName() + " (radius 1)", "us");
+	PrintPerformanceReport(reportIGISupport, igi2.GetName() + " (support)", "us");
 	PrintPerformanceReport(reportShazam, shazam2.GetName(), "us");
 	PrintPerformanceReport(reportVPT, vpt2.GetName(), "us");
 	*/PrintPerformanceReport(reportBKT, bkt2.GetName(), "us");
 	/*PrintPerformanceReport(reportIGIRtree, igiRtree2.GetName(), "us");
 	PrintPerformanceReport(reportIGIVpt, igiVPT2.GetName(), "us");
 	PrintPerformanceReport(reportSuccinctIGI, sIGI2.GetName(), "us");
+	PrintPerformanceReport(reportCompressedIGI, cIGI2.GetName(), "us");
+	PrintPerformanceReport(reportRoaringIGI, rIGI2.GetName(), "us");
+	PrintPerformanceReport(reportPyramidIGI, pIGI2.GetName(), "us");
+	std::cout << "Posting list bytes - IGI: " << igi2.SizeInBytes() << " CompressedIGI: " << cIGI2.SizeInBytes() << " RoaringIGI: " << rIGI2.SizeInBytes() << " PyramidIGI: " << pIGI2.SizeInBytes() << '\n';
 	//PrintPerformanceReport(reportSarrayVPT, sarrayVPT2.GetName(), "us");
+
+	// Posting list decode throughput of SuccinctIGI: select per ID vs sequential
+	auto decode = sIGI2.DecodePerformance();
+	std::cout << "SuccinctIGI decode (IDs/s) - Select: " << decode.first << " Sequential: " << decode.second << '\n';
+
+	// Cell computation throughput of the query points: floor divisions vs GridQuantizer
+	std::vector<Point> queryPoints;
+	for (const auto& cloud : cloudsQuery)
+	{
+		queryPoints.insert(std::end(queryPoints), std::begin(cloud.Points), std::end(cloud.Points));
+	}
+	auto quantizer = GridQuantizer(10000, 10).Performance(queryPoints);
+	std::cout << "Cells (points/s) - Division: " << quantizer.first << " GridQuantizer: " << quantizer.second << '\n';
 	*/
 	getchar();
 
@@ -1,13 +1,151 @@
 #pragma once
-#include <fstream>
-#include <sstream>
 #include <vector>
 #include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
 #include "Cloud.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
 
 // Miguel Ramirez Chacon
 // 17/05/17
 
+// Parse a decimal number at p: [spaces] [sign] digits [. digits] [e [sign] digits] [spaces]
+// p is advanced past the number - Returns false if there are no digits
+inline bool ParseCSVNumber(const char*& p, const char* end, double& value)
+{
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	bool negative{ false };
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	std::uint64_t mantissa{ 0 };
+	int exponent{ 0 };
+	int digits{ 0 };
+
+	// Integer part - Digits beyond 19 only scale the value
+	for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+	{
+		if (mantissa < 1000000000000000000ull)
+			mantissa = mantissa * 10 + (*p - '0');
+		else
+			exponent++;
+	}
+
+	// Fraction
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+		{
+			if (mantissa < 1000000000000000000ull)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				exponent--;
+			}
+		}
+	}
+
+	if (digits == 0)
+		return false;
+
+	// Exponent
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* q = p + 1;
+		bool negativeExponent{ false };
+		if (q < end && (*q == '-' || *q == '+'))
+		{
+			negativeExponent = *q == '-';
+			q++;
+		}
+
+		if (q < end && *q >= '0' && *q <= '9')
+		{
+			int e{ 0 };
+			for (; q < end && *q >= '0' && *q <= '9'; q++)
+			{
+				if (e < 10000)
+					e = e * 10 + (*q - '0');
+			}
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+
+	// Exact powers of ten: one rounding when the mantissa fits in 53 bits
+	auto m = static_cast<double>(mantissa);
+	if (exponent >= 0)
+		value = exponent <= 22 ? m * powers[exponent] : m * std::pow(10.0, exponent);
+	else
+		value = exponent >= -22 ? m / powers[-exponent] : m * std::pow(10.0, exponent);
+
+	if (negative)
+		value = -value;
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	return true;
+}
+
+// Parse the row (ID, X, Y) at p and advance p to the start of the next row
+// Returns false if the row doesn't start with 3 numbers (extra columns are ignored)
+// or if the point is outside [cmin, cmax]
+inline bool ParseCSVRow(const char*& p, const char* end, int cmin, int cmax, double(&row)[3])
+{
+	const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+	if (lineEnd == nullptr)
+		lineEnd = end;
+
+	bool valid{ true };
+	for (int i = 0; i < 3 && valid; i++)
+	{
+		valid = ParseCSVNumber(p, lineEnd, row[i]) && (i == 2 || (p < lineEnd && *p++ == ','));
+	}
+
+	p = lineEnd + 1;
+
+	return valid && row[0] >= 0 && row[1] >= cmin && row[2] >= cmin && row[1] <= cmax && row[2] <= cmax;
+}
+
+// Parse the rows of [begin, end) into pointCloudsMap - begin must be at the start of a row
+template<typename T> void ParseCSVChunk(const char* begin, const char* end, int cmin, int cmax, std::unordered_map<unsigned, std::vector<T>>& pointCloudsMap)
+{
+	const char* p = begin;
+	double row[3];
+
+	while (p < end)
+	{
+		if (ParseCSVRow(p, end, cmin, cmax, row))
+		{
+			pointCloudsMap[static_cast<unsigned>(row[0])].push_back(T(row[1], row[2]));
+		}
+	}
+}
+
+// Start of the rows of a mapped CSV file
+inline const char* SkipCSVHeader(const char* begin, const char* end, bool header)
+{
+	if (!header || begin == end)
+		return begin;
+
+	const char* lineEnd = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+	return lineEnd == nullptr ? end : lineEnd + 1;
+}
+
 // Function to get PointClouds from CSV file
 // File must comply with the following schema:
 // ID, X, Y
@@ -15,44 +153,57 @@
 // 2nd Parameter: cmin - Minimum valid coordinate value
 // 3rd Parameter: cmax - Maximum valid coordinate value
 // 4th Parameter: header - Flag to indicate that file has a header row
-template<typename T> std::vector<Cloud<T>> ReadCSV(std::string fileName, int cmin, int cmax, bool header)
+// 5th Parameter: numThreads - The file is memory mapped and split in numThreads chunks parsed in parallel
+// Points of a cloud keep the order of the file. A missing file gives no clouds
+template<typename T> std::vector<Cloud<T>> ReadCSV(std::string fileName, int cmin, int cmax, bool header, unsigned numThreads = DefaultThreads())
 {
-	std::unordered_map<unsigned, std::vector<T>> pointCloudsMap;
+	std::unique_ptr<MappedFile> file;
 
-	std::ifstream inputFile{ fileName };
-	std::string line;
-	std::string item;
-
-	std::vector<double> temp;
-	temp.reserve(3);
-
-	if (inputFile)
+	try
 	{
-		while (getline(inputFile, line) && !inputFile.eof())
-		{
-			temp.clear();
+		file.reset(new MappedFile(fileName));
+	}
+	catch (const std::runtime_error&)
+	{
+		return std::vector<Cloud<T>>();
+	}
 
-			// Skip header
-			if (header)
-			{
-				header = false;
-				continue;
-			}
+	const char* end = file->Data() + file->Size();
+	const char* begin = SkipCSVHeader(file->Data(), end, header);
 
-			std::stringstream lineStream{ line };
+	// Chunk boundaries at the start of a line
+	std::size_t size = end - begin;
+	numThreads = static_cast<unsigned>(std::max<std::size_t>(1, std::min<std::size_t>(std::max(numThreads, 1u), size / (1 << 20))));
+	std::vector<const char*> bounds{ begin };
 
-			while (getline(lineStream, item, ','))
-			{
-				temp.push_back(std::stof(item));
-			}
+	for (unsigned i = 1; i < numThreads; i++)
+	{
+		const char* bound = std::max(begin + size * i / numThreads, bounds.back());
+		const char* lineEnd = static_cast<const char*>(std::memchr(bound, '\n', end - bound));
+		bounds.push_back(lineEnd == nullptr ? end : lineEnd + 1);
+	}
+	bounds.push_back(end);
 
-			if (temp[0] >= 0 && temp[1] >= cmin && temp[2] >= cmin && temp[1] <= cmax && temp[2] <= cmax)
-			{
-				pointCloudsMap[static_cast<unsigned>(temp[0])].push_back(T(temp[1], temp[2]));
-			}
+	std::vector<std::unordered_map<unsigned, std::vector<T>>> chunkMaps(numThreads);
+
+	ThreadPool::Default().ParallelFor(numThreads, [&](std::size_t i, unsigned)
+	{
+		ParseCSVChunk<T>(bounds[i], bounds[i + 1], cmin, cmax, chunkMaps[i]);
+	}, numThreads);
 
+	// Merge chunks in file order
+	auto& pointCloudsMap = chunkMaps[0];
+	for (std::size_t i = 1; i < chunkMaps.size(); i++)
+	{
+		for (auto& pair : chunkMaps[i])
+		{
+			auto& points = pointCloudsMap[pair.first];
+			if (points.empty())
+				points = std::move(pair.second);
+			else
+				points.insert(std::end(points), std::begin(pair.second), std::end(pair.second));
 		}
-		inputFile.close();
+		std::unordered_map<unsigned, std::vector<T>>().swap(chunkMaps[i]);
 	}
 
 	std::vector<Cloud<T>> pointClouds;
@@ -60,13 +211,65 @@ template<typename T> std::vector<Cloud<T>> ReadCSV(std::string fileName, int cmi
 
 	for (auto& pair : pointCloudsMap)
 	{
-		Cloud<T> cloud{ pair.first };
-		cloud.Points = std::move(pair.second);
-		pointClouds.push_back(cloud);
+		pointClouds.emplace_back(pair.first);
+		pointClouds.back().Points = std::move(pair.second);
 	}
 
 	return pointClouds;
 }
 
+// Stream the PointClouds of a CSV file one at a time - The file is never held as a whole in clouds
+// Same schema and filters as ReadCSV, but the rows of a cloud must be consecutive (e.g. file sorted by ID):
+// a new cloud starts every time the ID changes
+// 1st Parameter: fileName - Full path of CSV file
+// 2nd Parameter: cmin - Minimum valid coordinate value
+// 3rd Parameter: cmax - Maximum valid coordinate value
+// 4th Parameter: header - Flag to indicate that file has a header row
+// 5th Parameter: f - Called with every Cloud<T>, e.g. to Add it to an index
+// Returns the number of clouds - A missing file gives no clouds
+template<typename T, typename F> std::size_t ForEachCloudCSV(std::string fileName, int cmin, int cmax, bool header, const F& f)
+{
+	std::unique_ptr<MappedFile> file;
+
+	try
+	{
+		file.reset(new MappedFile(fileName));
+	}
+	catch (const std::runtime_error&)
+	{
+		return 0;
+	}
+
+	const char* end = file->Data() + file->Size();
+	const char* p = SkipCSVHeader(file->Data(), end, header);
 
+	Cloud<T> cloud{ 0 };
+	std::size_t numClouds{ 0 };
+	double row[3];
 
+	while (p < end)
+	{
+		if (!ParseCSVRow(p, end, cmin, cmax, row))
+			continue;
+
+		auto id = static_cast<unsigned>(row[0]);
+
+		if (id != cloud.ID && !cloud.Points.empty())
+		{
+			f(static_cast<const Cloud<T>&>(cloud));
+			numClouds++;
+			cloud.Points.clear();
+		}
+
+		cloud.ID = id;
+		cloud.Points.push_back(T(row[1], row[2]));
+	}
+
+	if (!cloud.Points.empty())
+	{
+		f(static_cast<const Cloud<T>&>(cloud));
+		numClouds++;
+	}
+
+	return numClouds;
+}
@@ -0,0 +1,355 @@
+#pragma once
+#include <boost/geometry.hpp>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <type_traits>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define GRID_QUANTIZER_AVX2
+#elif defined(__SSE4_1__) || defined(__AVX__)
+#include <smmintrin.h>
+#define GRID_QUANTIZER_SSE
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GRID_QUANTIZER_SSE
+#endif
+
+// Cell of a point in the grid of the inverted grid indexes
+// cell = floor(x / delta) + (cmax / delta) * floor(y / delta)
+// The division is replaced by a multiplication by 1 / delta and a correction step, so the axis index is
+// exactly floor(x / delta) even when the rounded product lands on the wrong side of a cell border
+// Blocks of points are converted 8 (AVX2) or 4 (SSE4.1, SSE2) at a time from separate x and y arrays or straight from
+// an array of (x, y) float points, the scalar path computes the same values so build and query always agree
+// Points with double (or integer) coordinates are converted one at a time in double, never rounded to float
+
+template<typename T> class CloudPoints;
+
+class GridQuantizer
+{
+private:
+	float delta_;
+	float reciprocal_;
+	unsigned cellsPerRow_;
+
+	// Points converted per block when gathering x and y from a sequence of points
+	static const std::size_t blockSize = 256;
+
+	unsigned Axis(float v) const
+	{
+		auto q = std::floor(v * reciprocal_);
+
+		if (q * delta_ > v)
+			q -= 1.0f;
+		if ((q + 1.0f) * delta_ <= v)
+			q += 1.0f;
+
+		return static_cast<unsigned>(static_cast<int>(q));
+	}
+
+	// Same correction in double - q * delta is exact for every grid that fits in an unsigned
+	unsigned Axis(double v) const
+	{
+		const double delta{ delta_ };
+		auto q = std::floor(v / delta);
+
+		if (q * delta > v)
+			q -= 1.0;
+		if ((q + 1.0) * delta <= v)
+			q += 1.0;
+
+		return static_cast<unsigned>(static_cast<int>(q));
+	}
+
+	template<typename P>
+	using HasFloatCoordinates = std::is_same<typename boost::geometry::coordinate_type<P>::type, float>;
+
+	// Points read in place by CellsInterleaved: two floats, x first, nothing else
+	template<typename P>
+	using IsFloatPair = std::integral_constant<bool, HasFloatCoordinates<P>::value && sizeof(P) == 2 * sizeof(float) && std::is_standard_layout<P>::value>;
+
+#if defined(GRID_QUANTIZER_AVX2)
+	__m256i Axis8(__m256 v) const
+	{
+		const auto one = _mm256_set1_ps(1.0f);
+		const auto delta = _mm256_set1_ps(delta_);
+
+		auto q = _mm256_floor_ps(_mm256_mul_ps(v, _mm256_set1_ps(reciprocal_)));
+
+		auto over = _mm256_cmp_ps(_mm256_mul_ps(q, delta), v, _CMP_GT_OQ);
+		q = _mm256_sub_ps(q, _mm256_and_ps(over, one));
+		auto under = _mm256_cmp_ps(_mm256_mul_ps(_mm256_add_ps(q, one), delta), v, _CMP_LE_OQ);
+		q = _mm256_add_ps(q, _mm256_and_ps(under, one));
+
+		return _mm256_cvttps_epi32(q);
+	}
+#elif defined(GRID_QUANTIZER_SSE)
+	static __m128 Floor4(__m128 v)
+	{
+#if defined(__SSE4_1__) || defined(__AVX__)
+		return _mm_floor_ps(v);
+#else
+		// Truncate, then step down the negative values that were rounded up
+		auto t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+		return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.0f)));
+#endif
+	}
+
+	static __m128i MultiplyLow4(__m128i a, __m128i b)
+	{
+#if defined(__SSE4_1__) || defined(__AVX__)
+		return _mm_mullo_epi32(a, b);
+#else
+		// Products of lanes 0, 2 and lanes 1, 3, low 32 bits interleaved back
+		auto even = _mm_mul_epu32(a, b);
+		auto odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+		return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+	}
+
+	__m128i Axis4(__m128 v) const
+	{
+		const auto one = _mm_set1_ps(1.0f);
+		const auto delta = _mm_set1_ps(delta_);
+
+		auto q = Floor4(_mm_mul_ps(v, _mm_set1_ps(reciprocal_)));
+
+		auto over = _mm_cmpgt_ps(_mm_mul_ps(q, delta), v);
+		q = _mm_sub_ps(q, _mm_and_ps(over, one));
+		auto under = _mm_cmple_ps(_mm_mul_ps(_mm_add_ps(q, one), delta), v);
+		q = _mm_add_ps(q, _mm_and_ps(under, one));
+
+		return _mm_cvttps_epi32(q);
+	}
+#endif
+
+public:
+	GridQuantizer(const unsigned cmax, const unsigned delta)
+		:delta_{ static_cast<float>(delta) }, reciprocal_{ 1.0f / static_cast<float>(delta) }, cellsPerRow_{ cmax / delta } {}
+
+	unsigned CellsPerRow() const
+	{
+		return cellsPerRow_;
+	}
+
+	// Cell of one point
+	unsigned Cell(float x, float y) const
+	{
+		return Axis(x) + cellsPerRow_*Axis(y);
+	}
+
+	template<typename P>
+	unsigned Cell(const P& point) const
+	{
+		return Cell(point, HasFloatCoordinates<P>());
+	}
+
+	// Cells of n points given as separate x and y arrays
+	void Cells(const float* xs, const float* ys, std::size_t n, unsigned* cells) const
+	{
+		std::size_t i{ 0 };
+
+#if defined(GRID_QUANTIZER_AVX2)
+		const auto row = _mm256_set1_epi32(static_cast<int>(cellsPerRow_));
+
+		for (; i + 8 <= n; i += 8)
+		{
+			auto px = Axis8(_mm256_loadu_ps(xs + i));
+			auto py = Axis8(_mm256_loadu_ps(ys + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(cells + i), _mm256_add_epi32(px, _mm256_mullo_epi32(py, row)));
+		}
+#elif defined(GRID_QUANTIZER_SSE)
+		const auto row = _mm_set1_epi32(static_cast<int>(cellsPerRow_));
+
+		for (; i + 4 <= n; i += 4)
+		{
+			auto px = Axis4(_mm_loadu_ps(xs + i));
+			auto py = Axis4(_mm_loadu_ps(ys + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(cells + i), _mm_add_epi32(px, MultiplyLow4(py, row)));
+		}
+#endif
+
+		for (; i < n; i++)
+		{
+			cells[i] = Cell(xs[i], ys[i]);
+		}
+	}
+
+	// Cells of n points stored as x0, y0, x1, y1, ...
+	void CellsInterleaved(const float* xy, std::size_t n, unsigned* cells) const
+	{
+		std::size_t i{ 0 };
+
+#if defined(GRID_QUANTIZER_AVX2)
+		const auto row = _mm256_set1_epi32(static_cast<int>(cellsPerRow_));
+
+		for (; i + 8 <= n; i += 8)
+		{
+			auto low = _mm256_loadu_ps(xy + 2 * i);
+			auto high = _mm256_loadu_ps(xy + 2 * i + 8);
+
+			// x0 x1 x4 x5 x2 x3 x6 x7 -> x0 ... x7 (same for y)
+			auto xs = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0)));
+			auto ys = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0)));
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(cells + i), _mm256_add_epi32(Axis8(xs), _mm256_mullo_epi32(Axis8(ys), row)));
+		}
+#elif defined(GRID_QUANTIZER_SSE)
+		const auto row = _mm_set1_epi32(static_cast<int>(cellsPerRow_));
+
+		for (; i + 4 <= n; i += 4)
+		{
+			auto low = _mm_loadu_ps(xy + 2 * i);
+			auto high = _mm_loadu_ps(xy + 2 * i + 4);
+
+			auto xs = _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0));
+			auto ys = _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(cells + i), _mm_add_epi32(Axis4(xs), MultiplyLow4(Axis4(ys), row)));
+		}
+#endif
+
+		for (; i < n; i++)
+		{
+			cells[i] = Cell(xy[2 * i], xy[2 * i + 1]);
+		}
+	}
+
+	// Cells of a vector of points - Points made of exactly two floats are read in place
+	template<typename T>
+	void Cells(const std::vector<T>& points, std::vector<unsigned>& cells) const
+	{
+		Cells(points, cells, IsFloatPair<T>());
+	}
+
+	// Cells of a sequence of points - x and y of float points are gathered in blocks
+	template<typename Points>
+	void Cells(const Points& points, std::vector<unsigned>& cells) const
+	{
+		GatherCells(points, cells, HasFloatCoordinates<typename Points::value_type>());
+	}
+
+	// Points of a CloudSet are already stored as x and y columns
+	template<typename T>
+	void Cells(const CloudPoints<T>& points, std::vector<unsigned>& cells) const
+	{
+		cells.resize(points.size());
+		Cells(points.X(), points.Y(), points.size(), cells.data());
+	}
+
+	// Throughput of the cell computation in points per second
+	// Every point is converted repetitions times with floor divisions (as the indexes did before) and with Cells
+	// Returns (division, quantizer)
+	template<typename Points>
+	std::pair<double, double> Performance(const Points& points, const unsigned repetitions = 10) const
+	{
+		std::vector<unsigned> cells;
+		std::uint64_t sumDivision{ 0 };
+		std::uint64_t sumQuantizer{ 0 };
+		auto delta = static_cast<unsigned>(delta_);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (unsigned r = 0; r < repetitions; r++)
+		{
+			for (const auto& point : points)
+			{
+				auto px = static_cast<unsigned>(std::floor(boost::geometry::get<0>(point) / delta));
+				auto py = static_cast<unsigned>(std::floor(boost::geometry::get<1>(point) / delta));
+				sumDivision += px + cellsPerRow_*py;
+			}
+		}
+		auto middle = std::chrono::high_resolution_clock::now();
+
+		for (unsigned r = 0; r < repetitions; r++)
+		{
+			Cells(points, cells);
+			for (auto cell : cells)
+			{
+				sumQuantizer += cell;
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		// Keep the loops from being optimized away
+		volatile auto sink = sumDivision + sumQuantizer;
+		(void)sink;
+
+		auto total = static_cast<double>(points.size()) * repetitions;
+		auto divisionSeconds = std::chrono::duration<double>(middle - start).count();
+		auto quantizerSeconds = std::chrono::duration<double>(end - middle).count();
+
+		return std::make_pair(divisionSeconds > 0 ? total / divisionSeconds : 0.0, quantizerSeconds > 0 ? total / quantizerSeconds : 0.0);
+	}
+
+private:
+	template<typename P>
+	unsigned Cell(const P& point, std::true_type) const
+	{
+		return Cell(boost::geometry::get<0>(point), boost::geometry::get<1>(point));
+	}
+
+	template<typename P>
+	unsigned Cell(const P& point, std::false_type) const
+	{
+		return Axis(static_cast<double>(boost::geometry::get<0>(point))) + cellsPerRow_*Axis(static_cast<double>(boost::geometry::get<1>(point)));
+	}
+
+	template<typename Points>
+	void GatherCells(const Points& points, std::vector<unsigned>& cells, std::true_type) const
+	{
+		float xs[blockSize]{};
+		float ys[blockSize]{};
+
+		cells.resize(points.size());
+
+		std::size_t done{ 0 };
+		std::size_t filled{ 0 };
+
+		for (const auto& point : points)
+		{
+			xs[filled] = boost::geometry::get<0>(point);
+			ys[filled] = boost::geometry::get<1>(point);
+
+			if (++filled == blockSize)
+			{
+				Cells(xs, ys, filled, cells.data() + done);
+				done += filled;
+				filled = 0;
+			}
+		}
+
+		Cells(xs, ys, filled, cells.data() + done);
+	}
+
+	template<typename Points>
+	void GatherCells(const Points& points, std::vector<unsigned>& cells, std::false_type) const
+	{
+		cells.resize(points.size());
+
+		std::size_t i{ 0 };
+		for (const auto& point : points)
+		{
+			cells[i++] = Cell(point, std::false_type());
+		}
+	}
+
+	template<typename T>
+	void Cells(const std::vector<T>& points, std::vector<unsigned>& cells, std::true_type) const
+	{
+		static_assert(sizeof(T) == 2 * sizeof(float) && std::is_standard_layout<T>::value, "points read in place must be two floats");
+
+		cells.resize(points.size());
+		CellsInterleaved(reinterpret_cast<const float*>(points.data()), points.size(), cells.data());
+	}
+
+	template<typename T>
+	void Cells(const std::vector<T>& points, std::vector<unsigned>& cells, std::false_type) const
+	{
+		GatherCells(points, cells, HasFloatCoordinates<T>());
+	}
+};
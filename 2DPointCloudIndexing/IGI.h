@@ -2,6 +2,13 @@
 #include "Cloud.h"
 #include "PerformanceReport.h"
 #include "UtilityFunctions.h"
+#include "VoteCounter.h"
+#include "ThreadPool.h"
+#include "PostingLists.h"
+#include "QueryCells.h"
+#include "IndexFile.h"
+#include "Scoring.h"
+#include "ChunkedArray.h"
 #include <boost/geometry.hpp>
 #include <vector>
 #include <unordered_map>
@@ -9,6 +16,14 @@
 #include <chrono>
 #include <cmath>
 #include <string>
+#include <stdexcept>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <cstdint>
+#include <cstring>
 
 // Miguel Ramirez Chacon
 // 19/05/17
@@ -33,31 +48,360 @@ year = {2014}
 }
 */
 
+// Clouds can be added, removed or replaced while queries run, and queries never wait for a writer to build its changes (RCU):
+// - View: immutable snapshot of the index - Layers of CSR posting lists (the base built by the last compaction,
+// then the sparse segments published since) and per ID tables of cloud sizes and tombstones (ChunkedArray)
+// Queries take the current view with one atomic shared_ptr load and keep it to the end, writers publish
+// a new view with an atomic store. A view is freed by the last query still using it
+// The shared_ptr atomics are not lock-free in the usual standard libraries (a spinlock per address),
+// so the load of a query may wait for the pointer copy of a concurrent load or store, never for more
+// - Writers buffer Add, Remove and Replace in a hash map Inverted Index. Publish turns the buffer into a new segment
+// and publishes it with the tables in a single view, so queries see all the changes of a batch or none
+// - Tombstones: sequence number of the first layer where the postings of an ID are alive. A removed cloud
+// is skipped in the older layers (SkipVotes) until a compaction drops its postings
+// - Compaction merges all layers into a new base without dead postings, in the background once removed clouds
+// exceed the garbage threshold or segments pile up. Segments published meanwhile stay on top of the new base
 // T: Point class(2D)
 
 template<typename T = boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>>
 class IGI
 {
 private:
+	// Posting lists of a layer - Sequence numbers grow from the base to the newest segment
+	struct Layer
+	{
+		PostingLists Lists;
+		std::uint32_t Sequence;
+	};
+
+	// Published state of the index - Never modified once published
+	struct View
+	{
+		// Base first, newest segment last
+		std::vector<Layer> Layers;
+
+		// Points of every cloud (missingCloud: not in the index)
+		ChunkedArray<unsigned> Sizes{ missingCloud };
+
+		// Postings of an ID in layers older than AliveFrom are dead
+		ChunkedArray<std::uint32_t> AliveFrom;
+
+		// Largest AliveFrom - Layers at least as new need no filtering
+		std::uint32_t NewestTombstone = 0;
+		std::size_t NumClouds = 0;
+
+		bool IsDead(const Layer& layer, unsigned id) const
+		{
+			return AliveFrom.Get(id) > layer.Sequence;
+		}
+
+		// A single layer without dead postings - Nothing left to compact
+		bool IsMerged() const
+		{
+			return Layers.size() == 1 && NewestTombstone <= Layers[0].Sequence;
+		}
+	};
+
+	static const unsigned missingCloud = static_cast<unsigned>(-1);
+
+	// Writer: Add, Remove, Replace, Publish and the swap at the end of a compaction - Never taken by queries
+	// Compaction: one compaction at a time
+	// Background: guards Running, the compaction started on its own
+	struct Locks
+	{
+		std::mutex Writer;
+		std::mutex Compaction;
+		std::mutex Background;
+		std::future<void> Running;
+	};
+
+	// Owner of the locks - Moving it waits for the background compaction, which runs on the moved index
+	struct LocksHolder
+	{
+		std::unique_ptr<Locks> Pointer{ new Locks };
+
+		LocksHolder() = default;
+
+		LocksHolder(LocksHolder&& other)
+		{
+			if (other.Pointer)
+			{
+				std::lock_guard<std::mutex> background(other.Pointer->Background);
+				if (other.Pointer->Running.valid())
+					other.Pointer->Running.wait();
+			}
+
+			Pointer = std::move(other.Pointer);
+		}
+
+		Locks* operator->() const
+		{
+			return Pointer.get();
+		}
+
+		explicit operator bool() const
+		{
+			return static_cast<bool>(Pointer);
+		}
+	};
+
+	// Declared first: moved before the state the background compaction works on
+	LocksHolder locks_;
+
+	std::shared_ptr<const View> view_;
+
+	// Writer state - Buffered changes and the tables of the next view
 	std::unordered_map<unsigned, std::vector<unsigned>> IGI_index;
-	std::unordered_map<unsigned, unsigned> sizeClouds;
+	std::unordered_map<unsigned, std::vector<unsigned>> pendingCells_;
+	bool pendingChanges_ = false;
+	ChunkedArray<unsigned> sizes_{ missingCloud };
+	ChunkedArray<std::uint32_t> aliveFrom_;
+	std::uint32_t newestTombstone_ = 0;
+	std::uint32_t nextSequence_ = 1;
+	std::size_t numClouds_ = 0;
+	bool compacted_ = false;
+	bool weighted_ = false;
+
+	// Garbage - Points of removed clouds still in the posting lists, points of the clouds in the index
+	std::size_t deadPoints_ = 0;
+	std::size_t numPoints_ = 0;
+	double garbageThreshold_ = 0.25;
+	bool autoCompaction_ = true;
+	std::size_t maxSegments_ = 8;
+	std::size_t publishPoints_ = 0;
+	std::size_t pendingPoints_ = 0;
+
 	std::string name_;
 	const unsigned cmax_;
 	const unsigned delta_;
+	const GridQuantizer grid_;
 
-public:
+	std::shared_ptr<const View> Current() const
+	{
+		return std::atomic_load(&view_);
+	}
 
-	// Build index from vector of Point Clouds
-	IGI(const std::vector<Cloud<T>>& pointClouds, std::string name, const unsigned cmax, const unsigned delta) :name_{ name }, cmax_{ cmax }, delta_{ delta }
+	// Vote the lists of a cell in every layer of a view - Dead postings are skipped
+	// vote(list, counter): Add the votes of a PostingSpan to counter (the counter or a SkipVotes over it)
+	template<typename Counter, typename VoteList>
+	static void VoteLists(const View& view, Counter& count, unsigned cell, const VoteList& vote)
+	{
+		for (const auto& layer : view.Layers)
+		{
+			auto list = layer.Lists.Find(cell);
+			if (list.empty())
+				continue;
+
+			if (view.NewestTombstone <= layer.Sequence)
+			{
+				vote(list, count);
+				continue;
+			}
+
+			auto dead = [&view, &layer](unsigned id) {return view.IsDead(layer, id); };
+			SkipVotes<Counter, decltype(dead)> live(count, dead);
+			vote(list, live);
+		}
+	}
+
+	// Add the votes of the lists of a cell in every layer of a view
+	template<typename Counter, typename Times>
+	static void Vote(const View& view, Counter& count, unsigned cell, Voting voting, Times times)
+	{
+		VoteLists(view, count, cell, [voting, times](const PostingSpan& list, auto& counter) { list.Vote(counter, voting, times); });
+	}
+
+	// Clouds with points in a cell over every layer (removed clouds not compacted yet included)
+	static std::size_t CellClouds(const View& view, unsigned cell)
+	{
+		std::size_t clouds{ 0 };
+		for (const auto& layer : view.Layers)
+		{
+			clouds += layer.Lists.Find(cell).NumClouds();
+		}
+		return clouds;
+	}
+
+	// Posting lists of all layers of a view merged in one, without dead postings
+	static PostingLists Merge(const View& view, bool weighted)
+	{
+		std::vector<const PostingLists*> lists;
+		for (const auto& layer : view.Layers)
+		{
+			lists.push_back(&layer.Lists);
+		}
+
+		return PostingLists(lists, [&view](std::size_t l, unsigned id) {return view.IsDead(view.Layers[l], id); }, weighted);
+	}
+
+	// Buffer the points of a cloud - Caller holds the Writer lock
+	void Insert(unsigned id, std::size_t numPoints, const std::vector<unsigned>& cells)
+	{
+		auto size = sizes_.Get(id);
+		if (size == missingCloud)
+		{
+			size = 0;
+			numClouds_++;
+		}
+
+		// Get size of all PointCloud for calculate support
+		sizes_.Set(id, size + static_cast<unsigned>(numPoints));
+		numPoints_ += numPoints;
+		pendingPoints_ += numPoints;
+		pendingChanges_ = true;
+
+		for (auto cell : cells)
+		{
+			// Inverted Index
+			IGI_index[cell].push_back(id);
+		}
+
+		auto& own = pendingCells_[id];
+		own.insert(std::end(own), std::begin(cells), std::end(cells));
+	}
+
+	// Buffer the removal of a cloud - Caller holds the Writer lock
+	// Returns false if the ID is not in the index
+	bool Erase(unsigned id)
 	{
-		for (const auto& cloud : pointClouds)
+		std::size_t points = sizes_.Get(id);
+		if (points == missingCloud)
+			return false;
+
+		sizes_.Set(id, missingCloud);
+		numClouds_--;
+		numPoints_ -= points;
+		pendingChanges_ = true;
+
+		// Buffered points - Erased from their lists
+		auto own = pendingCells_.find(id);
+		if (own != std::end(pendingCells_))
 		{
-			// Get size of all PointCloud for calculate support
-			sizeClouds[cloud.ID] = cloud.Points.size();
+			auto& cells = own->second;
+			points -= cells.size();
+			pendingPoints_ -= cells.size();
+
+			std::sort(std::begin(cells), std::end(cells));
+			cells.erase(std::unique(std::begin(cells), std::end(cells)), std::end(cells));
+
+			for (auto cell : cells)
+			{
+				auto list = IGI_index.find(cell);
+				if (list == std::end(IGI_index))
+					continue;
+
+				auto& ids = list->second;
+				ids.erase(std::remove(std::begin(ids), std::end(ids), id), std::end(ids));
+				if (ids.empty())
+					IGI_index.erase(list);
+			}
+
+			pendingCells_.erase(own);
+		}
 
-			// Add cloud to index
-			Add(cloud);
+		// Published points - Dead in every layer older than the next segment
+		if (points > 0)
+		{
+			aliveFrom_.Set(id, nextSequence_);
+			newestTombstone_ = nextSequence_;
+			deadPoints_ += points;
 		}
+
+		return true;
+	}
+
+	// Caller holds the Writer lock
+	bool NeedsCompactionLocked() const
+	{
+		if (!compacted_)
+			return false;
+
+		auto garbage = garbageThreshold_ > 0.0 && deadPoints_ > garbageThreshold_ * static_cast<double>(deadPoints_ + numPoints_);
+		return garbage || Current()->Layers.size() > maxSegments_ + 1;
+	}
+
+	// Publish the buffered changes as a new view - Caller holds the Writer lock
+	void PublishLocked()
+	{
+		if (!pendingChanges_)
+			return;
+
+		auto current = Current();
+		std::shared_ptr<View> view = current ? std::make_shared<View>(*current) : std::make_shared<View>();
+
+		if (view->Layers.empty())
+			view->Layers.push_back(Layer{ PostingLists(), 0 });
+
+		// The new segment takes the sequence of the tombstones stamped since the last publish,
+		// without segment they keep it for themselves: a compaction covers them with the sequence of its base
+		if (!IGI_index.empty() || newestTombstone_ == nextSequence_)
+			nextSequence_++;
+
+		if (!IGI_index.empty())
+			view->Layers.push_back(Layer{ PostingLists(IGI_index, weighted_, CellLayout::Sparse), nextSequence_ - 1 });
+
+		view->Sizes = sizes_.Share();
+		view->AliveFrom = aliveFrom_.Share();
+		view->NewestTombstone = newestTombstone_;
+		view->NumClouds = numClouds_;
+
+		std::atomic_store(&view_, std::shared_ptr<const View>(std::move(view)));
+
+		// Release the buffer
+		std::unordered_map<unsigned, std::vector<unsigned>>().swap(IGI_index);
+		std::unordered_map<unsigned, std::vector<unsigned>>().swap(pendingCells_);
+		pendingPoints_ = 0;
+		pendingChanges_ = false;
+	}
+
+	// Start a compaction in the background when NeedsCompaction
+	void CompactIfNeeded()
+	{
+		{
+			std::lock_guard<std::mutex> lock(locks_->Writer);
+			if (!autoCompaction_ || !NeedsCompactionLocked())
+				return;
+		}
+
+		std::lock_guard<std::mutex> background(locks_->Background);
+
+		if (locks_->Running.valid() && locks_->Running.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+
+		locks_->Running = std::async(std::launch::async, [this] { Compact(); });
+	}
+
+public:
+
+	// Empty index - Streaming build: Add clouds one at a time, then Finalize
+	IGI(std::string name, const unsigned cmax, const unsigned delta) :name_{ name }, cmax_{ cmax }, delta_{ delta }, grid_{ cmax, delta }
+	{
+		auto view = std::make_shared<View>();
+		view->Layers.push_back(Layer{ PostingLists(), 0 });
+		view_ = std::move(view);
+	}
+
+	// Build index from vector of Point Clouds
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	IGI(const Clouds& pointClouds, std::string name, const unsigned cmax, const unsigned delta) :IGI(name, cmax, delta)
+	{
+		AddRange(std::begin(pointClouds), std::end(pointClouds));
+		Publish();
+	}
+
+	// Waits for the background compaction, if any
+	IGI(IGI&&) = default;
+
+	// Waits for the background compaction
+	~IGI()
+	{
+		if (!locks_)
+			return;
+
+		std::lock_guard<std::mutex> background(locks_->Background);
+		if (locks_->Running.valid())
+			locks_->Running.wait();
 	}
 
 	std::string GetName()
@@ -65,65 +409,403 @@ public:
 		return name_;
 	}
 
-	// Add PointCloud to Index
-	IGI& Add(const Cloud<T>& pointCloud)
+	// Add PointCloud to Index - Searchable after the next Publish
+	template<typename C>
+	IGI& Add(const C& pointCloud)
 	{
-		unsigned px, py, cell;
-		for (const auto& point : pointCloud.Points)
+		// Cell of every point
+		thread_local std::vector<unsigned> cells;
+		grid_.Cells(pointCloud.Points, cells);
+
+		bool publish;
 		{
-			// Calculate cell of point
-			px = static_cast<unsigned>(std::floor(boost::geometry::get<0>(point) / delta_));
-			py = static_cast<unsigned>(std::floor(boost::geometry::get<1>(point) / delta_));
-			cell = px + static_cast<unsigned>(cmax_ / delta_)*py;
+			std::lock_guard<std::mutex> lock(locks_->Writer);
+			Insert(pointCloud.ID, pointCloud.Points.size(), cells);
 
-			// Inverted Index
-			IGI_index[cell].push_back(pointCloud.ID);
+			publish = publishPoints_ > 0 && pendingPoints_ >= publishPoints_;
+			if (publish)
+				PublishLocked();
 		}
 
+		if (publish)
+			CompactIfNeeded();
+
 		return *this;
 	}
 
-	// KNN Query
+	// Add the clouds of [first, last) - e.g. a range of a CloudSet or a chunk read from a file
+	template<typename Iterator>
+	IGI& AddRange(Iterator first, Iterator last)
+	{
+		for (; first != last; ++first)
+		{
+			Add(*first);
+		}
+
+		return *this;
+	}
+
+	// Remove a PointCloud - No longer returned by queries after the next Publish
+	// Its postings stay in the published layers, skipped, until a compaction drops them
+	// Returns false if the ID is not in the index
+	bool Remove(unsigned id)
+	{
+		std::lock_guard<std::mutex> lock(locks_->Writer);
+		return Erase(id);
+	}
+
+	// Replace a PointCloud - The cloud with the same ID is removed and the new one added,
+	// both changes are published together so queries see either the old cloud or the new one
+	// Returns false if the ID was not in the index (the cloud is added anyway)
+	template<typename C>
+	bool Replace(const C& pointCloud)
+	{
+		thread_local std::vector<unsigned> cells;
+		grid_.Cells(pointCloud.Points, cells);
+
+		std::lock_guard<std::mutex> lock(locks_->Writer);
+
+		auto found = Erase(pointCloud.ID);
+		Insert(pointCloud.ID, pointCloud.Points.size(), cells);
+
+		return found;
+	}
+
+	// Make the buffered changes visible to queries at once - Added clouds form a new segment
+	// May start a background compaction (garbage threshold, too many segments)
+	IGI& Publish()
+	{
+		{
+			std::lock_guard<std::mutex> lock(locks_->Writer);
+			PublishLocked();
+		}
+
+		CompactIfNeeded();
+
+		return *this;
+	}
+
+	// Merge every layer in a single CSR base layer without the postings of removed clouds
+	// Buffered changes are published first. Queries and writers keep running meanwhile: queries read the views
+	// published before the new base is swapped in, segments published meanwhile stay on top of it
+	// weighted: Keep every ID once per cell with its number of points (ID, multiplicity), sorted by ID
+	// (first compaction only, later ones and the segments keep the layout)
+	IGI& Compact(bool weighted = false)
+	{
+		std::lock_guard<std::mutex> compaction(locks_->Compaction);
+
+		std::shared_ptr<const View> view;
+		std::size_t purgedPoints;
+		{
+			std::lock_guard<std::mutex> lock(locks_->Writer);
+
+			PublishLocked();
+			view = Current();
+
+			if (compacted_ && view->IsMerged())
+				return *this;
+
+			if (!compacted_)
+				weighted_ = weighted;
+
+			purgedPoints = deadPoints_;
+		}
+
+		// The snapshot is immutable, weighted_ only changes above under the Compaction lock
+		// The base is as new as its newest layer and the tombstones it purged - Later ones are stamped with a larger sequence
+		Layer base{ Merge(*view, weighted_), std::max(view->Layers.back().Sequence, view->NewestTombstone) };
+
+		std::lock_guard<std::mutex> lock(locks_->Writer);
+
+		auto current = Current();
+		auto next = std::make_shared<View>(*current);
+
+		// Segments published since the snapshot stay on top of the new base
+		next->Layers.clear();
+		next->Layers.push_back(std::move(base));
+		for (const auto& layer : current->Layers)
+		{
+			if (layer.Sequence > next->Layers[0].Sequence)
+				next->Layers.push_back(layer);
+		}
+
+		std::atomic_store(&view_, std::shared_ptr<const View>(std::move(next)));
+
+		compacted_ = true;
+		deadPoints_ -= purgedPoints;
+
+		return *this;
+	}
+
+	// End of a streaming build - Same as Compact
+	IGI& Finalize(bool weighted = false)
+	{
+		return Compact(weighted);
+	}
+
+	// Wait for the compaction started on its own, if any - Rethrows its exception
+	void WaitCompaction()
+	{
+		std::future<void> running;
+		{
+			std::lock_guard<std::mutex> background(locks_->Background);
+			running = std::move(locks_->Running);
+		}
+
+		if (running.valid())
+			running.get();
+	}
+
+	// Share of the indexed points that belong to removed clouds, compared to the garbage threshold
+	double GarbageRatio() const
+	{
+		std::lock_guard<std::mutex> lock(locks_->Writer);
+
+		auto total = deadPoints_ + numPoints_;
+		return total == 0 ? 0.0 : static_cast<double>(deadPoints_) / total;
+	}
+
+	// threshold: Garbage ratio that starts a background compaction after Publish (0: never)
+	void SetGarbageThreshold(double threshold)
+	{
+		std::lock_guard<std::mutex> lock(locks_->Writer);
+		garbageThreshold_ = threshold;
+	}
+
+	// publishPoints: Buffered points that make Add publish on its own (0: only Publish)
+	// maxSegments: Segments over the base that start a background compaction after Publish
+	void SetSegments(std::size_t publishPoints, std::size_t maxSegments)
+	{
+		std::lock_guard<std::mutex> lock(locks_->Writer);
+		publishPoints_ = publishPoints;
+		maxSegments_ = maxSegments;
+	}
+
+	// True once compacted if the points of removed clouds exceed the garbage threshold
+	// or the segments published since the last compaction exceed maxSegments
+	bool NeedsCompaction() const
+	{
+		std::lock_guard<std::mutex> lock(locks_->Writer);
+		return NeedsCompactionLocked();
+	}
+
+	// enabled: Start background compactions on Publish when NeedsCompaction (default)
+	// Disabled, the owner runs Compact itself - e.g. on a thread of its choice
+	void SetAutoCompaction(bool enabled)
+	{
+		std::lock_guard<std::mutex> lock(locks_->Writer);
+		autoCompaction_ = enabled;
+	}
+
+	// Layers of the current view - Base plus the segments published since the last compaction
+	std::size_t NumLayers() const
+	{
+		return Current()->Layers.size();
+	}
+
+	// True once compacted and while nothing was published since the last compaction (segment or removal)
+	bool IsCompacted() const
+	{
+		std::lock_guard<std::mutex> lock(locks_->Writer);
+		return compacted_ && Current()->IsMerged();
+	}
+
+	// Bytes used by the posting lists of the current view (cell offsets [+ cells] + IDs [+ multiplicities] of every layer)
+	std::size_t SizeInBytes() const
+	{
+		std::size_t bytes{ 0 };
+		for (const auto& layer : Current()->Layers)
+		{
+			bytes += layer.Lists.SizeInBytes();
+		}
+		return bytes;
+	}
+
+	// Write the current view to a binary file (format in IndexFile.h) - Buffered changes are not written
+	// Sections: cell offsets, posting IDs, [multiplicities,] (ID, size) of every cloud
+	// Weighted indexes are written with their own magic ("IGIWINDX")
+	// Several layers or removed clouds are merged on the fly
+	void Save(const std::string& fileName) const
+	{
+		std::shared_ptr<const View> view;
+		bool weighted;
+		{
+			std::lock_guard<std::mutex> lock(locks_->Writer);
+			view = Current();
+			weighted = weighted_;
+		}
+
+		const auto lists = view->IsMerged() ? view->Layers[0].Lists : Merge(*view, weighted);
+
+		IndexFileWriter writer(fileName, weighted ? "IGIWINDX" : "IGIINDEX", 1);
+		auto& header = writer.Header();
+		header.Cmax = cmax_;
+		header.Delta = delta_;
+		header.NumCells = lists.NumCells();
+		header.NumPostings = lists.NumPostings();
+
+		std::vector<std::uint32_t> clouds;
+		clouds.reserve(2 * view->NumClouds);
+		for (std::size_t id = 0; id < view->Sizes.Capacity(); id++)
+		{
+			auto size = view->Sizes.Get(id);
+			if (size == missingCloud)
+				continue;
+
+			clouds.push_back(static_cast<std::uint32_t>(id));
+			clouds.push_back(size);
+		}
+		header.NumClouds = clouds.size() / 2;
+
+		auto numOffsets = lists.NumCells() == 0 ? 0 : lists.NumCells() + 1;
+		writer.Write(lists.Offsets(), numOffsets * sizeof(std::uint64_t));
+		writer.Write(lists.Ids(), lists.NumPostings() * sizeof(unsigned));
+		if (weighted)
+			writer.Write(lists.Weights(), lists.NumPostings() * sizeof(unsigned));
+
+		writer.Write(clouds.data(), clouds.size() * sizeof(std::uint32_t));
+
+		writer.Close();
+	}
+
+	// Open an index written by Save - The result is compacted
+	// The posting lists are not copied: they are read from a memory mapping of the file,
+	// loaded on first access and shared by every process that opens the same file
+	// verify: Check the checksum of the whole file before use
+	static IGI Open(const std::string& fileName, std::string name, bool verify = false)
+	{
+		auto file = std::make_shared<MappedFile>(fileName);
+		bool weighted = file->Size() >= sizeof(IndexFileHeader) && std::memcmp(file->Data(), "IGIWINDX", 8) == 0;
+		IndexFileReader reader(*file, weighted ? "IGIWINDX" : "IGIINDEX", 1, verify);
+		const auto& header = reader.Header();
+
+		auto numCells = static_cast<std::size_t>(header.NumCells);
+		auto numPostings = static_cast<std::size_t>(header.NumPostings);
+		// numCells + 1 offsets must fit in the payload (and numCells + 1 not wrap around)
+		if (numCells > 0 && numCells >= header.PayloadSize / sizeof(std::uint64_t))
+			throw std::runtime_error("IGI: corrupted cell offsets in " + fileName);
+
+		auto offsets = reader.Read<std::uint64_t>(numCells == 0 ? 0 : numCells + 1);
+		auto ids = reader.Read<unsigned>(numPostings);
+		auto weights = weighted ? reader.Read<unsigned>(numPostings) : nullptr;
+		auto clouds = reader.Read<std::uint32_t>(2 * static_cast<std::size_t>(header.NumClouds));
+
+		// Offsets must delimit the postings: every query reads Ids[offsets[cell], offsets[cell + 1])
+		// O(cells), checked even without verify (truncated writes, flipped bits)
+		bool valid = numCells == 0 || (offsets[0] == 0 && offsets[numCells] == numPostings);
+		for (std::size_t cell = 0; valid && cell < numCells; cell++)
+		{
+			valid = offsets[cell] <= offsets[cell + 1];
+		}
+
+		if (!valid)
+			throw std::runtime_error("IGI: corrupted cell offsets in " + fileName);
+
+		IGI igi(name, header.Cmax, header.Delta);
+		igi.compacted_ = true;
+		igi.weighted_ = weighted;
+
+		for (std::size_t i = 0; i < header.NumClouds; i++)
+		{
+			igi.sizes_.Set(clouds[2 * i], clouds[2 * i + 1]);
+			igi.numPoints_ += clouds[2 * i + 1];
+		}
+		igi.numClouds_ = static_cast<std::size_t>(header.NumClouds);
+
+		auto view = std::make_shared<View>();
+		view->Layers.push_back(Layer{ PostingLists(file, offsets, numCells, ids, numPostings, weights), 0 });
+		view->Sizes = igi.sizes_.Share();
+		view->NumClouds = igi.numClouds_;
+		igi.view_ = std::move(view);
+
+		return igi;
+	}
+
+	// KNN Query - Runs on the view published when it starts, never waits for a writer
 	// First Parameter: queryCloud =  PointCloud
 	// Second Parameter: k = Nearest Neighbors
-	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, unsigned k) const
+	// Third Parameter: voting = One vote per indexed point (Points) or per cloud (Set) in every cell
+	// Fourth Parameter: radius = Also vote the cells within this Chebyshev distance of every query cell,
+	// weighted radius + 1 - distance, so query points that jitter across a cell border still meet their cloud (0: exact cell)
+	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, unsigned k, Voting voting = Voting::Points, unsigned radius = 0) const
 	{
-		std::unordered_map<unsigned, unsigned> count;
+		auto& count = VoteCounter<>::Local();
 
-		unsigned px, py, cell;
+		const auto& queryCells = QueryCells(queryCloud.Points, grid_);
 
-		// For every point in the PointCloud 
-		for (const auto& point : queryCloud.Points)
+		auto view = Current();
+
+		// For every distinct cell of the PointCloud (or of its neighborhood) - Votes weighted by its number of points
+		// Neighbor cells come sorted and merged: every cell is looked up once, with a Find in every layer,
+		// and cells without points in a layer are skipped there
+		for (const auto& queryCell : radius == 0 ? queryCells : NeighborCells(queryCells, grid_, radius))
 		{
-			px = static_cast<unsigned>(std::floor(boost::geometry::get<0>(point) / delta_));
-			py = static_cast<unsigned>(std::floor(boost::geometry::get<1>(point) / delta_));
+			// Get Lists from Inverted Index (contiguous in every layer) and count frequency of ID's
+			Vote(*view, count, queryCell.Cell, voting, queryCell.Count);
+		}
 
-			cell = px + static_cast<unsigned>(cmax_ / delta_)*py;
+		// Get k approximate nearest neighbors
+		return count.TopK(k);
+	}
 
-			auto it = IGI_index.find(cell);
+	// KNN Query ranked by a normalized score instead of raw votes (Scoring.h)
+	// First Parameter: queryCloud =  PointCloud
+	// Second Parameter: k = Nearest Neighbors
+	// Third Parameter: scoring = Votes, Support, Jaccard (points shared with the query in every cell over the union)
+	// or TfIdf (votes of every cell weighted by its inverse cloud frequency)
+	// Fourth Parameter: voting = Votes per cell, as in KNN (not used by Jaccard)
+	// Fifth Parameter: radius = Neighbor cells voted, as in KNN
+	std::vector<std::pair<unsigned, double>> KNNScored(const Cloud<T>& queryCloud, unsigned k, Scoring scoring, Voting voting = Voting::Points, unsigned radius = 0) const
+	{
+		auto& count = VoteCounter<unsigned, double>::Local();
+
+		const auto& queryCells = QueryCells(queryCloud.Points, grid_);
 
-			// Get List from Inverted Index and count frequency of ID's
-			if (it != std::end(IGI_index))
+		auto view = Current();
+
+		for (const auto& queryCell : radius == 0 ? queryCells : NeighborCells(queryCells, grid_, radius))
+		{
+			// Jaccard - Points shared with the query in the cell, whatever the voting
+			if (scoring == Scoring::Jaccard)
 			{
-				auto list = it->second;
-				std::for_each(std::begin(list), std::end(list), [&count](unsigned val) { count[val]++; });
+				auto times = queryCell.Count;
+				VoteLists(*view, count, queryCell.Cell, [times](const PostingSpan& list, auto& counter) { list.VoteOverlap(counter, times); });
+				continue;
 			}
-		}
 
-		auto numberResults = 0;
+			double times = queryCell.Count;
+			if (scoring == Scoring::TfIdf)
+				times *= InverseCloudFrequency(view->NumClouds, CellClouds(*view, queryCell.Cell));
 
-		if (count.size() > k)
-			numberResults = k;
-		else
-			numberResults = count.size();
+			Vote(*view, count, queryCell.Cell, voting, times);
+		}
 
-		std::vector<std::pair<unsigned, unsigned>> resultsID(numberResults);
+		// Get the k clouds with best score - Sizes of the clouds in the view
+		auto querySize = queryCloud.Points.size();
+		return count.TopK(k, [&view, scoring, querySize](unsigned id, double votes)
+		{
+			auto size = view->Sizes.Get(id);
+			return scoring == Scoring::Votes ? votes : Score(scoring, votes, size == missingCloud ? 0 : size, querySize);
+		});
+	}
 
-		// Get k approximate nearest neighbors
-		std::partial_sort_copy(std::begin(count), std::end(count), std::begin(resultsID), std::end(resultsID),
-			[](const std::pair<unsigned, unsigned>& left, const std::pair<unsigned, unsigned>& right) {return left.second>right.second; });
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: numThreads = Worker threads
+	// 4th Parameter: voting = Votes per cell, as in KNN
+	// 5th Parameter: radius = Neighbor cells voted, as in KNN
+	std::vector<std::vector<std::pair<unsigned, unsigned>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, unsigned k, const unsigned numThreads = DefaultThreads(), Voting voting = Voting::Points, unsigned radius = 0) const
+	{
+		std::vector<std::vector<std::pair<unsigned, unsigned>>> results(queryClouds.size());
+
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
+		{
+			results[i] = KNN(queryClouds[i], k, voting, radius);
+		}, numThreads);
 
-		return resultsID;
+		return results;
 	}
 
 	// Performance report on KNN Search
@@ -132,22 +814,36 @@ public:
 	// 1st Parameter: Vector of Queries Point Clouds
 	// 2nd Parameter: k = Nearest Neighbors	
 	// 3rd Parameter: recallAt = Vector for desired Recall@
-	template<typename D = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, unsigned k, const std::vector<unsigned>& recallAt) const
+	// 4th Parameter: voting = Votes per cell, as in KNN
+	// 5th Parameter: radius = Neighbor cells voted, as in KNN
+	// 6th Parameter: scoring = Ranking of the clouds, as in KNNScored (Votes: KNN)
+	template<typename D = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, unsigned k, const std::vector<unsigned>& recallAt, Voting voting = Voting::Points, unsigned radius = 0, Scoring scoring = Scoring::Votes) const
 	{
 		PerformanceReport performance;
 		performance.QueriesTime.reserve(queryClouds.size());
 		performance.RecallAt.reserve(queryClouds.size());
 		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
+		std::vector<std::pair<unsigned, unsigned>> result;
+		std::vector<std::pair<unsigned, double>> resultScored;
 
 		// For every cloud in vector of PointClouds
-		for (const auto cloud : queryClouds)
+		for (const auto& cloud : queryClouds)
 		{
 			// Perform KNN search
+			allocations = AllocationCount();
 			start = std::chrono::high_resolution_clock::now();
-			auto result = KNN(cloud, k);
+			if (scoring == Scoring::Votes)
+				result = KNN(cloud, k, voting, radius);
+			else
+				resultScored = KNNScored(cloud, k, scoring, voting, radius);
 			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
 
-			GetRecall(performance, result, recallAt, cloud.ID);
+			if (scoring == Scoring::Votes)
+				GetRecall(performance, result, recallAt, cloud.ID);
+			else
+				GetRecall(performance, resultScored, recallAt, cloud.ID);
 
 			performance.QueriesTime.push_back(std::chrono::duration_cast<D>(end - start).count());
 		}
@@ -158,6 +854,7 @@ public:
 		}
 
 		TimePerformance(performance);
+		AllocationPerformance(performance);
 
 		return performance;
 	}
@@ -2,10 +2,15 @@
 #include "Cloud.h"
 #include "PerformanceReport.h"
 #include "UtilityFunctions.h"
+#include "VoteCounter.h"
+#include "ThreadPool.h"
+#include "QueryCells.h"
+#include "Scoring.h"
 #include <boost/geometry.hpp>
 #include <boost/geometry/index/rtree.hpp>
 #include <boost/geometry/index/parameters.hpp>
 #include <unordered_map>
+#include <algorithm>
 #include <vector>
 #include <chrono>
 #include <string>
@@ -26,105 +31,217 @@ private:
 
 	std::unordered_map<unsigned, boost::geometry::index::rtree<PointIdx, Param>> igiRtree;
 	std::unordered_map<unsigned, unsigned> sizeClouds;
+
+	// Distinct clouds with points in every cell - Inverse cloud frequency of TfIdf scoring
+	std::unordered_map<unsigned, unsigned> cellClouds_;
+
+	// Streaming build - Points of every cell until Finalize
+	std::unordered_map<unsigned, std::vector<PointIdx>> pendingCells_;
+
 	std::string name_;
 	const unsigned cmax_;
 	const unsigned delta_;
+	const GridQuantizer grid_;
 
-public:
-
-	// Build index from vector of PointClouds
-	IGIRtree(const std::vector<Cloud<T>>& pointClouds, std::string name, const unsigned cmax, const unsigned delta) :name_{ name }, cmax_{ cmax }, delta_{ delta }
+	// Votes of the internalK nearest points of every query point, searched in the Rtree of its cell
+	// idf: Weight the votes of every cell by its inverse cloud frequency (TfIdf scoring)
+	template<typename Counter>
+	void Vote(const Cloud<T>& queryCloud, const unsigned internalK, Counter& count, bool idf) const
 	{
-		std::unordered_map<unsigned, std::vector<PointIdx>> pointsWithinCell;
-		PointsWithinCell(pointClouds, pointsWithinCell);
+		using Votes = typename Counter::CountType;
+		std::vector<PointIdx> results;
+
+		const auto& pointsByCell = PointsByCell(queryCloud.Points, grid_);
+		auto it = std::end(igiRtree);
+		Votes weight = 1;
 
-		for (const auto& pair : pointsWithinCell)
+		// For every point in the PointCloud, grouped by cell - Every cell is looked up once
+		for (std::size_t i = 0; i < pointsByCell.size(); i++)
 		{
-			// Create a Rtree for every cell
-			boost::geometry::index::rtree<PointIdx, Param> tempRtree(std::begin(pair.second), std::end(pair.second));
-			igiRtree.insert({ pair.first, boost::move(tempRtree) });
+			if (i == 0 || pointsByCell[i].first != pointsByCell[i - 1].first)
+			{
+				it = igiRtree.find(pointsByCell[i].first);
+
+				if (idf && it != std::end(igiRtree))
+				{
+					auto clouds = cellClouds_.find(pointsByCell[i].first);
+					weight = static_cast<Votes>(InverseCloudFrequency(sizeClouds.size(), clouds == std::end(cellClouds_) ? 0 : clouds->second));
+				}
+			}
+
+			// Get List from Inverted Index and count frequency of ID's
+			if (it != std::end(igiRtree))
+			{
+				const auto& point = queryCloud.Points[pointsByCell[i].second];
+
+				results.clear();
+				(it->second).query(boost::geometry::index::nearest(point, internalK), std::back_inserter(results));
+
+				// Count the frequencies for the Clouds ID
+				for (const auto& item : results)
+				{
+					count.Add(item.second, weight);
+				}
+			}
 		}
 	}
 
+public:
+
+	// Empty index - Streaming build: Add clouds one at a time, then Finalize
+	IGIRtree(std::string name, const unsigned cmax, const unsigned delta) :name_{ name }, cmax_{ cmax }, delta_{ delta }, grid_{ cmax, delta } {}
+
+	// Build index from vector of PointClouds
+	// The Rtrees of the cells are built in parallel on numThreads threads
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	IGIRtree(const Clouds& pointClouds, std::string name, const unsigned cmax, const unsigned delta, const unsigned numThreads = DefaultThreads()) :IGIRtree(name, cmax, delta)
+	{
+		AddRange(std::begin(pointClouds), std::end(pointClouds));
+		Finalize(numThreads);
+	}
+
 	std::string GetName()
 	{
 		return name_;
 	}
 
-	// Calculate cell for every point in pointClouds
-	void PointsWithinCell(const std::vector<Cloud<T>>& pointClouds, std::unordered_map<unsigned, std::vector<PointIdx>>& pointsWithinCell)
+	// Add PointCloud to Index - Calculate the cell of every point
+	// The cloud is searchable after Finalize
+	template<typename C>
+	IGIRtree& Add(const C& pointCloud)
 	{
-		int totalPoints = 0;
-		unsigned px, py, cell;
+		sizeClouds[pointCloud.ID] += static_cast<unsigned>(pointCloud.Points.size());
+
+		// Cell of every point
+		thread_local std::vector<unsigned> cells;
+		grid_.Cells(pointCloud.Points, cells);
 
 		// Prepare data to Indexing - Add the Cloud ID to every Point
-		for (const auto& cloud : pointClouds)
+		std::size_t i{ 0 };
+		for (const auto& p : pointCloud.Points)
 		{
-			sizeClouds[cloud.ID] = cloud.Points.size();
+			pendingCells_[cells[i++]].push_back(std::make_pair(p, pointCloud.ID));
+		}
 
-			for (const auto& p : cloud.Points)
-			{
-				// Calculate cell of point
-				px = static_cast<unsigned>(std::floor(boost::geometry::get<0>(p) / delta_));
-				py = static_cast<unsigned>(std::floor(boost::geometry::get<1>(p) / delta_));
-				cell = px + static_cast<unsigned>(cmax_ / delta_)*py;
+		return *this;
+	}
 
-				pointsWithinCell[cell].push_back(std::make_pair(p, cloud.ID));
-			}
+	// Add the clouds of [first, last) - e.g. a range of a CloudSet or a chunk read from a file
+	template<typename Iterator>
+	IGIRtree& AddRange(Iterator first, Iterator last)
+	{
+		for (; first != last; ++first)
+		{
+			Add(*first);
 		}
+
+		return *this;
 	}
 
-	// KNN Query
-	// 1st Parameter: Query =  PointCloud
-	// 2nd Parameter: K = K Nearest Neighbors PointClouds
-	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
-	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k, const unsigned internalK) const
+	// End of a streaming build - Move the pending points into the Rtrees of their cells
+	// New cells are bulk loaded, cells that already have a Rtree get the points inserted
+	// The cells are processed in parallel on numThreads threads
+	IGIRtree& Finalize(const unsigned numThreads = DefaultThreads())
 	{
-		std::unordered_map<unsigned, unsigned> count;
-		std::vector<PointIdx> results;
+		// One (points, Rtree, clouds) job per cell - Entries are created before the parallel section
+		struct Job
+		{
+			std::vector<PointIdx>* Points;
+			boost::geometry::index::rtree<PointIdx, Param>* Rtree;
+			unsigned* Clouds;
+		};
 
-		unsigned px, py, cell;
+		std::vector<Job> cells;
+		cells.reserve(pendingCells_.size());
+		igiRtree.reserve(igiRtree.size() + pendingCells_.size());
 
-		// For every point in the PointCloud 
-		for (const auto& point : queryCloud.Points)
+		for (auto& pair : pendingCells_)
 		{
-			px = static_cast<unsigned>(std::floor(boost::geometry::get<0>(point) / delta_));
-			py = static_cast<unsigned>(std::floor(boost::geometry::get<1>(point) / delta_));
+			cells.push_back(Job{ &pair.second, &igiRtree[pair.first], &cellClouds_[pair.first] });
+		}
 
-			cell = px + static_cast<unsigned>(cmax_ / delta_)*py;
+		// Largest cells first so they don't straggle at the end
+		std::sort(std::begin(cells), std::end(cells), [](const Job& left, const Job& right) {return left.Points->size() > right.Points->size(); });
 
-			auto it = igiRtree.find(cell);
+		ThreadPool::Default().ParallelFor(cells.size(), [&cells](std::size_t i, unsigned)
+		{
+			auto& points = *cells[i].Points;
+			auto& rtree = *cells[i].Rtree;
 
-			// Get List from Inverted Index and count frequency of ID's
-			if (it != std::end(igiRtree))
+			if (rtree.empty())
 			{
-				(it->second).query(boost::geometry::index::nearest(point, internalK), std::back_inserter(results));
+				// Create a Rtree for every cell
+				boost::geometry::index::rtree<PointIdx, Param> tempRtree(std::begin(points), std::end(points));
+				rtree = boost::move(tempRtree);
+			}
+			else
+			{
+				rtree.insert(std::begin(points), std::end(points));
 			}
-		}
 
-		// Count the frequencies for the Clouds ID
-		for (const auto& item : results)
-		{
-			count[item.second]++;
-		}
+			std::vector<PointIdx>().swap(points);
 
-		auto numberResults = 0;
+			// Distinct IDs of the whole cell - Clouds added by earlier Finalize calls or by several Adds count once
+			thread_local std::vector<unsigned> ids;
+			ids.clear();
+			for (const auto& point : rtree)
+			{
+				ids.push_back(point.second);
+			}
+			std::sort(std::begin(ids), std::end(ids));
+			*cells[i].Clouds = static_cast<unsigned>(std::unique(std::begin(ids), std::end(ids)) - std::begin(ids));
+		}, numThreads);
 
-		if (count.size() > k)
-			numberResults = k;
-		else
-			numberResults = count.size();
+		std::unordered_map<unsigned, std::vector<PointIdx>>().swap(pendingCells_);
 
+		return *this;
+	}
 
-		std::vector<std::pair<unsigned, unsigned>> resultsID(numberResults);
+	// KNN Query
+	// 1st Parameter: Query =  PointCloud
+	// 2nd Parameter: K = K Nearest Neighbors PointClouds
+	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
+	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k, const unsigned internalK) const
+	{
+		auto& count = VoteCounter<>::Local();
+		Vote(queryCloud, internalK, count, false);
 
 		// Get only the first K Point Clouds based in ID frequency.
-		std::partial_sort_copy(std::begin(count), std::end(count), std::begin(resultsID), std::end(resultsID),
-			[](const std::pair<unsigned, unsigned>& left, const std::pair<unsigned, unsigned>& right) {return left.second > right.second; });
+		return count.TopK(k);
+	}
+
+	// KNN Query ranked by a normalized score instead of raw votes (Scoring.h)
+	// 1st Parameter: Query =  PointCloud
+	// 2nd Parameter: K = K Nearest Neighbors PointClouds
+	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
+	// 4th Parameter: scoring = Votes, Support, Jaccard or TfIdf (votes of every cell weighted by its inverse cloud frequency)
+	std::vector<std::pair<unsigned, double>> KNNScored(const Cloud<T>& queryCloud, const unsigned k, const unsigned internalK, Scoring scoring) const
+	{
+		auto& count = VoteCounter<unsigned, double>::Local();
+		Vote(queryCloud, internalK, count, scoring == Scoring::TfIdf);
 
-		return resultsID;
+		// Get the k clouds with best score
+		return count.TopK(k, CloudScore<>(sizeClouds, scoring, queryCloud.Points.size() * internalK));
 	}
 
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
+	// 4th Parameter: numThreads = Worker threads
+	std::vector<std::vector<std::pair<unsigned, unsigned>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const unsigned numThreads = DefaultThreads()) const
+	{
+		std::vector<std::vector<std::pair<unsigned, unsigned>>> results(queryClouds.size());
+
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
+		{
+			results[i] = KNN(queryClouds[i], k, internalK);
+		}, numThreads);
+
+		return results;
+	}
 
 	// Performance report on KNN Search
 	// Obtain Recall@
@@ -133,22 +250,34 @@ public:
 	// 2nd Parameter: k = Nearest Neighbors
 	// 3rd Parameter: internalK = Internal k parameter for internalK-NN 
 	// 4th Parameter: recallAt = Vector for desired Recall@
-	template<typename D = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const std::vector<unsigned>& recallAt) const
+	// 5th Parameter: scoring = Ranking of the clouds, as in KNNScored (Votes: KNN)
+	template<typename D = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const std::vector<unsigned>& recallAt, Scoring scoring = Scoring::Votes) const
 	{
 		PerformanceReport performance;
 		performance.QueriesTime.reserve(queryClouds.size());
 		performance.RecallAt.reserve(queryClouds.size());
 		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
+		std::vector<std::pair<unsigned, unsigned>> result;
+		std::vector<std::pair<unsigned, double>> resultScored;
 
 		// For every cloud in vector of PointClouds
 		for (const auto& cloud : queryClouds)
 		{
 			// Perform KNN search
+			allocations = AllocationCount();
 			start = std::chrono::high_resolution_clock::now();
-			auto result = KNN(cloud, k, internalK);
+			if (scoring == Scoring::Votes)
+				result = KNN(cloud, k, internalK);
+			else
+				resultScored = KNNScored(cloud, k, internalK, scoring);
 			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
 
-			GetRecall(performance, result, recallAt, cloud.ID);
+			if (scoring == Scoring::Votes)
+				GetRecall(performance, result, recallAt, cloud.ID);
+			else
+				GetRecall(performance, resultScored, recallAt, cloud.ID);
 
 			performance.QueriesTime.push_back(std::chrono::duration_cast<D>(end - start).count());
 		}
@@ -159,6 +288,7 @@ public:
 		}
 
 		TimePerformance(performance);
+		AllocationPerformance(performance);
 
 		return performance;
 	}
@@ -2,11 +2,17 @@
 #include "vp-tree.h"
 #include "PerformanceReport.h"
 #include "UtilityFunctions.h"
+#include "VoteCounter.h"
+#include "ThreadPool.h"
+#include "QueryCells.h"
+#include "Scoring.h"
 #include "Cloud.h"
 #include <boost/geometry.hpp>
 #include <unordered_map>
 #include <vector>
 #include <memory>
+#include <algorithm>
+#include <functional>
 #include <chrono>
 
 // Miguel Ramirez Chacon
@@ -24,22 +30,101 @@ class IGIVpt
 private:
 	std::unordered_map<unsigned, VpTree<PointIdx>> igiVPT;
 	std::unordered_map<unsigned, unsigned> sizeClouds;
+
+	// Clouds with points in every cell - Inverse cloud frequency of TfIdf scoring
+	std::unordered_map<unsigned, unsigned> cellClouds_;
+
 	std::string name_;
 	const unsigned cmax_;
 	const unsigned delta_;
+	const GridQuantizer grid_;
+
+	// Votes of the internalK nearest points of every query point, searched in the VPT of its cell
+	// idf: Weight the votes of every cell by its inverse cloud frequency (TfIdf scoring)
+	template<typename Counter>
+	void Vote(const Cloud<T>& queryCloud, const unsigned internalK, Counter& count, bool idf) const
+	{
+		using Votes = typename Counter::CountType;
+		std::vector<PointIdx> results;
+		std::vector<double> distances;
+
+		const auto& pointsByCell = PointsByCell(queryCloud.Points, grid_);
+		auto it = std::end(igiVPT);
+		Votes weight = 1;
+
+		// For every point in the PointCloud, grouped by cell - Every cell is looked up once
+		for (std::size_t i = 0; i < pointsByCell.size(); i++)
+		{
+			if (i == 0 || pointsByCell[i].first != pointsByCell[i - 1].first)
+			{
+				it = igiVPT.find(pointsByCell[i].first);
+
+				if (idf && it != std::end(igiVPT))
+				{
+					auto clouds = cellClouds_.find(pointsByCell[i].first);
+					weight = static_cast<Votes>(InverseCloudFrequency(sizeClouds.size(), clouds == std::end(cellClouds_) ? 0 : clouds->second));
+				}
+			}
+
+			// Get List from Inverted Index and count frequency of ID's
+			if (it != std::end(igiVPT))
+			{
+				const auto& point = queryCloud.Points[pointsByCell[i].second];
+
+				(it->second).KNN(std::make_pair(point, 0), internalK, results, distances);
+
+				// Count the frequencies for the Clouds ID
+				for (const auto& item : results)
+				{
+					count.Add(item.second, weight);
+				}
+
+				results.clear();
+				distances.clear();
+			}
+		}
+	}
 
 public:
 
-	IGIVpt(std::vector<Cloud<T>>& pointClouds, std::function<double(const PointIdx&, const PointIdx&)> dist, std::string name, const unsigned cmax, const unsigned delta) :name_{ name }, cmax_{ cmax }, delta_{ delta }
+	// Build index from vector of PointClouds
+	// The VPTs of the cells are built in parallel on numThreads threads
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	IGIVpt(const Clouds& pointClouds, std::function<double(const PointIdx&, const PointIdx&)> dist, std::string name, const unsigned cmax, const unsigned delta, const unsigned numThreads = DefaultThreads()) :name_{ name }, cmax_{ cmax }, delta_{ delta }, grid_{ cmax, delta }
 	{
 		std::unordered_map<unsigned, std::vector<PointIdx>> pointsWithinCell;
 		PointsWithinCell(pointClouds, pointsWithinCell);
 
+		// One (points, VPT) job per cell - Entries are created before the parallel section
+		std::vector<std::pair<std::vector<PointIdx>*, VpTree<PointIdx>*>> cells;
+		cells.reserve(pointsWithinCell.size());
+		igiVPT.reserve(pointsWithinCell.size());
+
 		for (auto& pair : pointsWithinCell)
 		{
-			// Create a VPT for every cell						
-			igiVPT[pair.first].Build(pair.second, dist);
+			cells.push_back(std::make_pair(&pair.second, &igiVPT[pair.first]));
+
+			// The points of a cloud are added together - Every run of equal IDs is one cloud
+			const auto& points = pair.second;
+			auto& clouds = cellClouds_[pair.first];
+			for (std::size_t i = 0; i < points.size(); i++)
+			{
+				if (i == 0 || points[i].second != points[i - 1].second)
+					clouds++;
+			}
 		}
+
+		// Largest cells first so they don't straggle at the end
+		std::sort(std::begin(cells), std::end(cells), [](const auto& left, const auto& right) {return left.first->size() > right.first->size(); });
+
+		ThreadPool::Default().ParallelFor(cells.size(), [&cells, &dist](std::size_t i, unsigned)
+		{
+			// Create a VPT for every cell
+			cells[i].second->Build(*cells[i].first, dist);
+
+			std::vector<PointIdx>().swap(*cells[i].first);
+		}, numThreads);
 	}
 
 	std::string GetName()
@@ -48,24 +133,23 @@ public:
 	}
 
 	// Calculate cell for every point in pointClouds
-	void PointsWithinCell(std::vector<Cloud<T>>& pointClouds, std::unordered_map<unsigned, std::vector<PointIdx>>& pointsWithinCell)
+	template<typename Clouds>
+	void PointsWithinCell(const Clouds& pointClouds, std::unordered_map<unsigned, std::vector<PointIdx>>& pointsWithinCell)
 	{
-		int totalPoints = 0;
-		unsigned px, py, cell;
+		std::vector<unsigned> cells;
 
 		// Prepare data to Indexing - Add the Cloud ID to every Point
 		for (const auto& cloud : pointClouds)
 		{
 			sizeClouds[cloud.ID] = cloud.Points.size();
 
+			// Cell of every point
+			grid_.Cells(cloud.Points, cells);
+
+			std::size_t i{ 0 };
 			for (const auto& p : cloud.Points)
 			{
-				// Calculate cell of point
-				px = static_cast<unsigned>(std::floor(boost::geometry::get<0>(p) / delta_));
-				py = static_cast<unsigned>(std::floor(boost::geometry::get<1>(p) / delta_));
-				cell = px + static_cast<unsigned>(cmax_ / delta_)*py;
-
-				pointsWithinCell[cell].push_back(std::make_pair(p, cloud.ID));
+				pointsWithinCell[cells[i++]].push_back(std::make_pair(p, cloud.ID));
 			}
 		}
 	}
@@ -76,52 +160,43 @@ public:
 	// 3rd Parameter: internalK-NN
 	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k, const unsigned internalK) const
 	{
-		std::unordered_map<unsigned, unsigned> count;
-		std::vector<PointIdx> results;
-		std::vector<double> distances;
-
-		unsigned px, py, cell;
-
-		// For every point in the PointCloud 
-		for (const auto& point : queryCloud.Points)
-		{
-			px = static_cast<unsigned>(std::floor(boost::geometry::get<0>(point) / delta_));
-			py = static_cast<unsigned>(std::floor(boost::geometry::get<1>(point) / delta_));
-
-			cell = px + static_cast<unsigned>(cmax_ / delta_)*py;
+		auto& count = VoteCounter<>::Local();
+		Vote(queryCloud, internalK, count, false);
 
-			auto it = igiVPT.find(cell);
-
-			// Get List from Inverted Index and count frequency of ID's
-			if (it != std::end(igiVPT))
-			{
-				(it->second).KNN(std::make_pair(point, 0), internalK, results, distances);
-
-				// Count the frequencies for the Clouds ID
-				for (const auto& item : results)
-				{
-					count[item.second]++;
-				}
-
-				results.clear();
-				distances.clear();
-			}
-		}
+		// Get only the first K Point Clouds based in ID frequency.
+		return count.TopK(k);
+	}
 
-		auto numberResults = 0;
+	// KNN Query ranked by a normalized score instead of raw votes (Scoring.h)
+	// 1st Parameter: Query =  PointCloud
+	// 2nd Parameter: K = K Nearest Neighbors PointClouds
+	// 3rd Parameter: internalK-NN
+	// 4th Parameter: scoring = Votes, Support, Jaccard or TfIdf (votes of every cell weighted by its inverse cloud frequency)
+	std::vector<std::pair<unsigned, double>> KNNScored(const Cloud<T>& queryCloud, const unsigned k, const unsigned internalK, Scoring scoring) const
+	{
+		auto& count = VoteCounter<unsigned, double>::Local();
+		Vote(queryCloud, internalK, count, scoring == Scoring::TfIdf);
 
-		if (count.size() > k)
-			numberResults = k;
-		else
-			numberResults = count.size();
+		// Get the k clouds with best score
+		return count.TopK(k, CloudScore<>(sizeClouds, scoring, queryCloud.Points.size() * internalK));
+	}
 
-		std::vector<std::pair<unsigned, unsigned>> resultsID(numberResults);
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
+	// 4th Parameter: numThreads = Worker threads
+	std::vector<std::vector<std::pair<unsigned, unsigned>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const unsigned numThreads = DefaultThreads()) const
+	{
+		std::vector<std::vector<std::pair<unsigned, unsigned>>> results(queryClouds.size());
 
-		// Get only the first K Point Clouds based in ID frequency.
-		std::partial_sort_copy(std::begin(count), std::end(count), std::begin(resultsID), std::end(resultsID),
-			[](const std::pair<unsigned, unsigned>& left, const std::pair<unsigned, unsigned>& right) {return left.second > right.second; });
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
+		{
+			results[i] = KNN(queryClouds[i], k, internalK);
+		}, numThreads);
 
-		return resultsID;
+		return results;
 	}
 
 	// Performance report on KNN Search
@@ -131,22 +206,34 @@ public:
 	// 2nd Parameter: k = Nearest Neighbors
 	// 3rd Parameter: internalK-NN
 	// 3rd Parameter: recallAt = Vector for desired Recall@
-	template<typename Duration = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const std::vector<unsigned>& recallAt) const
+	// 5th Parameter: scoring = Ranking of the clouds, as in KNNScored (Votes: KNN)
+	template<typename Duration = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const std::vector<unsigned>& recallAt, Scoring scoring = Scoring::Votes) const
 	{
 		PerformanceReport performance;
 		performance.QueriesTime.reserve(queryClouds.size());
 		performance.RecallAt.reserve(queryClouds.size());
 		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
+		std::vector<std::pair<unsigned, unsigned>> result;
+		std::vector<std::pair<unsigned, double>> resultScored;
 
 		// For every cloud in vector of PointClouds
 		for (const auto& cloud : queryClouds)
 		{
 			// Perform KNN search
+			allocations = AllocationCount();
 			start = std::chrono::high_resolution_clock::now();
-			auto result = KNN(cloud, k, internalK);
+			if (scoring == Scoring::Votes)
+				result = KNN(cloud, k, internalK);
+			else
+				resultScored = KNNScored(cloud, k, internalK, scoring);
 			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
 
-			GetRecall(performance, result, recallAt, cloud.ID);
+			if (scoring == Scoring::Votes)
+				GetRecall(performance, result, recallAt, cloud.ID);
+			else
+				GetRecall(performance, resultScored, recallAt, cloud.ID);
 
 			performance.QueriesTime.push_back(std::chrono::duration_cast<Duration>(end - start).count());
 		}
@@ -157,6 +244,7 @@ public:
 		}
 
 		TimePerformance(performance);
+		AllocationPerformance(performance);
 
 		return performance;
 	}
@@ -0,0 +1,175 @@
+#pragma once
+#include "MappedFile.h"
+#include <fstream>
+#include <streambuf>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Binary image of an index
+// Header (64 bytes) followed by the payload: a sequence of sections, each padded to 8 bytes
+// The checksum covers the whole payload, padding included
+// Values are stored in the byte order of the machine that wrote the file (ByteOrder detects a mismatch)
+
+struct IndexFileHeader
+{
+	char Magic[8];
+	std::uint32_t Version;
+	std::uint32_t ByteOrder;
+	std::uint32_t Cmax;
+	std::uint32_t Delta;
+	std::uint64_t NumCells;
+	std::uint64_t NumPostings;
+	std::uint64_t NumClouds;
+	std::uint64_t PayloadSize;
+	std::uint64_t Checksum;
+};
+
+static_assert(sizeof(unsigned) == 4, "Posting IDs are stored as 32-bit integers");
+static_assert(sizeof(IndexFileHeader) == 64, "IndexFileHeader must be 64 bytes");
+
+const std::uint32_t IndexFileByteOrder{ 0x01020304 };
+
+// Write an index image section by section
+class IndexFileWriter
+{
+private:
+	std::ofstream out_;
+	std::string fileName_;
+	IndexFileHeader header_;
+	std::uint64_t checksum_;
+
+public:
+
+	// magic: 8 characters identifying the index type
+	IndexFileWriter(const std::string& fileName, const char* magic, std::uint32_t version) :out_{ fileName, std::ios::binary | std::ios::trunc }, fileName_{ fileName }, checksum_{ Checksum(nullptr, 0) }
+	{
+		if (!out_)
+			throw std::runtime_error("IndexFileWriter: cannot create " + fileName);
+
+		std::memset(&header_, 0, sizeof(header_));
+		std::memcpy(header_.Magic, magic, sizeof(header_.Magic));
+		header_.Version = version;
+		header_.ByteOrder = IndexFileByteOrder;
+
+		// Placeholder, rewritten by Close
+		out_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+	}
+
+	IndexFileHeader& Header()
+	{
+		return header_;
+	}
+
+	// Append a section padded to 8 bytes
+	void Write(const void* data, std::size_t bytes)
+	{
+		auto whole = bytes - bytes % 8;
+
+		if (whole > 0)
+		{
+			out_.write(static_cast<const char*>(data), whole);
+			checksum_ = Checksum(data, whole, checksum_);
+		}
+
+		if (whole < bytes)
+		{
+			char tail[8] = { 0 };
+			std::memcpy(tail, static_cast<const char*>(data) + whole, bytes - whole);
+			out_.write(tail, sizeof(tail));
+			checksum_ = Checksum(tail, sizeof(tail), checksum_);
+		}
+
+		header_.PayloadSize += (bytes + 7) / 8 * 8;
+	}
+
+	// Write the final header
+	void Close()
+	{
+		header_.Checksum = checksum_;
+		out_.seekp(0);
+		out_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+		out_.close();
+
+		if (!out_)
+			throw std::runtime_error("IndexFileWriter: cannot write " + fileName_);
+	}
+};
+
+// Read the sections of a mapped index image in the order they were written
+class IndexFileReader
+{
+private:
+	const IndexFileHeader* header_;
+	const char* position_;
+	const char* end_;
+
+public:
+
+	// Validate the header: magic, version, byte order and size
+	// verify: Also recompute the checksum of the payload (reads the whole file)
+	IndexFileReader(const MappedFile& file, const char* magic, std::uint32_t version, bool verify)
+	{
+		if (file.Size() < sizeof(IndexFileHeader))
+			throw std::runtime_error("IndexFileReader: file too small");
+
+		header_ = reinterpret_cast<const IndexFileHeader*>(file.Data());
+
+		if (std::memcmp(header_->Magic, magic, sizeof(header_->Magic)) != 0)
+			throw std::runtime_error("IndexFileReader: wrong index type");
+
+		if (header_->Version != version)
+			throw std::runtime_error("IndexFileReader: unsupported version " + std::to_string(header_->Version));
+
+		if (header_->ByteOrder != IndexFileByteOrder)
+			throw std::runtime_error("IndexFileReader: byte order mismatch");
+
+		if (file.Size() - sizeof(IndexFileHeader) < header_->PayloadSize)
+			throw std::runtime_error("IndexFileReader: truncated file");
+
+		position_ = file.Data() + sizeof(IndexFileHeader);
+		end_ = position_ + header_->PayloadSize;
+
+		if (verify && Checksum(position_, static_cast<std::size_t>(header_->PayloadSize)) != header_->Checksum)
+			throw std::runtime_error("IndexFileReader: checksum mismatch");
+	}
+
+	const IndexFileHeader& Header() const
+	{
+		return *header_;
+	}
+
+	// Next section of count elements - Returns a pointer into the mapping
+	template<typename V>
+	const V* Read(std::size_t count)
+	{
+		// Counts come from the header: compared before the multiplication can overflow
+		auto left = static_cast<std::size_t>(end_ - position_);
+		if (count > left / sizeof(V))
+			throw std::runtime_error("IndexFileReader: truncated section");
+
+		auto bytes = count * sizeof(V);
+		auto padded = (bytes + 7) / 8 * 8;
+
+		if (left < padded)
+			throw std::runtime_error("IndexFileReader: truncated section");
+
+		auto data = reinterpret_cast<const V*>(position_);
+		position_ += padded;
+		return data;
+	}
+};
+
+// Input stream buffer over a section of a mapped file (no copy)
+// Used to load structures that only know how to read from a std::istream
+class IndexSectionBuffer : public std::streambuf
+{
+public:
+	IndexSectionBuffer(const char* data, std::size_t size)
+	{
+		auto begin = const_cast<char*>(data);
+		setg(begin, begin, begin + size);
+	}
+};
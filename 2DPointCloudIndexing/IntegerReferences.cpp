@@ -31,6 +31,7 @@
 #include <chrono>
 #include "codecfactory.h"
 #include "intersection.h"
+#include "GridQuantizer.h"
 
 using namespace SIMDCompressionLib;
 
@@ -53,7 +54,6 @@ public:
 
 // Funcion para leer archivo de texto - Declaracion
 void Posiciones(std::string fileName, int delta, int cmax, std::vector<Punto> &resultado, std::set<unsigned int> &nubesID);
-int Posicion(int x, int y, int cmax, int delta);
 
 //Funcion para calcular distancia coseno
 double DistanciaCoseno(const Punto &q, const Punto &bitmap, int pint);
@@ -316,6 +316,9 @@ void Posiciones(std::string fileName, int delta, int cmax, std::vector<Punto> &r
 	//Vector que dado un renglon del archivo de texto almacena las coordenadas e identificador de la nube ()
 	std::vector<float> d;
 
+	//Celda de cada punto en la rejilla
+	GridQuantizer grid(cmax, delta);
+
 	//Inicia lectura de archivo de texto
 	if (inputFile.is_open())
 	{
@@ -352,7 +355,7 @@ void Posiciones(std::string fileName, int delta, int cmax, std::vector<Punto> &r
 				unsigned int p{ 0 };
 
 				//Calcular posicion de 1 en bitvector
-				p = (unsigned int)Posicion(std::floor(d[1] / delta), std::floor(d[2] / delta), cmax, delta);
+				p = grid.Cell(d[1], d[2]);
 				unsigned int cid = (unsigned int)d[0];
 
 				//Guardar identificador de la nube en conjunto
@@ -388,11 +391,6 @@ void Posiciones(std::string fileName, int delta, int cmax, std::vector<Punto> &r
 
 }
 
-int Posicion(int x, int y, int cmax, int delta)
-{
-	return x + (cmax / delta*y);
-}
-
 double DistanciaCoseno(const Punto &q, const Punto &bitmap, int pint)
 {
 	//Calcular norma de bitmap de consulta
@@ -0,0 +1,148 @@
+#pragma once
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file
+// Pages are loaded on demand and shared between all processes mapping the same file
+class MappedFile
+{
+private:
+	const char* data_ = nullptr;
+	std::size_t size_ = 0;
+
+#ifdef _WIN32
+	HANDLE file_ = INVALID_HANDLE_VALUE;
+	HANDLE mapping_ = nullptr;
+#endif
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (data_ != nullptr)
+			UnmapViewOfFile(data_);
+		if (mapping_ != nullptr)
+			CloseHandle(mapping_);
+		if (file_ != INVALID_HANDLE_VALUE)
+			CloseHandle(file_);
+		mapping_ = nullptr;
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		if (data_ != nullptr)
+			munmap(const_cast<char*>(data_), size_);
+#endif
+		data_ = nullptr;
+		size_ = 0;
+	}
+
+public:
+
+	explicit MappedFile(const std::string& fileName)
+	{
+#ifdef _WIN32
+		file_ = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file_ == INVALID_HANDLE_VALUE)
+			throw std::runtime_error("MappedFile: cannot open " + fileName);
+
+		LARGE_INTEGER size;
+		GetFileSizeEx(file_, &size);
+		size_ = static_cast<std::size_t>(size.QuadPart);
+
+		if (size_ > 0)
+		{
+			mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping_ != nullptr)
+				data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+
+			if (data_ == nullptr)
+			{
+				Close();
+				throw std::runtime_error("MappedFile: cannot map " + fileName);
+			}
+		}
+#else
+		int fd = open(fileName.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("MappedFile: cannot open " + fileName);
+
+		struct stat info;
+		if (fstat(fd, &info) != 0)
+		{
+			close(fd);
+			throw std::runtime_error("MappedFile: cannot stat " + fileName);
+		}
+
+		size_ = static_cast<std::size_t>(info.st_size);
+
+		if (size_ > 0)
+		{
+			void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+			if (data == MAP_FAILED)
+			{
+				close(fd);
+				throw std::runtime_error("MappedFile: cannot map " + fileName);
+			}
+			data_ = static_cast<const char*>(data);
+		}
+
+		// The mapping stays valid after closing the descriptor
+		close(fd);
+#endif
+	}
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* Data() const
+	{
+		return data_;
+	}
+
+	std::size_t Size() const
+	{
+		return size_;
+	}
+};
+
+// FNV-1a hash of a byte range, taken over 64-bit words (tail bytes one at a time)
+// Used to detect truncated or corrupted index files
+inline std::uint64_t Checksum(const void* data, std::size_t size, std::uint64_t seed = 14695981039346656037ull)
+{
+	const std::uint64_t prime{ 1099511628211ull };
+	const char* bytes = static_cast<const char*>(data);
+	std::uint64_t hash{ seed };
+
+	std::size_t i{ 0 };
+	for (; i + 8 <= size; i += 8)
+	{
+		std::uint64_t word;
+		std::memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * prime;
+	}
+
+	for (; i < size; i++)
+	{
+		hash = (hash ^ static_cast<unsigned char>(bytes[i])) * prime;
+	}
+
+	return hash;
+}
@@ -0,0 +1,454 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
+#include <cstdlib>
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+// NUMA topology and thread placement
+// Nodes and their CPUs come from /sys/devices/system/node (Linux) or the NUMA API (Windows),
+// other systems and machines without NUMA report a single node holding every CPU
+// Memory lands on the node of the thread that first touches it: data built by a thread pinned to a node stays local,
+// unless the thread asks for pages interleaved over every node (InterleaveMemory)
+
+// CPUs of a Linux cpulist, e.g. "0-3,8-11"
+inline std::vector<unsigned> ParseCpuList(const std::string& list)
+{
+	std::vector<unsigned> cpus;
+	std::stringstream ranges(list);
+	std::string range;
+
+	while (std::getline(ranges, range, ','))
+	{
+		if (range.empty() || range[0] < '0' || range[0] > '9')
+			continue;
+
+		auto dash = range.find('-');
+		auto first = static_cast<unsigned>(std::strtoul(range.c_str(), nullptr, 10));
+		auto last = dash == std::string::npos ? first : static_cast<unsigned>(std::strtoul(range.c_str() + dash + 1, nullptr, 10));
+
+		for (auto cpu = first; cpu <= last; cpu++)
+		{
+			cpus.push_back(cpu);
+		}
+	}
+
+	return cpus;
+}
+
+class NumaTopology
+{
+private:
+	// CPUs of every node - Nodes numbered 0..n-1 in increasing order of system ID
+	std::vector<std::vector<unsigned>> nodes_;
+	std::vector<unsigned> ids_;
+
+	NumaTopology()
+	{
+#ifdef _WIN32
+		ULONG highest{ 0 };
+		if (GetNumaHighestNodeNumber(&highest))
+		{
+			for (ULONG node = 0; node <= highest; node++)
+			{
+				GROUP_AFFINITY affinity;
+				if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity) || affinity.Mask == 0)
+					continue;
+
+				std::vector<unsigned> cpus;
+				for (unsigned bit = 0; bit < 8 * sizeof(affinity.Mask); bit++)
+				{
+					if (affinity.Mask & (KAFFINITY{ 1 } << bit))
+						cpus.push_back(64 * affinity.Group + bit);
+				}
+				nodes_.push_back(cpus);
+				ids_.push_back(node);
+			}
+		}
+#elif defined(__linux__)
+		if (auto dir = opendir("/sys/devices/system/node"))
+		{
+			std::vector<unsigned> found;
+			while (auto entry = readdir(dir))
+			{
+				std::string name(entry->d_name);
+				if (name.size() > 4 && name.compare(0, 4, "node") == 0 && name[4] >= '0' && name[4] <= '9')
+					found.push_back(static_cast<unsigned>(std::strtoul(name.c_str() + 4, nullptr, 10)));
+			}
+			closedir(dir);
+
+			std::sort(std::begin(found), std::end(found));
+			for (auto node : found)
+			{
+				std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+				std::string list;
+				std::getline(file, list);
+
+				auto cpus = ParseCpuList(list);
+				if (cpus.empty())
+					continue;
+
+				nodes_.push_back(cpus);
+				ids_.push_back(node);
+			}
+		}
+#endif
+
+		// No NUMA information - A single node with every CPU
+		if (nodes_.empty())
+		{
+			std::vector<unsigned> cpus(std::max(std::thread::hardware_concurrency(), 1u));
+			for (unsigned cpu = 0; cpu < cpus.size(); cpu++)
+			{
+				cpus[cpu] = cpu;
+			}
+			nodes_.push_back(cpus);
+			ids_.push_back(0);
+		}
+	}
+
+public:
+	// Topology of the machine, detected on first use
+	static const NumaTopology& Get()
+	{
+		static const NumaTopology topology;
+		return topology;
+	}
+
+	unsigned NumNodes() const
+	{
+		return static_cast<unsigned>(nodes_.size());
+	}
+
+	// CPUs of a node (node modulo NumNodes)
+	const std::vector<unsigned>& Cpus(unsigned node) const
+	{
+		return nodes_[node % nodes_.size()];
+	}
+
+	// Pin the calling thread to the CPUs of a node (node modulo NumNodes)
+	// Returns false if the system has no support or refused
+	bool PinThread(unsigned node) const
+	{
+		node %= NumNodes();
+
+#ifdef _WIN32
+		GROUP_AFFINITY affinity;
+		if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(ids_[node]), &affinity))
+			return false;
+		return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (auto cpu : nodes_[node])
+		{
+			if (cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &set);
+		}
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	// Pages first touched by the calling thread from now on are spread round-robin over every node
+	// Returns false if the system has no support or refused (Windows has no per-thread policy)
+	// Only new pages are placed: memory the allocator reuses keeps its node
+	bool InterleaveMemory() const
+	{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+		const int interleave = 3;
+		const std::size_t bits = 8 * sizeof(unsigned long);
+
+		std::vector<unsigned long> mask(*std::max_element(std::begin(ids_), std::end(ids_)) / bits + 1, 0);
+		for (auto id : ids_)
+		{
+			mask[id / bits] |= 1ul << (id % bits);
+		}
+		return syscall(SYS_set_mempolicy, interleave, mask.data(), mask.size() * bits + 1) == 0;
+#else
+		return false;
+#endif
+	}
+
+	// Back to first touch placement for the calling thread
+	bool LocalMemory() const
+	{
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+		return syscall(SYS_set_mempolicy, 0, nullptr, 0) == 0;
+#else
+		return false;
+#endif
+	}
+};
+
+// Worker threads pinned to a NUMA node - Tasks run in order of submission on the first free worker
+class NodeExecutor
+{
+private:
+	std::vector<std::thread> threads_;
+	std::deque<std::function<void()>> tasks_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	bool stop_ = false;
+	const unsigned node_;
+
+	void WorkerLoop()
+	{
+		NumaTopology::Get().PinThread(node_);
+
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				wake_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+
+				if (tasks_.empty())
+					return;
+
+				task = std::move(tasks_.front());
+				tasks_.pop_front();
+			}
+
+			task();
+		}
+	}
+
+public:
+	// numThreads: Workers (at least 1)
+	NodeExecutor(unsigned node, unsigned numThreads = 1) :node_{ node }
+	{
+		for (unsigned i = 0; i < std::max(numThreads, 1u); i++)
+		{
+			threads_.emplace_back([this] { WorkerLoop(); });
+		}
+	}
+
+	// Runs the tasks already submitted, then joins the workers
+	~NodeExecutor()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_all();
+
+		for (auto& thread : threads_)
+		{
+			thread.join();
+		}
+	}
+
+	NodeExecutor(const NodeExecutor&) = delete;
+	NodeExecutor& operator=(const NodeExecutor&) = delete;
+
+	unsigned Node() const
+	{
+		return node_;
+	}
+
+	unsigned NumThreads() const
+	{
+		return static_cast<unsigned>(threads_.size());
+	}
+
+	// Run task() on a worker - Exceptions reach the caller through the future
+	template<typename Task>
+	auto Submit(Task task) -> std::future<decltype(task())>
+	{
+		using Result = decltype(task());
+
+		auto packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+		auto future = packaged->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			tasks_.emplace_back([packaged] { (*packaged)(); });
+		}
+		wake_.notify_one();
+
+		return future;
+	}
+};
+
+// Placement of an index over the NUMA nodes
+// Single: One copy built on node 0 - Queries of other nodes read remote memory
+// Interleaved: One copy with its pages spread over every node - Every node reads a share of remote memory,
+// but no node's memory bandwidth carries all the queries
+// Replicated: One copy per node built on the node - Queries read local memory only, at the cost of
+// NumNodes times the memory and the build time (builds of different nodes run in parallel)
+enum class NumaPlacement { Single, Interleaved, Replicated };
+
+// Read-only index placed over the NUMA nodes with query workers pinned to every node
+// Each worker answers queries with the copy of its node, so with Replicated placement they never read
+// remote memory. Changes to the index after the build are not propagated between copies
+// Index: Any index class (IGI, Rtree, ...), move constructible
+template<typename Index>
+class NumaReplicas
+{
+private:
+	// replicas_[node] - Single and Interleaved placements share one copy
+	std::vector<std::shared_ptr<const Index>> replicas_;
+	std::vector<std::unique_ptr<NodeExecutor>> executors_;
+	const NumaPlacement placement_;
+
+	// Run query(index, queries[i]) for every query on the workers of every node
+	// offset: Workers of node n use the copy of node (n + offset) - 0 routes them to the local copy
+	template<typename Queries, typename Query>
+	auto Run(const Queries& queries, const Query& query, unsigned offset) const -> std::vector<decltype(query(std::declval<const Index&>(), queries[0]))>
+	{
+		using Result = decltype(query(std::declval<const Index&>(), queries[0]));
+
+		std::vector<Result> results(queries.size());
+		std::atomic<std::size_t> next{ 0 };
+
+		// Workers of every node take the next query, so faster nodes answer more of them
+		std::vector<std::future<void>> tasks;
+		for (std::size_t n = 0; n < executors_.size(); n++)
+		{
+			auto index = replicas_[(n + offset) % replicas_.size()].get();
+			for (unsigned t = 0; t < executors_[n]->NumThreads(); t++)
+			{
+				tasks.push_back(executors_[n]->Submit([&, index]
+				{
+					for (auto i = next++; i < queries.size(); i = next++)
+					{
+						results[i] = query(*index, queries[i]);
+					}
+				}));
+			}
+		}
+
+		// Every task references the results: wait for all of them before an exception leaves
+		for (auto& task : tasks)
+		{
+			task.wait();
+		}
+		for (auto& task : tasks)
+		{
+			task.get();
+		}
+
+		return results;
+	}
+
+public:
+	// build(): Returns the index - Called on a worker pinned to every node (Replicated) or to node 0
+	// threadsPerNode: Query workers of every node (0: one per CPU of the node)
+	template<typename Build>
+	NumaReplicas(const Build& build, NumaPlacement placement = NumaPlacement::Replicated, unsigned threadsPerNode = 0) :placement_{ placement }
+	{
+		const auto& topology = NumaTopology::Get();
+
+		for (unsigned node = 0; node < topology.NumNodes(); node++)
+		{
+			auto threads = threadsPerNode == 0 ? static_cast<unsigned>(topology.Cpus(node).size()) : threadsPerNode;
+			executors_.emplace_back(new NodeExecutor(node, threads));
+		}
+
+		auto copies = placement == NumaPlacement::Replicated ? topology.NumNodes() : 1u;
+		std::vector<std::future<std::shared_ptr<const Index>>> builds;
+		for (unsigned node = 0; node < copies; node++)
+		{
+			builds.push_back(executors_[node]->Submit([&build, placement, &topology]
+			{
+				// Restores first touch placement on the worker, even if build throws
+				struct Interleave
+				{
+					const NumaTopology& Topology;
+					const bool Enabled;
+					Interleave(const NumaTopology& topology, bool enabled) :Topology(topology), Enabled{ enabled && topology.InterleaveMemory() } {}
+					~Interleave() { if (Enabled) Topology.LocalMemory(); }
+				} interleave(topology, placement == NumaPlacement::Interleaved);
+
+				return std::shared_ptr<const Index>(std::make_shared<Index>(build()));
+			}));
+		}
+
+		for (auto& future : builds)
+		{
+			future.wait();
+		}
+		for (auto& future : builds)
+		{
+			replicas_.push_back(future.get());
+		}
+	}
+
+	NumaPlacement Placement() const
+	{
+		return placement_;
+	}
+
+	unsigned NumNodes() const
+	{
+		return static_cast<unsigned>(executors_.size());
+	}
+
+	// Copy read by the workers of a node
+	const Index& Replica(unsigned node) const
+	{
+		return *replicas_[node % replicas_.size()];
+	}
+
+	// Batch query - Results in the same order as queries
+	// query(index, queries[i]): Answer one query, e.g. [k](const IGI<Point>& index, const Cloud<Point>& cloud) { return index.KNN(cloud, k); }
+	// Must only read the index
+	template<typename Queries, typename Query>
+	auto KNNBatch(const Queries& queries, const Query& query) const -> std::vector<decltype(query(std::declval<const Index&>(), queries[0]))>
+	{
+		return Run(queries, query, 0);
+	}
+
+	// Throughput of KNNBatch in queries per second: workers routed to the copy of their node (first)
+	// vs to the copy of the next node (second)
+	// Remote reads only exist with Replicated placement on several nodes, otherwise both runs read the same memory
+	// repetitions: Batches timed for each routing, the best one is reported
+	template<typename Queries, typename Query>
+	std::pair<double, double> LocalRemoteThroughput(const Queries& queries, const Query& query, const unsigned repetitions = 3) const
+	{
+		auto throughput = [&](unsigned offset)
+		{
+			double best{ 0.0 };
+			for (unsigned r = 0; r < std::max(repetitions, 1u); r++)
+			{
+				auto start = std::chrono::steady_clock::now();
+				Run(queries, query, offset);
+				std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+				if (seconds.count() > 0.0)
+					best = std::max(best, queries.size() / seconds.count());
+			}
+			return best;
+		};
+
+		auto local = throughput(0);
+		return std::make_pair(local, throughput(1));
+	}
+};
@@ -1,6 +1,7 @@
 #pragma once
 #include <unordered_map>
 #include <vector>
+#include <cstddef>
 // Miguel Ramirez Chacon
 // 17/05/17
 
@@ -12,4 +13,8 @@ struct PerformanceReport
 	double SDQueryTime;
 	double MaxQueryTime;
 	double MinQueryTime;
+	// Heap allocations made while each query ran, by any thread (see AllocationCounter.h)
+	std::vector<std::size_t> QueriesAllocations;
+	double AverageAllocations;
+	std::size_t MaxAllocations;
 };
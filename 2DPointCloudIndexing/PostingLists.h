@@ -0,0 +1,413 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <utility>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+// Posting lists of a grid index flattened in CSR layout
+// Offsets: one entry per cell (+1), position of the first ID of the cell in Ids
+// Ids: IDs of all cells stored contiguously, cell by cell
+// Cells (sparse layout only): sorted cells that have a list, Offsets then has one entry per list (+1)
+// and a cell is found by binary search - Small lists over a large grid cost their size, not the grid's
+// Weights (optional): multiplicity of every entry of Ids - Weighted lists keep every ID once per cell,
+// sorted, with the number of points the cloud has in the cell
+// The arrays are immutable once built and may live in memory owned by the object or in a file mapping,
+// copies share the same arrays
+
+// Votes of a posting list at query time
+// Points: one vote per indexed point of the cloud in the cell (original IGI)
+// Set: one vote per cloud in the cell (as SuccinctIGI)
+enum class Voting { Points, Set };
+
+// Addressing of the cells of PostingLists
+// Dense: offsets of every cell of [0, max cell], direct lookup (compacted indexes)
+// Sparse: offsets of the cells with a list only, binary search (small segments)
+enum class CellLayout { Dense, Sparse };
+
+// Read-only range of IDs inside a posting array
+struct PostingSpan
+{
+	PostingSpan() :First{ nullptr }, Last{ nullptr }, Weights{ nullptr } {}
+	PostingSpan(const unsigned* first, const unsigned* last, const unsigned* weights = nullptr) :First{ first }, Last{ last }, Weights{ weights } {}
+
+	const unsigned* begin() const { return First; }
+	const unsigned* end() const { return Last; }
+	std::size_t size() const { return Last - First; }
+	bool empty() const { return First == Last; }
+
+	// Number of distinct IDs - Unweighted lists count runs of equal IDs (exact for IDs added by a single Add)
+	std::size_t NumClouds() const
+	{
+		if (Weights != nullptr)
+			return size();
+
+		std::size_t clouds{ 0 };
+		for (auto it = First; it != Last; ++it)
+		{
+			if (it == First || *it != *(it - 1))
+				clouds++;
+		}
+		return clouds;
+	}
+
+	// Add the votes of the list to a VoteCounter
+	// Unweighted lists hold one entry per point: with Set voting consecutive repeats of an ID count once,
+	// which is exact for IDs added by a single Add
+	// times: Number of query points in the cell, every vote is multiplied by it (may carry a cell weight)
+	template<typename Counter, typename Times = unsigned>
+	void Vote(Counter& count, Voting voting, Times times = 1) const
+	{
+		if (Weights != nullptr)
+		{
+			for (auto it = First; it != Last; ++it)
+			{
+				count.Add(*it, voting == Voting::Points ? Weights[it - First] * times : times);
+			}
+			return;
+		}
+
+		if (voting == Voting::Points)
+		{
+			for (auto it = First; it != Last; ++it)
+			{
+				count.Add(*it, times);
+			}
+			return;
+		}
+
+		for (auto it = First; it != Last; ++it)
+		{
+			if (it == First || *it != *(it - 1))
+				count.Add(*it, times);
+		}
+	}
+
+	// Add the points shared by the query and every cloud of the list: min(query points, cloud points) in the cell
+	// Summed over the cells of a query it is the size of the intersection of the query and the cloud (Jaccard)
+	// times: Number of query points in the cell
+	template<typename Counter>
+	void VoteOverlap(Counter& count, unsigned times) const
+	{
+		if (Weights != nullptr)
+		{
+			for (auto it = First; it != Last; ++it)
+			{
+				count.Add(*it, std::min(Weights[it - First], times));
+			}
+			return;
+		}
+
+		// One entry per point: runs of equal IDs
+		for (auto it = First; it != Last;)
+		{
+			auto run = it;
+			while (run != Last && *run == *it)
+			{
+				++run;
+			}
+
+			count.Add(*it, std::min(static_cast<unsigned>(run - it), times));
+			it = run;
+		}
+	}
+
+	const unsigned* First;
+	const unsigned* Last;
+
+	// Multiplicity of every ID (nullptr: every entry is one point)
+	const unsigned* Weights;
+};
+
+class PostingLists
+{
+private:
+	struct Arrays
+	{
+		std::vector<std::uint64_t> Offsets;
+		std::vector<unsigned> Cells;
+		std::vector<unsigned> Ids;
+		std::vector<unsigned> Weights;
+	};
+
+	// Owner of the arrays
+	std::shared_ptr<const void> storage_;
+	const std::uint64_t* offsets_ = nullptr;
+	const unsigned* cells_ = nullptr;
+	const unsigned* ids_ = nullptr;
+	const unsigned* weights_ = nullptr;
+	std::size_t numCells_ = 0;
+	std::size_t numLists_ = 0;
+	std::size_t numPostings_ = 0;
+
+public:
+	PostingLists() {}
+
+	// Flatten an Inverted Index (cell -> IDs)
+	// weighted: Store every ID once per cell, sorted, with its multiplicity
+	// layout: Dense offsets cover [0, max cell], sparse ones the cells of the index only
+	explicit PostingLists(const std::unordered_map<unsigned, std::vector<unsigned>>& cells, bool weighted = false, CellLayout layout = CellLayout::Dense)
+	{
+		if (cells.empty())
+			return;
+
+		// Cells in increasing order - The offsets are then a running total
+		std::vector<unsigned> order;
+		order.reserve(cells.size());
+		std::uint64_t totalIds{ 0 };
+		for (const auto& pair : cells)
+		{
+			order.push_back(pair.first);
+			totalIds += pair.second.size();
+		}
+		std::sort(std::begin(order), std::end(order));
+		auto maxCell = order.back();
+
+		auto arrays = std::make_shared<Arrays>();
+		auto& offsets = arrays->Offsets;
+		auto& ids = arrays->Ids;
+		auto& weights = arrays->Weights;
+
+		if (layout == CellLayout::Dense)
+			offsets.assign(static_cast<std::size_t>(maxCell) + 2, 0);
+		else
+			offsets.assign(order.size() + 1, 0);
+
+		if (!weighted)
+			ids.reserve(static_cast<std::size_t>(totalIds));
+
+		std::vector<unsigned> sorted;
+
+		for (std::size_t i = 0; i < order.size(); i++)
+		{
+			const auto& list = cells.find(order[i])->second;
+
+			if (weighted)
+			{
+				// Sort the cell and collapse repeated IDs into (ID, multiplicity)
+				sorted.assign(std::begin(list), std::end(list));
+				std::sort(std::begin(sorted), std::end(sorted));
+
+				for (std::size_t j = 0; j < sorted.size(); j++)
+				{
+					if (j == 0 || sorted[j] != sorted[j - 1])
+					{
+						ids.push_back(sorted[j]);
+						weights.push_back(1);
+					}
+					else
+					{
+						weights.back()++;
+					}
+				}
+			}
+			else
+			{
+				ids.insert(std::end(ids), std::begin(list), std::end(list));
+			}
+
+			offsets[layout == CellLayout::Dense ? order[i] + 1 : i + 1] = ids.size();
+		}
+
+		// Empty cells start where the previous cell ends
+		for (std::size_t i = 1; i < offsets.size(); i++)
+		{
+			offsets[i] = std::max(offsets[i], offsets[i - 1]);
+		}
+
+		ids.shrink_to_fit();
+		weights.shrink_to_fit();
+
+		if (layout == CellLayout::Sparse)
+		{
+			arrays->Cells = std::move(order);
+			cells_ = arrays->Cells.data();
+		}
+
+		offsets_ = offsets.data();
+		ids_ = ids.data();
+		weights_ = weighted ? weights.data() : nullptr;
+		numCells_ = static_cast<std::size_t>(maxCell) + 1;
+		numLists_ = offsets.size() - 1;
+		numPostings_ = ids.size();
+		storage_ = std::move(arrays);
+	}
+
+	// Merge of several posting lists - e.g. the layers of an index into a single one, with dense offsets
+	// layers: The IDs of every cell follow the order of the layers
+	// dead(layer, id): true for the postings of an ID to drop from a layer
+	// weighted: Layout of the result - Entries of unweighted layers count one point, IDs found in several layers
+	// add their multiplicities. Weighted layers are expanded in an unweighted result
+	template<typename Dead>
+	PostingLists(const std::vector<const PostingLists*>& layers, const Dead& dead, bool weighted)
+	{
+		std::size_t numCells{ 0 };
+		std::size_t totalIds{ 0 };
+		for (auto layer : layers)
+		{
+			numCells = std::max(numCells, layer->NumCells());
+			totalIds += layer->NumPostings();
+		}
+
+		if (numCells == 0)
+			return;
+
+		auto arrays = std::make_shared<Arrays>();
+		auto& offsets = arrays->Offsets;
+		auto& ids = arrays->Ids;
+		auto& weights = arrays->Weights;
+
+		offsets.assign(numCells + 1, 0);
+		ids.reserve(totalIds);
+		if (weighted)
+			weights.reserve(totalIds);
+
+		std::vector<std::pair<unsigned, unsigned>> entries;
+
+		for (std::size_t cell = 0; cell < numCells; cell++)
+		{
+			entries.clear();
+
+			for (std::size_t l = 0; l < layers.size(); l++)
+			{
+				auto list = layers[l]->Find(static_cast<unsigned>(cell));
+				for (auto it = list.begin(); it != list.end(); ++it)
+				{
+					if (dead(l, *it))
+						continue;
+
+					auto weight = list.Weights == nullptr ? 1 : list.Weights[it - list.begin()];
+					if (weighted)
+					{
+						entries.emplace_back(*it, weight);
+						continue;
+					}
+
+					ids.insert(std::end(ids), weight, *it);
+				}
+			}
+
+			if (weighted && !entries.empty())
+			{
+				// Collapse every ID into (ID, multiplicity), sorted by ID
+				std::sort(std::begin(entries), std::end(entries));
+
+				for (std::size_t i = 0; i < entries.size(); i++)
+				{
+					if (i == 0 || entries[i].first != entries[i - 1].first)
+					{
+						ids.push_back(entries[i].first);
+						weights.push_back(entries[i].second);
+					}
+					else
+					{
+						weights.back() += entries[i].second;
+					}
+				}
+			}
+
+			offsets[cell + 1] = ids.size();
+		}
+
+		ids.shrink_to_fit();
+		weights.shrink_to_fit();
+
+		offsets_ = offsets.data();
+		ids_ = ids.data();
+		weights_ = weighted ? weights.data() : nullptr;
+		numCells_ = numCells;
+		numLists_ = numCells;
+		numPostings_ = ids.size();
+		storage_ = std::move(arrays);
+	}
+
+	// View over arrays owned by someone else (e.g. a file mapping)
+	// owner: Keeps the arrays alive
+	// offsets: numCells + 1 entries
+	// weights: numPostings entries, nullptr for unweighted lists
+	PostingLists(std::shared_ptr<const void> owner, const std::uint64_t* offsets, std::size_t numCells, const unsigned* ids, std::size_t numPostings, const unsigned* weights = nullptr)
+		:storage_{ std::move(owner) }, offsets_{ offsets }, ids_{ ids }, weights_{ weights }, numCells_{ numCells }, numLists_{ numCells }, numPostings_{ numPostings } {}
+
+	// IDs of a cell - Empty span if the cell has no points
+	PostingSpan Find(unsigned cell) const
+	{
+		if (cell >= numCells_)
+			return PostingSpan();
+
+		std::size_t list = cell;
+		if (cells_ != nullptr)
+		{
+			auto it = std::lower_bound(cells_, cells_ + numLists_, cell);
+			if (it == cells_ + numLists_ || *it != cell)
+				return PostingSpan();
+
+			list = it - cells_;
+		}
+
+		auto first = offsets_[list];
+		auto last = offsets_[list + 1];
+
+		return PostingSpan(ids_ + first, ids_ + last, weights_ == nullptr ? nullptr : weights_ + first);
+	}
+
+	bool IsWeighted() const
+	{
+		return weights_ != nullptr;
+	}
+
+	bool IsSparse() const
+	{
+		return cells_ != nullptr;
+	}
+
+	// Cells addressed: max cell + 1 - Dense lists have an offset for each of them
+	std::size_t NumCells() const
+	{
+		return numCells_;
+	}
+
+	// Lists stored: NumCells() for dense lists, cells with points for sparse ones
+	std::size_t NumLists() const
+	{
+		return numLists_;
+	}
+
+	std::size_t NumPostings() const
+	{
+		return numPostings_;
+	}
+
+	// Bytes of the arrays: offsets, cells (sparse lists), IDs and multiplicities
+	std::size_t SizeInBytes() const
+	{
+		auto numOffsets = numLists_ == 0 ? 0 : numLists_ + 1;
+		auto numWeights = weights_ == nullptr ? 0 : numPostings_;
+		auto numCells = cells_ == nullptr ? 0 : numLists_;
+		return numOffsets * sizeof(std::uint64_t) + (numCells + numPostings_ + numWeights) * sizeof(unsigned);
+	}
+
+	// Raw arrays - Offsets has NumLists() + 1 entries (none if the index is empty)
+	const std::uint64_t* Offsets() const
+	{
+		return offsets_;
+	}
+
+	// NumLists() entries for sparse lists, nullptr for dense ones
+	const unsigned* Cells() const
+	{
+		return cells_;
+	}
+
+	const unsigned* Ids() const
+	{
+		return ids_;
+	}
+
+	// NumPostings() entries, nullptr for unweighted lists
+	const unsigned* Weights() const
+	{
+		return weights_;
+	}
+};
@@ -0,0 +1,319 @@
+#pragma once
+#include "Cloud.h"
+#include "PerformanceReport.h"
+#include "UtilityFunctions.h"
+#include "VoteCounter.h"
+#include "ThreadPool.h"
+#include "PostingLists.h"
+#include "QueryCells.h"
+#include <boost/geometry.hpp>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+// Multi-resolution (pyramid) Inverted Grid Index for Point Clouds
+// Level 0 is the grid of an IGI with cells of side delta, level l has cells of side delta * 2^l:
+// every cell of level l + 1 covers exactly 2x2 cells of level l (quadtree aligned)
+// All levels share the ID space and keep weighted posting lists (ID, number of points), sorted by ID
+// A query votes the coarsest level over every cloud, keeps the best candidates and refines
+// level by level only for the clouds that survived, so one index replaces the IGIs built for several deltas
+// T: Point class(2D)
+
+template<typename T = boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>>
+class PyramidIGI
+{
+private:
+	// Posting lists of every level, level 0 is the finest
+	std::vector<PostingLists> levels_;
+	std::vector<GridQuantizer> grids_;
+	std::unordered_map<unsigned, unsigned> sizeClouds;
+
+	// Streaming build - IDs of every cell of every level until Finalize
+	std::vector<std::unordered_map<unsigned, std::vector<unsigned>>> pendingCells_;
+	bool finalized_ = false;
+
+	const std::string name_;
+	const unsigned cmax_;
+	const unsigned delta_;
+
+	// Votes of the candidates (sorted IDs) found in a posting list (sorted IDs)
+	// Long lists are searched for every candidate instead of being scanned
+	template<typename Counter>
+	static void VoteCandidates(Counter& count, const PostingSpan& list, const std::vector<unsigned>& candidates, Voting voting, unsigned times)
+	{
+		auto it = list.begin();
+
+		if (list.size() > 8 * candidates.size())
+		{
+			for (auto id : candidates)
+			{
+				it = std::lower_bound(it, list.end(), id);
+				if (it == list.end())
+					return;
+				if (*it == id)
+					count.Add(id, voting == Voting::Points ? list.Weights[it - list.begin()] * times : times);
+			}
+			return;
+		}
+
+		auto candidate = std::begin(candidates);
+		while (it != list.end() && candidate != std::end(candidates))
+		{
+			if (*it < *candidate)
+				++it;
+			else if (*candidate < *it)
+				++candidate;
+			else
+			{
+				count.Add(*it, voting == Voting::Points ? list.Weights[it - list.begin()] * times : times);
+				++it;
+				++candidate;
+			}
+		}
+	}
+
+public:
+
+	// Empty index - Streaming build: Add clouds one at a time, then Finalize
+	// levels: Number of grids, the coarsest has cells of side delta * 2^(levels - 1)
+	PyramidIGI(std::string name, const unsigned cmax, const unsigned delta, const unsigned levels = 3)
+		:pendingCells_(levels), name_{ name }, cmax_{ cmax }, delta_{ delta }
+	{
+		if (levels == 0 || levels > 16 || delta == 0 || cmax / (delta << (levels - 1)) == 0)
+			throw std::invalid_argument("PyramidIGI: the coarsest grid must have at least one cell per row");
+
+		for (unsigned level = 0; level < levels; level++)
+		{
+			grids_.emplace_back(cmax, delta << level);
+		}
+	}
+
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	PyramidIGI(const Clouds& pointClouds, std::string name, const unsigned cmax, const unsigned delta, const unsigned levels = 3)
+		:PyramidIGI(name, cmax, delta, levels)
+	{
+		AddRange(std::begin(pointClouds), std::end(pointClouds));
+		Finalize();
+	}
+
+	std::string GetName()
+	{
+		return name_;
+	}
+
+	unsigned NumLevels() const
+	{
+		return static_cast<unsigned>(grids_.size());
+	}
+
+	// Add PointCloud to Index
+	// The cloud is searchable after Finalize
+	template<typename C>
+	PyramidIGI& Add(const C& pointCloud)
+	{
+		if (finalized_)
+			throw std::logic_error("PyramidIGI: Add on a finalized index");
+
+		// Get size of all PointCloud for calculate support
+		sizeClouds[pointCloud.ID] += static_cast<unsigned>(pointCloud.Points.size());
+
+		thread_local std::vector<unsigned> cells;
+
+		for (std::size_t level = 0; level < grids_.size(); level++)
+		{
+			// Cell of every point in the grid of the level
+			grids_[level].Cells(pointCloud.Points, cells);
+
+			auto& index = pendingCells_[level];
+			for (auto cell : cells)
+			{
+				// Inverted Index - One entry per point, collapsed into (ID, multiplicity) by Finalize
+				index[cell].push_back(pointCloud.ID);
+			}
+		}
+
+		return *this;
+	}
+
+	// Add the clouds of [first, last) - e.g. a range of a CloudSet or a chunk read from a file
+	template<typename Iterator>
+	PyramidIGI& AddRange(Iterator first, Iterator last)
+	{
+		for (; first != last; ++first)
+		{
+			Add(*first);
+		}
+
+		return *this;
+	}
+
+	// End of a streaming build - Flatten every level in CSR layout with weighted lists
+	PyramidIGI& Finalize()
+	{
+		if (finalized_)
+			return *this;
+
+		for (auto& index : pendingCells_)
+		{
+			levels_.emplace_back(index, true);
+			std::unordered_map<unsigned, std::vector<unsigned>>().swap(index);
+		}
+
+		finalized_ = true;
+
+		return *this;
+	}
+
+	// KNN Query
+	// First Parameter: queryCloud =  PointCloud
+	// Second Parameter: k = Nearest Neighbors
+	// Third Parameter: candidates = Clouds kept by every coarse level for the next one (at least k)
+	// Fourth Parameter: voting = One vote per indexed point (Points) or per cloud (Set) in every cell
+	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k, const unsigned candidates = 64, Voting voting = Voting::Points) const
+	{
+		if (!finalized_)
+			throw std::logic_error("PyramidIGI: KNN before Finalize");
+
+		auto& count = VoteCounter<>::Local();
+		auto level = levels_.size() - 1;
+
+		// Coarsest level - Votes of every cloud
+		for (const auto& queryCell : QueryCells(queryCloud.Points, grids_[level]))
+		{
+			levels_[level].Find(queryCell.Cell).Vote(count, voting, queryCell.Count);
+		}
+
+		thread_local std::vector<unsigned> survivors;
+
+		// Finer levels - Votes of the survivors of the previous level only
+		while (level-- > 0)
+		{
+			auto best = count.TopK(std::max(candidates, k));
+
+			survivors.clear();
+			for (const auto& pair : best)
+			{
+				survivors.push_back(pair.first);
+			}
+			std::sort(std::begin(survivors), std::end(survivors));
+
+			count.Clear();
+			for (const auto& queryCell : QueryCells(queryCloud.Points, grids_[level]))
+			{
+				auto list = levels_[level].Find(queryCell.Cell);
+				if (!list.empty())
+					VoteCandidates(count, list, survivors, voting, queryCell.Count);
+			}
+		}
+
+		// Get k approximate nearest neighbors
+		return count.TopK(k);
+	}
+
+	// KNN Query on a single level - Same result as an IGI with cells of side delta * 2^level
+	// First Parameter: queryCloud =  PointCloud
+	// Second Parameter: k = Nearest Neighbors
+	// Third Parameter: level = Grid used, 0 is the finest
+	// Fourth Parameter: voting = One vote per indexed point (Points) or per cloud (Set) in every cell
+	std::vector<std::pair<unsigned, unsigned>> KNNLevel(const Cloud<T>& queryCloud, const unsigned k, const unsigned level, Voting voting = Voting::Points) const
+	{
+		if (!finalized_)
+			throw std::logic_error("PyramidIGI: KNN before Finalize");
+		if (level >= levels_.size())
+			throw std::out_of_range("PyramidIGI: level out of range");
+
+		auto& count = VoteCounter<>::Local();
+
+		for (const auto& queryCell : QueryCells(queryCloud.Points, grids_[level]))
+		{
+			levels_[level].Find(queryCell.Cell).Vote(count, voting, queryCell.Count);
+		}
+
+		return count.TopK(k);
+	}
+
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: candidates = Clouds kept by every coarse level, as in KNN
+	// 4th Parameter: numThreads = Worker threads
+	std::vector<std::vector<std::pair<unsigned, unsigned>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned candidates = 64, const unsigned numThreads = DefaultThreads()) const
+	{
+		std::vector<std::vector<std::pair<unsigned, unsigned>>> results(queryClouds.size());
+
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
+		{
+			results[i] = KNN(queryClouds[i], k, candidates);
+		}, numThreads);
+
+		return results;
+	}
+
+	// Number of (ID, multiplicity) entries of a level
+	std::size_t NumPostings(unsigned level) const
+	{
+		return level < levels_.size() ? levels_[level].NumPostings() : 0;
+	}
+
+	// Bytes used by the posting lists of all levels (cell offsets + IDs + multiplicities)
+	std::size_t SizeInBytes() const
+	{
+		std::size_t bytes{ 0 };
+		for (const auto& lists : levels_)
+		{
+			auto numOffsets = lists.NumCells() == 0 ? 0 : lists.NumCells() + 1;
+			bytes += numOffsets * sizeof(std::uint64_t) + 2 * lists.NumPostings() * sizeof(unsigned);
+		}
+		return bytes;
+	}
+
+	// Performance report on KNN Search
+	// Obtain Recall@
+	// Average query time, Standard deviation query time, max query time and min query time
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: recallAt = Vector for desired Recall@
+	// 4th Parameter: candidates = Clouds kept by every coarse level, as in KNN
+	template<typename D = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const std::vector<unsigned>& recallAt, const unsigned candidates = 64) const
+	{
+		PerformanceReport performance;
+		performance.QueriesTime.reserve(queryClouds.size());
+		performance.RecallAt.reserve(queryClouds.size());
+		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
+
+		// For every cloud in vector of PointClouds
+		for (const auto& cloud : queryClouds)
+		{
+			// Perform KNN search
+			allocations = AllocationCount();
+			start = std::chrono::high_resolution_clock::now();
+			auto result = KNN(cloud, k, candidates);
+			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
+
+			GetRecall(performance, result, recallAt, cloud.ID);
+
+			performance.QueriesTime.push_back(std::chrono::duration_cast<D>(end - start).count());
+		}
+		// Calculate Recall@
+		for (auto& pair : performance.RecallAt)
+		{
+			pair.second = pair.second / static_cast<double>(queryClouds.size());
+		}
+
+		TimePerformance(performance);
+		AllocationPerformance(performance);
+
+		return performance;
+	}
+
+};
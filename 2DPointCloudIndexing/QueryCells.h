@@ -0,0 +1,120 @@
+#pragma once
+#include "GridQuantizer.h"
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <limits>
+#include <cstdlib>
+#include <cstddef>
+
+// Grid cells of the points of a query cloud
+// A query with many points falling in few cells probes every cell once instead of once per point
+// The buffers belong to the calling thread and are overwritten by the next call on the same thread
+
+// A cell and the number of query points inside it
+struct QueryCell
+{
+	unsigned Cell;
+	unsigned Count;
+};
+
+// Distinct cells of the points, sorted, with the number of points in each
+template<typename T>
+const std::vector<QueryCell>& QueryCells(const std::vector<T>& points, const GridQuantizer& grid)
+{
+	thread_local std::vector<unsigned> cells;
+	thread_local std::vector<QueryCell> result;
+
+	grid.Cells(points, cells);
+	std::sort(std::begin(cells), std::end(cells));
+
+	result.clear();
+	for (std::size_t i = 0; i < cells.size(); i++)
+	{
+		if (i > 0 && cells[i] == cells[i - 1])
+			result.back().Count++;
+		else
+			result.push_back(QueryCell{ cells[i], 1 });
+	}
+
+	return result;
+}
+
+// (cell, index of the point) for every point, sorted by cell
+// For indexes that still run one search per point but look up every cell once
+template<typename T>
+const std::vector<std::pair<unsigned, unsigned>>& PointsByCell(const std::vector<T>& points, const GridQuantizer& grid)
+{
+	thread_local std::vector<unsigned> cells;
+	thread_local std::vector<std::pair<unsigned, unsigned>> result;
+
+	grid.Cells(points, cells);
+
+	result.resize(cells.size());
+	for (std::size_t i = 0; i < cells.size(); i++)
+	{
+		result[i] = std::make_pair(cells[i], static_cast<unsigned>(i));
+	}
+	std::sort(std::begin(result), std::end(result));
+
+	return result;
+}
+
+// Cells within Chebyshev distance radius of the query cells, sorted, with their summed votes
+// A neighbor at distance d of a cell holding n query points gets n * (radius + 1 - d) votes,
+// so the cell itself weighs radius + 1 and the outer ring 1
+// Neighbors outside the grid (past either end of a row or below the first row) are skipped
+// radius 0: the query cells themselves
+inline const std::vector<QueryCell>& NeighborCells(const std::vector<QueryCell>& queryCells, const GridQuantizer& grid, unsigned radius)
+{
+	thread_local std::vector<QueryCell> neighbors;
+	thread_local std::vector<QueryCell> result;
+
+	const long long row = grid.CellsPerRow();
+	const long long r = radius;
+
+	neighbors.clear();
+	for (const auto& queryCell : queryCells)
+	{
+		if (row == 0)
+		{
+			neighbors.push_back(QueryCell{ queryCell.Cell, queryCell.Count * (radius + 1) });
+			continue;
+		}
+
+		const long long px = queryCell.Cell % row;
+		const long long py = queryCell.Cell / row;
+
+		for (auto dy = -r; dy <= r; dy++)
+		{
+			auto y = py + dy;
+			if (y < 0)
+				continue;
+
+			for (auto dx = -r; dx <= r; dx++)
+			{
+				auto x = px + dx;
+				auto cell = x + row*y;
+				if (x < 0 || x >= row || cell > static_cast<long long>(std::numeric_limits<unsigned>::max()))
+					continue;
+
+				auto distance = static_cast<unsigned>(std::max(std::abs(dx), std::abs(dy)));
+				neighbors.push_back(QueryCell{ static_cast<unsigned>(cell), queryCell.Count * (radius + 1 - distance) });
+			}
+		}
+	}
+
+	std::sort(std::begin(neighbors), std::end(neighbors), [](const QueryCell& left, const QueryCell& right) {return left.Cell < right.Cell; });
+
+	// Neighborhoods of close query cells overlap - Sum the votes of every cell
+	result.clear();
+	for (const auto& neighbor : neighbors)
+	{
+		if (!result.empty() && result.back().Cell == neighbor.Cell)
+			result.back().Count += neighbor.Count;
+		else
+			result.push_back(neighbor);
+	}
+
+	return result;
+}
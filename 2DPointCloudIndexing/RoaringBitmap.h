@@ -0,0 +1,223 @@
+#pragma once
+#include "BitUtility.h"
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// Roaring style compressed set of 32 bit IDs
+// IDs are split in chunks of 2^16 by their high 16 bits, every chunk is stored in the smallest of:
+// Array: sorted low 16 bits (2 bytes per ID) - sparse chunks
+// Bitmap: 2^16 bits (8 KB) - dense chunks
+// Run: (start, length - 1) pairs of consecutive IDs (4 bytes per run) - clustered chunks
+// The set is immutable once built
+
+class RoaringBitmap
+{
+public:
+	enum class Kind : std::uint8_t { Array, Bitmap, Run };
+
+private:
+	static const std::size_t bitmapWords = 1024;
+
+	struct Container
+	{
+		std::uint16_t Key;
+		Kind Type;
+		std::uint32_t Cardinality;
+
+		// Array: values - Run: start, length - 1, start, length - 1, ...
+		std::vector<std::uint16_t> Values;
+
+		// Bitmap: bitmapWords words
+		std::vector<std::uint64_t> Words;
+	};
+
+	std::vector<Container> containers_;
+	std::size_t cardinality_ = 0;
+
+	// Store the low 16 bits of a chunk in its cheapest container
+	static Container MakeContainer(std::uint16_t key, const std::uint32_t* first, const std::uint32_t* last)
+	{
+		Container container;
+		container.Key = key;
+		container.Cardinality = static_cast<std::uint32_t>(last - first);
+
+		std::size_t runs{ 1 };
+		for (auto it = first + 1; it < last; ++it)
+		{
+			if (*it != *(it - 1) + 1)
+				runs++;
+		}
+
+		auto arrayBytes = 2 * static_cast<std::size_t>(container.Cardinality);
+		auto bitmapBytes = bitmapWords * sizeof(std::uint64_t);
+		auto runBytes = 4 * runs;
+
+		if (runBytes < arrayBytes && runBytes < bitmapBytes)
+		{
+			container.Type = Kind::Run;
+			container.Values.reserve(2 * runs);
+
+			auto start = first;
+			for (auto it = first + 1; it <= last; ++it)
+			{
+				if (it == last || *it != *(it - 1) + 1)
+				{
+					container.Values.push_back(static_cast<std::uint16_t>(*start & 0xFFFF));
+					container.Values.push_back(static_cast<std::uint16_t>(it - start - 1));
+					start = it;
+				}
+			}
+		}
+		else if (arrayBytes <= bitmapBytes)
+		{
+			container.Type = Kind::Array;
+			container.Values.reserve(container.Cardinality);
+
+			for (auto it = first; it < last; ++it)
+			{
+				container.Values.push_back(static_cast<std::uint16_t>(*it & 0xFFFF));
+			}
+		}
+		else
+		{
+			container.Type = Kind::Bitmap;
+			container.Words.assign(bitmapWords, 0);
+
+			for (auto it = first; it < last; ++it)
+			{
+				auto low = *it & 0xFFFF;
+				container.Words[low >> 6] |= std::uint64_t{ 1 } << (low & 63);
+			}
+		}
+
+		return container;
+	}
+
+public:
+	RoaringBitmap() {}
+
+	// Build from sorted, deduplicated IDs
+	explicit RoaringBitmap(const std::vector<std::uint32_t>& ids)
+	{
+		cardinality_ = ids.size();
+
+		auto first = ids.data();
+		auto last = ids.data() + ids.size();
+
+		while (first < last)
+		{
+			auto key = *first >> 16;
+			auto chunkEnd = std::upper_bound(first, last, (key << 16) | 0xFFFF);
+
+			containers_.push_back(MakeContainer(static_cast<std::uint16_t>(key), first, chunkEnd));
+			first = chunkEnd;
+		}
+	}
+
+	// Number of IDs
+	std::size_t size() const
+	{
+		return cardinality_;
+	}
+
+	// Call f(id) for every ID in increasing order
+	template<typename F>
+	void ForEach(F f) const
+	{
+		for (const auto& container : containers_)
+		{
+			std::uint32_t base = static_cast<std::uint32_t>(container.Key) << 16;
+
+			switch (container.Type)
+			{
+			case Kind::Array:
+				for (auto value : container.Values)
+				{
+					f(base | value);
+				}
+				break;
+
+			case Kind::Bitmap:
+				for (std::size_t w = 0; w < bitmapWords; w++)
+				{
+					auto word = container.Words[w];
+					while (word != 0)
+					{
+						f(base | static_cast<std::uint32_t>(w * 64 + CountTrailingZeros(word)));
+						word &= word - 1;
+					}
+				}
+				break;
+
+			case Kind::Run:
+				for (std::size_t r = 0; r < container.Values.size(); r += 2)
+				{
+					std::uint32_t start = base | container.Values[r];
+					std::uint32_t end = start + container.Values[r + 1] + 1;
+					for (auto id = start; id < end; id++)
+					{
+						f(id);
+					}
+				}
+				break;
+			}
+		}
+	}
+
+	// Add votes to every ID - Counter: VoteCounter
+	// Bitmaps are voted a word at a time (VoteCounter::AddWord), runs as ranges of words (VoteCounter::AddRange)
+	template<typename Counter, typename Count>
+	void Vote(Counter& count, Count votes) const
+	{
+		for (const auto& container : containers_)
+		{
+			std::uint32_t base = static_cast<std::uint32_t>(container.Key) << 16;
+
+			switch (container.Type)
+			{
+			case Kind::Array:
+				for (auto value : container.Values)
+				{
+					count.Add(base | value, votes);
+				}
+				break;
+
+			case Kind::Bitmap:
+				for (std::size_t w = 0; w < bitmapWords; w++)
+				{
+					if (container.Words[w] != 0)
+						count.AddWord(base | static_cast<std::uint32_t>(w * 64), container.Words[w], votes);
+				}
+				break;
+
+			case Kind::Run:
+				for (std::size_t r = 0; r < container.Values.size(); r += 2)
+				{
+					std::uint32_t start = base | container.Values[r];
+					count.AddRange(start, start + container.Values[r + 1] + 1, votes);
+				}
+				break;
+			}
+		}
+	}
+
+	// Number of containers of a kind
+	std::size_t NumContainers(Kind type) const
+	{
+		return static_cast<std::size_t>(std::count_if(std::begin(containers_), std::end(containers_),
+			[type](const Container& container) {return container.Type == type; }));
+	}
+
+	// Bytes used by the containers
+	std::size_t SizeInBytes() const
+	{
+		std::size_t bytes{ containers_.capacity() * sizeof(Container) };
+		for (const auto& container : containers_)
+		{
+			bytes += container.Values.capacity() * sizeof(std::uint16_t) + container.Words.capacity() * sizeof(std::uint64_t);
+		}
+		return bytes;
+	}
+};
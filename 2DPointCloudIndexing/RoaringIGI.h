@@ -0,0 +1,226 @@
+#pragma once
+#include "Cloud.h"
+#include "PerformanceReport.h"
+#include "UtilityFunctions.h"
+#include "VoteCounter.h"
+#include "ThreadPool.h"
+#include "RoaringBitmap.h"
+#include "QueryCells.h"
+#include <boost/geometry.hpp>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+// Roaring Inverted Grid Index for Point Clouds
+// Every cell keeps the set of IDs of its clouds (as SuccinctIGI) in a RoaringBitmap:
+// the container of every chunk of 2^16 IDs is chosen by density (array, bitmap or runs),
+// so hot cells with dense posting lists cost at most 8 KB per chunk and are voted in ranges
+// T: Point class(2D)
+
+template<typename T = boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>>
+class RoaringIGI
+{
+private:
+	std::unordered_map<unsigned, RoaringBitmap> roaringIGI;
+	std::unordered_map<unsigned, unsigned> sizeClouds;
+
+	// Streaming build - IDs of every cell until Finalize
+	std::unordered_map<unsigned, std::vector<std::uint32_t>> pendingCells_;
+	bool finalized_ = false;
+
+	const std::string name_;
+	const unsigned cmax_;
+	const unsigned delta_;
+	const GridQuantizer grid_;
+
+public:
+
+	// Empty index - Streaming build: Add clouds one at a time, then Finalize
+	RoaringIGI(std::string name, const unsigned cmax, const unsigned delta) :name_{ name }, cmax_{ cmax }, delta_{ delta }, grid_{ cmax, delta } {}
+
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	RoaringIGI(const Clouds& pointClouds, std::string name, const unsigned cmax, const unsigned delta) :RoaringIGI(name, cmax, delta)
+	{
+		AddRange(std::begin(pointClouds), std::end(pointClouds));
+		Finalize();
+	}
+
+	std::string GetName()
+	{
+		return name_;
+	}
+
+	// Add PointCloud to Index
+	// The cloud is searchable after Finalize
+	template<typename C>
+	RoaringIGI& Add(const C& pointCloud)
+	{
+		if (finalized_)
+			throw std::logic_error("RoaringIGI: Add on a finalized index");
+
+		// Get size of all PointCloud for calculate support
+		sizeClouds[pointCloud.ID] += static_cast<unsigned>(pointCloud.Points.size());
+
+		// Cell of every point
+		thread_local std::vector<unsigned> cells;
+		grid_.Cells(pointCloud.Points, cells);
+
+		for (auto cell : cells)
+		{
+			// Inverted Index - Consecutive points of a cloud often share the cell
+			auto& ids = pendingCells_[cell];
+			if (ids.empty() || ids.back() != pointCloud.ID)
+				ids.push_back(pointCloud.ID);
+		}
+
+		return *this;
+	}
+
+	// Add the clouds of [first, last) - e.g. a range of a CloudSet or a chunk read from a file
+	template<typename Iterator>
+	RoaringIGI& AddRange(Iterator first, Iterator last)
+	{
+		for (; first != last; ++first)
+		{
+			Add(*first);
+		}
+
+		return *this;
+	}
+
+	// End of a streaming build - Sort, deduplicate and store the IDs of every cell as a RoaringBitmap
+	RoaringIGI& Finalize()
+	{
+		if (finalized_)
+			return *this;
+
+		roaringIGI.reserve(pendingCells_.size());
+
+		for (auto& pair : pendingCells_)
+		{
+			auto& ids = pair.second;
+			std::sort(std::begin(ids), std::end(ids));
+			ids.erase(std::unique(std::begin(ids), std::end(ids)), std::end(ids));
+
+			roaringIGI[pair.first] = RoaringBitmap(ids);
+
+			std::vector<std::uint32_t>().swap(ids);
+		}
+
+		std::unordered_map<unsigned, std::vector<std::uint32_t>>().swap(pendingCells_);
+		finalized_ = true;
+
+		return *this;
+	}
+
+	// KNN Query
+	// First Parameter: queryCloud =  PointCloud
+	// Second Parameter: k = Nearest Neighbors
+	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k) const
+	{
+		auto& count = VoteCounter<>::Local();
+
+		// For every distinct cell of the PointCloud - Votes weighted by its number of points
+		for (const auto& queryCell : QueryCells(queryCloud.Points, grid_))
+		{
+			auto it = roaringIGI.find(queryCell.Cell);
+
+			// Vote all IDs of the cell container by container
+			if (it != std::end(roaringIGI))
+			{
+				it->second.Vote(count, queryCell.Count);
+			}
+		}
+
+		// Get k approximate nearest neighbors
+		return count.TopK(k);
+	}
+
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: numThreads = Worker threads
+	std::vector<std::vector<std::pair<unsigned, unsigned>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned numThreads = DefaultThreads()) const
+	{
+		std::vector<std::vector<std::pair<unsigned, unsigned>>> results(queryClouds.size());
+
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
+		{
+			results[i] = KNN(queryClouds[i], k);
+		}, numThreads);
+
+		return results;
+	}
+
+	// Number of containers of a kind over all cells
+	std::size_t NumContainers(RoaringBitmap::Kind type) const
+	{
+		std::size_t total{ 0 };
+		for (const auto& pair : roaringIGI)
+		{
+			total += pair.second.NumContainers(type);
+		}
+		return total;
+	}
+
+	// Bytes used by the posting lists (containers of every cell)
+	std::size_t SizeInBytes() const
+	{
+		std::size_t bytes{ 0 };
+		for (const auto& pair : roaringIGI)
+		{
+			bytes += sizeof(pair.first) + pair.second.SizeInBytes();
+		}
+		return bytes;
+	}
+
+	// Performance report on KNN Search
+	// Obtain Recall@
+	// Average query time, Standard deviation query time, max query time and min query time
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: recallAt = Vector for desired Recall@
+	template<typename D = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const std::vector<unsigned>& recallAt) const
+	{
+		PerformanceReport performance;
+		performance.QueriesTime.reserve(queryClouds.size());
+		performance.RecallAt.reserve(queryClouds.size());
+		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
+
+		// For every cloud in vector of PointClouds
+		for (const auto& cloud : queryClouds)
+		{
+			// Perform KNN search
+			allocations = AllocationCount();
+			start = std::chrono::high_resolution_clock::now();
+			auto result = KNN(cloud, k);
+			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
+
+			GetRecall(performance, result, recallAt, cloud.ID);
+
+			performance.QueriesTime.push_back(std::chrono::duration_cast<D>(end - start).count());
+		}
+		// Calculate Recall@
+		for (auto& pair : performance.RecallAt)
+		{
+			pair.second = pair.second / static_cast<double>(queryClouds.size());
+		}
+
+		TimePerformance(performance);
+		AllocationPerformance(performance);
+
+		return performance;
+	}
+
+};
@@ -2,6 +2,9 @@
 #include "Cloud.h"
 #include "PerformanceReport.h"
 #include "UtilityFunctions.h"
+#include "VoteCounter.h"
+#include "ThreadPool.h"
+#include "Scoring.h"
 #include <boost/geometry.hpp>
 #include <boost/geometry/index/rtree.hpp>
 #include <boost/geometry/index/parameters.hpp>
@@ -11,6 +14,7 @@
 #include <unordered_map>
 #include <numeric>
 #include <string>
+#include <stdexcept>
 
 // Miguel Ramirez Chacon
 // 17/05/17
@@ -30,6 +34,30 @@ private:
 	std::unordered_map<unsigned, unsigned> sizeClouds;
 	std::string name_ = "Rtree";
 
+	// Votes of the internalK nearest points of every query point, searched in the Rtree
+	// The points are split over numThreads threads
+	VoteCounter<>& Vote(const Cloud<T>& queryCloud, const unsigned internalK, const unsigned numThreads) const
+	{
+		const auto& points = queryCloud.Points;
+
+		return VoteCounter<>::Parallel(points.size(), numThreads, [&](std::size_t first, std::size_t last, VoteCounter<>& partial)
+		{
+			std::vector<PointIdx> results;
+
+			// K queries for every point in the PointCloud
+			for (auto i = first; i < last; i++)
+			{
+				results.clear();
+				rtree.query(boost::geometry::index::nearest(points[i], internalK), std::back_inserter(results));
+
+				// Count the frequencies for the Clouds ID
+				for (const auto& item : results)
+				{
+					partial.Add(item.second);
+				}
+			}
+		});
+	}
 
 public:
 	Rtree() {}
@@ -42,7 +70,9 @@ public:
 	}
 
 	// Build index from vector of Point Clouds
-	void Build(const std::vector<Cloud<T>>& pointClouds)
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	void Build(const Clouds& pointClouds)
 	{
 		std::vector<PointIdx> data;
 		int totalPoints = 0;
@@ -76,38 +106,30 @@ public:
 	// 1st Parameter: Query =  PointCloud
 	// 2nd Parameter: K = K Nearest Neighbors PointClouds
 	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
-	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k, const unsigned internalK) const
+	// 4th Parameter: numThreads = Threads sharing the points of the query (for very large query clouds)
+	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k, const unsigned internalK, const unsigned numThreads = 1) const
 	{
-		std::vector<PointIdx> results;
-		std::unordered_map<unsigned, unsigned> count;
-
-		// K queries for every point in the PointCloud
-		for (const auto& point : queryCloud.Points)
-		{
-			rtree.query(boost::geometry::index::nearest(point, internalK), std::back_inserter(results));
-		}
+		auto& count = Vote(queryCloud, internalK, numThreads);
 
-		// Count the frequencies for the Clouds ID
-		for (const auto& item : results)
-		{
-			count[item.second]++;
-		}
-
-		auto numberResults = 0;
-
-		if (count.size() > k)
-			numberResults = k;
-		else
-			numberResults = count.size();
+		// Get only the first K Point Clouds based in ID frequency.
+		return count.TopK(k);
+	}
 
+	// KNN Query ranked by a normalized score instead of raw votes (Scoring.h)
+	// 1st Parameter: Query =  PointCloud
+	// 2nd Parameter: K = K Nearest Neighbors PointClouds
+	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
+	// 4th Parameter: scoring = Votes, Support or Jaccard - TfIdf needs the cells of a grid index
+	// 5th Parameter: numThreads = Threads sharing the points of the query (for very large query clouds)
+	std::vector<std::pair<unsigned, double>> KNNScored(const Cloud<T>& queryCloud, const unsigned k, const unsigned internalK, Scoring scoring, const unsigned numThreads = 1) const
+	{
+		if (scoring == Scoring::TfIdf)
+			throw std::invalid_argument("Rtree: TfIdf scoring needs a grid index");
 
-		std::vector<std::pair<unsigned, unsigned>> resultsID(numberResults);
+		auto& count = Vote(queryCloud, internalK, numThreads);
 
-		// Get only the first K Point Clouds based in ID frequency.
-		std::partial_sort_copy(std::begin(count), std::end(count), std::begin(resultsID), std::end(resultsID),
-			[](const std::pair<unsigned, unsigned>& left, const std::pair<unsigned, unsigned>& right) {return left.second>right.second; });
-
-		return resultsID;
+		// Get the k clouds with best score
+		return count.TopK(k, CloudScore<>(sizeClouds, scoring, queryCloud.Points.size() * internalK));
 	}
 
 	// Intersection Query
@@ -117,7 +139,7 @@ public:
 	std::vector<std::pair<unsigned, float>> Intersection(const Cloud<T>& queryCloud, const float delta, const float epsilon) const
 	{
 		std::vector<PointIdx> results;
-		std::unordered_map<unsigned, unsigned> count;
+		auto& count = VoteCounter<>::Local();
 
 		// Intersection query for every point in the PointCloud
 		for (const auto& point : queryCloud.Points)
@@ -130,40 +152,53 @@ public:
 			Box query_box(T(cx - (delta / 2), cy - (delta / 2)), T(cx + (delta / 2), cy + (delta / 2)));
 
 			// Intersection query
+			results.clear();
 			rtree.query(boost::geometry::index::intersects(query_box), std::back_inserter(results));
-		}
 
-		// Count ID's frequencies
-		for (const auto& item : results)
-		{
-			count[item.second]++;
+			// Count ID's frequencies
+			for (const auto& item : results)
+			{
+				count.Add(item.second);
+			}
 		}
 
-		std::vector<std::pair<unsigned, float>> resultsPrelim(count.size());
+		std::vector<std::pair<unsigned, float>> resultsID;
+		resultsID.reserve(count.Size());
 
-		for (const auto& pair : count)
+		// Select only the PointCloud with support greater than epsilon - Only those are sorted
+		for (const auto id : count.Touched())
 		{
-			unsigned id = pair.first;
-			auto it = sizeClouds.find(pair.first);
-			resultsPrelim.push_back(std::make_pair(pair.first, static_cast<float>(pair.second) / it->second));
+			auto it = sizeClouds.find(id);
+			auto support = static_cast<float>(count.Get(id)) / it->second;
 
+			if (support > epsilon)
+			{
+				resultsID.push_back(std::make_pair(id, support));
+			}
 		}
 
-		std::sort(std::begin(resultsPrelim), std::end(resultsPrelim),
-			[](const std::pair<unsigned, unsigned>& left, const std::pair<unsigned, unsigned>& right) {return left.second>right.second; });
+		std::sort(std::begin(resultsID), std::end(resultsID),
+			[](const std::pair<unsigned, float>& left, const std::pair<unsigned, float>& right) {return left.second > right.second; });
 
-		std::vector<std::pair<unsigned, float>> resultsID;
-		resultsID.reserve(resultsPrelim.size());
+		return resultsID;
+	}
+
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
+	// 4th Parameter: numThreads = Worker threads
+	std::vector<std::vector<std::pair<unsigned, unsigned>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const unsigned numThreads = DefaultThreads()) const
+	{
+		std::vector<std::vector<std::pair<unsigned, unsigned>>> results(queryClouds.size());
 
-		// Select only the PointCloud with support greater than epsilon
-		for (const auto& r : resultsPrelim)
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
 		{
-			if (r.second > epsilon)
-			{
-				resultsID.push_back(r);
-			}
-		}
-		return resultsID;
+			results[i] = KNN(queryClouds[i], k, internalK);
+		}, numThreads);
+
+		return results;
 	}
 
 	// Performance report on KNN Search
@@ -173,22 +208,34 @@ public:
 	// 2nd Parameter: k = Nearest Neighbors
 	// 3rd Parameter: internalK = Internal k parameter for internalK-NN 
 	// 4th Parameter: recallAt = Vector for desired Recall@
-	template<typename D = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const std::vector<unsigned>& recallAt) const
+	// 5th Parameter: scoring = Ranking of the clouds, as in KNNScored (Votes: KNN)
+	template<typename D = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const std::vector<unsigned>& recallAt, Scoring scoring = Scoring::Votes) const
 	{
 		PerformanceReport performance;
 		performance.QueriesTime.reserve(queryClouds.size());
 		performance.RecallAt.reserve(queryClouds.size());
 		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
+		std::vector<std::pair<unsigned, unsigned>> result;
+		std::vector<std::pair<unsigned, double>> resultScored;
 
 		// For every cloud in vector of PointClouds
 		for (const auto& cloud : queryClouds)
 		{
 			// Perform KNN search
+			allocations = AllocationCount();
 			start = std::chrono::high_resolution_clock::now();
-			auto result = KNN(cloud, k, internalK);
+			if (scoring == Scoring::Votes)
+				result = KNN(cloud, k, internalK);
+			else
+				resultScored = KNNScored(cloud, k, internalK, scoring);
 			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
 
-			GetRecall(performance, result, recallAt, cloud.ID);
+			if (scoring == Scoring::Votes)
+				GetRecall(performance, result, recallAt, cloud.ID);
+			else
+				GetRecall(performance, resultScored, recallAt, cloud.ID);
 
 			performance.QueriesTime.push_back(std::chrono::duration_cast<D>(end - start).count());
 		}
@@ -199,6 +246,7 @@ public:
 		}
 
 		TimePerformance(performance);
+		AllocationPerformance(performance);
 
 		return performance;
 	}
@@ -0,0 +1,126 @@
+#pragma once
+#include "BitUtility.h"
+#include <iterator>
+#include <cstdint>
+#include <cstddef>
+#include <sdsl/bit_vectors.hpp>
+
+// Sequential decoding of the positions set in a Sarray (sdsl::sd_vector, Elias-Fano)
+// Position i = ((select of the i-th 1 in high) - i) << wl | low[i]
+// Instead of one select per position, the high bits are walked word by word:
+// every position costs a count of trailing zeros plus a read of its low bits
+
+// Input iterator over the positions set in a Sarray, in increasing order
+class SarrayIterator
+{
+private:
+	const std::uint64_t* high_ = nullptr;
+	const sdsl::int_vector<>* low_ = nullptr;
+	std::uint8_t wl_ = 0;
+
+	// Word of high being walked, its bits not consumed yet
+	std::size_t word_ = 0;
+	std::uint64_t bits_ = 0;
+
+	// Rank of the current position and its value
+	std::size_t index_ = 0;
+	std::size_t ones_ = 0;
+	std::uint64_t position_ = 0;
+
+	void Decode()
+	{
+		if (index_ >= ones_)
+			return;
+
+		while (bits_ == 0)
+		{
+			bits_ = high_[++word_];
+		}
+
+		auto highPosition = word_ * 64 + CountTrailingZeros(bits_);
+		bits_ &= bits_ - 1;
+
+		position_ = (static_cast<std::uint64_t>(highPosition - index_) << wl_) | (*low_)[index_];
+	}
+
+public:
+	using iterator_category = std::input_iterator_tag;
+	using value_type = std::uint64_t;
+	using difference_type = std::ptrdiff_t;
+	using pointer = const std::uint64_t*;
+	using reference = std::uint64_t;
+
+	// End iterator
+	SarrayIterator() {}
+
+	// Start at the first position
+	explicit SarrayIterator(const sdsl::sd_vector<>& sarray) :high_{ sarray.high.data() }, low_{ &sarray.low }, wl_{ sarray.wl }, index_{ 0 }, ones_{ static_cast<std::size_t>(sarray.low.size()) }
+	{
+		if (ones_ > 0)
+		{
+			bits_ = high_[0];
+			Decode();
+		}
+	}
+
+	std::uint64_t operator*() const
+	{
+		return position_;
+	}
+
+	SarrayIterator& operator++()
+	{
+		index_++;
+		Decode();
+		return *this;
+	}
+
+	SarrayIterator operator++(int)
+	{
+		auto it = *this;
+		++*this;
+		return it;
+	}
+
+	// Only comparisons against the end iterator are meaningful
+	bool operator==(const SarrayIterator& other) const
+	{
+		return Done() == other.Done();
+	}
+
+	bool operator!=(const SarrayIterator& other) const
+	{
+		return !(*this == other);
+	}
+
+	bool Done() const
+	{
+		return index_ >= ones_;
+	}
+};
+
+// Positions set in a Sarray as a range: for (auto position : SarrayPositions(sarray))
+class SarrayPositions
+{
+private:
+	const sdsl::sd_vector<>* sarray_;
+
+public:
+	explicit SarrayPositions(const sdsl::sd_vector<>& sarray) :sarray_{ &sarray } {}
+
+	SarrayIterator begin() const
+	{
+		return SarrayIterator(*sarray_);
+	}
+
+	SarrayIterator end() const
+	{
+		return SarrayIterator();
+	}
+
+	// Number of positions set
+	std::size_t size() const
+	{
+		return static_cast<std::size_t>(sarray_->low.size());
+	}
+};
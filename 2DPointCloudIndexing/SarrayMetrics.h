@@ -1,4 +1,5 @@
 #pragma once
+#include "SarrayDecoder.h"
 
 struct SelectRankData
 {
@@ -11,58 +12,39 @@ struct SelectRankData
 
 SelectRankData InnerProduct(const std::pair<sdsl::sd_vector<>, unsigned> &pointX, const std::pair<sdsl::sd_vector<>, unsigned> &pointY)
 {
-	// Allow Select
-	sdsl::sd_vector<>::select_1_type sarrayX_select(&pointX.first);
-	sdsl::sd_vector<>::select_1_type sarrayY_select(&pointY.first);
-
-	// Allow Rank to get the total of 1's bits in Sarray's	
-	sdsl::sd_vector<>::rank_1_type sarrayX_rank(&pointX.first);
-	sdsl::sd_vector<>::rank_1_type sarrayY_rank(&pointY.first);
+	// Positions of the 1's, decoded sequentially
+	SarrayPositions positionsX(pointX.first);
+	SarrayPositions positionsY(pointY.first);
 
 	// Total of 1's per Sarray
-	auto onesX = sarrayX_rank(pointX.first.size());
-	auto onesY = sarrayY_rank(pointY.first.size());
-
-	// Size of Sarray's
-	auto sizeX = pointX.first.size();
-	auto sizeY = pointY.first.size();
-
-	unsigned selectX{ 1 };
-	unsigned selectY{ 1 };
+	auto onesX = static_cast<unsigned>(positionsX.size());
+	auto onesY = static_cast<unsigned>(positionsY.size());
 
 	//Acumulador - Numero de 1's
 	unsigned innerProduct{ 0 };
 
-	// Select 1
-	auto indexX = sarrayX_select(selectX);
-	auto indexY = sarrayY_select(selectY);
+	auto itX = std::begin(positionsX);
+	auto itY = std::begin(positionsY);
+	auto end = std::end(positionsX);
 
 	// Clasic intersection algorithm
-	do
+	while (itX != end && itY != end)
 	{
-		if (indexX == indexY)
+		if (*itX == *itY)
 		{
 			innerProduct += 1;
-
-			selectX += 1;
-			selectY += 1;
-
-			indexX = sarrayX_select(selectX);
-			indexY = sarrayY_select(selectY);
+			++itX;
+			++itY;
 		}
-
-		else if (indexX > indexY)
+		else if (*itX > *itY)
 		{
-			selectY += 1;
-			indexY = sarrayY_select(selectY);
+			++itY;
 		}
 		else
 		{
-			selectX += 1;
-			indexX = sarrayX_select(selectX);
+			++itX;
 		}
-
-	} while ((indexX<sizeX) && (indexY<sizeY) && (selectX <= onesX) && (selectY <= onesY));
+	}
 
 	return SelectRankData(innerProduct, onesX, onesY);
 }
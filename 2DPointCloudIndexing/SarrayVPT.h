@@ -2,6 +2,8 @@
 #include <utility>
 #include <unordered_map>
 #include "UtilityFunctions.h"
+#include "GridQuantizer.h"
+#include "ThreadPool.h"
 #include <string>
 #include <chrono>
 #include <functional>
@@ -30,12 +32,15 @@ private:
 	std::string name_;
 	const unsigned cmax_;
 	const unsigned delta_;
+	const GridQuantizer grid_;
 
 public:
 
-	SarrayVPT(std::string name, unsigned cmax, unsigned delta) :name_{ name }, cmax_{ cmax }, delta_{ delta } {}
+	SarrayVPT(std::string name, unsigned cmax, unsigned delta) :name_{ name }, cmax_{ cmax }, delta_{ delta }, grid_{ cmax, delta } {}
 
-	void Build(const std::vector<Cloud<T>>& pointClouds)
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	void Build(const Clouds& pointClouds)
 	{
 		int totalPoints{ 0 };
 		std::vector<PointIdx> data;
@@ -59,20 +64,15 @@ public:
 		vpt.create(data);
 	}
 
-	sdsl::sd_vector<> GenerateSarray(const Cloud<T>& pointCloud) const
+	template<typename C>
+	sdsl::sd_vector<> GenerateSarray(const C& pointCloud) const
 	{
-		unsigned px, py, position;
+		std::vector<unsigned> cells;
 		std::set<unsigned> positions;
 
-		for (const auto& point : pointCloud.Points)
-		{
-			// Calculate cell of point
-			px = static_cast<unsigned>(std::floor(boost::geometry::get<0>(point) / delta_));
-			py = static_cast<unsigned>(std::floor(boost::geometry::get<1>(point) / delta_));
-			position = px + static_cast<unsigned>(cmax_ / delta_)*py;
-
-			positions.insert(position);
-		}
+		// Cell of every point
+		grid_.Cells(pointCloud.Points, cells);
+		positions.insert(std::begin(cells), std::end(cells));
 
 		// Generate bitmap
 		auto size_bitmap = (cmax_ / delta_)*(cmax_ / delta_);
@@ -114,20 +114,41 @@ public:
 		return neighbors;
 	}
 
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
+	// 4th Parameter: numThreads = Worker threads
+	std::vector<std::vector<std::pair<unsigned, double>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const unsigned numThreads = DefaultThreads()) const
+	{
+		std::vector<std::vector<std::pair<unsigned, double>>> results(queryClouds.size());
+
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
+		{
+			results[i] = KNN(queryClouds[i], k, internalK);
+		}, numThreads);
+
+		return results;
+	}
+
 	template<typename Duration = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const std::vector<unsigned>& recallAt) const
 	{
 		PerformanceReport performance;
 		performance.QueriesTime.reserve(queryClouds.size());
 		performance.RecallAt.reserve(queryClouds.size());
 		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
 
 		// For every cloud in vector of PointClouds
 		for (const auto& cloud : queryClouds)
 		{
 			// Perform KNN search
+			allocations = AllocationCount();
 			start = std::chrono::high_resolution_clock::now();
 			auto result = KNN(cloud, k, internalK);
 			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
 
 			GetRecall(performance, result, recallAt, cloud.ID);
 
@@ -140,6 +161,7 @@ public:
 		}
 
 		TimePerformance(performance);
+		AllocationPerformance(performance);
 
 		return performance;
 	}
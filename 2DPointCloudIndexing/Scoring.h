@@ -0,0 +1,74 @@
+#pragma once
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+// Ranking of the clouds voted by a KNN query
+// Raw votes favour large clouds: a cloud with many points collects votes from any query.
+// The normalized scores divide by the size of the cloud (sizeClouds of every index) inside the top-k selection
+// Votes: Raw number of votes (KNN)
+// Support: votes / points of the cloud
+// Jaccard: intersection / (points of the query + points of the cloud - intersection)
+// (grid indexes count the points shared in every cell, min(query points, cloud points); point KNN indexes
+// use their votes, at most the votes the query can cast)
+// TfIdf: Votes of every cell weighted by log(1 + clouds / clouds in the cell), divided by the points of the cloud
+// (grid indexes only - cells shared by many clouds say little about the query)
+enum class Scoring { Votes, Support, Jaccard, TfIdf };
+
+// Weight of the votes of a cell with TfIdf scoring
+// 1st Parameter: numClouds = Clouds in the index
+// 2nd Parameter: cellClouds = Clouds with points in the cell
+inline double InverseCloudFrequency(std::size_t numClouds, std::size_t cellClouds)
+{
+	return std::log(1.0 + static_cast<double>(numClouds) / static_cast<double>(std::max<std::size_t>(cellClouds, 1)));
+}
+
+// Score of a cloud
+// 1st Parameter: scoring = Normalization
+// 2nd Parameter: votes = Votes of the cloud (already weighted by cell for TfIdf, intersection size for Jaccard)
+// 3rd Parameter: cloudSize = Points of the cloud
+// 4th Parameter: querySize = Votes the query can cast (points of the query, times internalK for point KNN indexes)
+inline double Score(Scoring scoring, double votes, unsigned cloudSize, std::size_t querySize)
+{
+	switch (scoring)
+	{
+	case Scoring::Support:
+	case Scoring::TfIdf:
+		return cloudSize == 0 ? 0.0 : votes / cloudSize;
+
+	case Scoring::Jaccard:
+	{
+		// votes: size of the intersection, at most the size of the query or of the cloud
+		auto total = static_cast<double>(querySize) + cloudSize;
+		return total - votes <= 0.0 ? 0.0 : votes / (total - votes);
+	}
+
+	default:
+		return votes;
+	}
+}
+
+// Scoring function for VoteCounter::TopK - Sizes looked up in the sizeClouds map of an index
+// Ids missing from the map score as clouds of size 0
+template<typename Id = unsigned>
+class CloudScore
+{
+private:
+	const std::unordered_map<unsigned, unsigned>& sizeClouds_;
+	Scoring scoring_;
+	std::size_t querySize_;
+
+public:
+	CloudScore(const std::unordered_map<unsigned, unsigned>& sizeClouds, Scoring scoring, std::size_t querySize)
+		:sizeClouds_(sizeClouds), scoring_{ scoring }, querySize_{ querySize } {}
+
+	double operator()(Id id, double votes) const
+	{
+		if (scoring_ == Scoring::Votes)
+			return votes;
+
+		auto it = sizeClouds_.find(static_cast<unsigned>(id));
+		return Score(scoring_, votes, it == std::end(sizeClouds_) ? 0 : it->second, querySize_);
+	}
+};
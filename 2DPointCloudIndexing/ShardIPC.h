@@ -0,0 +1,554 @@
+#pragma once
+#include "Cloud.h"
+#include "PostingLists.h"
+#include "ShardedIGI.h"
+#include <boost/geometry.hpp>
+#include <vector>
+#include <utility>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+// Shards of a ShardedIGI behind a local IPC boundary
+// A ShardServer answers the requests of one connection with a LocalShard, a SocketShard is the client side:
+// it has the interface of LocalShard, so ShardedIGI<T, SocketShard<T>> runs the same scatter-gather over shards
+// living in other processes of the machine
+// Messages on a stream socket: type (uint32), payload size (uint64), payload - Host byte order,
+// both ends run on the same machine. Clouds are sent as ID, number of points and (x, y) floats
+// Local sockets (AF_UNIX) need a POSIX system
+
+enum class ShardMessage : std::uint32_t { AddRange = 1, Remove, Replace, Publish, Compact, KNN, KNNBatch, SizeInBytes, Result, Error };
+
+// Payload of a message - Written and read in the same order
+class MessageBuffer
+{
+private:
+	std::vector<char> bytes_;
+	std::size_t read_ = 0;
+
+public:
+	std::vector<char>& Bytes()
+	{
+		return bytes_;
+	}
+
+	const std::vector<char>& Bytes() const
+	{
+		return bytes_;
+	}
+
+	void Clear()
+	{
+		bytes_.clear();
+		read_ = 0;
+	}
+
+	// Plain values (integers, floats)
+	template<typename V>
+	void Put(V value)
+	{
+		auto size = bytes_.size();
+		bytes_.resize(size + sizeof(V));
+		std::memcpy(bytes_.data() + size, &value, sizeof(V));
+	}
+
+	template<typename V>
+	V Get()
+	{
+		if (read_ + sizeof(V) > bytes_.size())
+			throw std::runtime_error("ShardIPC: truncated message");
+
+		V value;
+		std::memcpy(&value, bytes_.data() + read_, sizeof(V));
+		read_ += sizeof(V);
+		return value;
+	}
+
+	// Voting of a query - Values that are not a Voting are rejected
+	Voting GetVoting()
+	{
+		auto voting = Get<std::uint8_t>();
+		if (voting != static_cast<std::uint8_t>(Voting::Points) && voting != static_cast<std::uint8_t>(Voting::Set))
+			throw std::runtime_error("ShardIPC: unknown voting " + std::to_string(voting));
+
+		return static_cast<Voting>(voting);
+	}
+
+	template<typename T>
+	void PutCloud(const Cloud<T>& cloud)
+	{
+		Put<std::uint32_t>(cloud.ID);
+		Put<std::uint64_t>(cloud.Points.size());
+		for (const auto& point : cloud.Points)
+		{
+			Put<float>(static_cast<float>(boost::geometry::get<0>(point)));
+			Put<float>(static_cast<float>(boost::geometry::get<1>(point)));
+		}
+	}
+
+	template<typename T>
+	Cloud<T> GetCloud()
+	{
+		Cloud<T> cloud(Get<std::uint32_t>());
+		auto numPoints = Get<std::uint64_t>();
+		if (numPoints > (bytes_.size() - read_) / (2 * sizeof(float)))
+			throw std::runtime_error("ShardIPC: truncated message");
+
+		cloud.Points.reserve(static_cast<std::size_t>(numPoints));
+		for (std::uint64_t i = 0; i < numPoints; i++)
+		{
+			auto x = Get<float>();
+			auto y = Get<float>();
+			cloud.Points.emplace_back(x, y);
+		}
+		return cloud;
+	}
+
+	void PutResult(const std::vector<std::pair<unsigned, unsigned>>& result)
+	{
+		Put<std::uint64_t>(result.size());
+		for (const auto& pair : result)
+		{
+			Put<std::uint32_t>(pair.first);
+			Put<std::uint32_t>(pair.second);
+		}
+	}
+
+	std::vector<std::pair<unsigned, unsigned>> GetResult()
+	{
+		auto size = Get<std::uint64_t>();
+		if (size > (bytes_.size() - read_) / (2 * sizeof(std::uint32_t)))
+			throw std::runtime_error("ShardIPC: truncated message");
+
+		std::vector<std::pair<unsigned, unsigned>> result;
+		result.reserve(static_cast<std::size_t>(size));
+		for (std::uint64_t i = 0; i < size; i++)
+		{
+			auto id = Get<std::uint32_t>();
+			result.emplace_back(id, Get<std::uint32_t>());
+		}
+		return result;
+	}
+};
+
+#ifndef _WIN32
+
+// Connected stream socket - Owns the descriptor
+class ShardChannel
+{
+private:
+	int fd_;
+
+	void WriteAll(const char* data, std::size_t size)
+	{
+#ifdef MSG_NOSIGNAL
+		const int flags = MSG_NOSIGNAL;
+#else
+		const int flags = 0;
+#endif
+		while (size > 0)
+		{
+			auto sent = ::send(fd_, data, size, flags);
+			if (sent < 0 && errno == EINTR)
+				continue;
+			if (sent <= 0)
+				throw std::runtime_error("ShardIPC: send failed");
+
+			data += sent;
+			size -= static_cast<std::size_t>(sent);
+		}
+	}
+
+	// Returns false if the peer closed the connection before the first byte
+	bool ReadAll(char* data, std::size_t size)
+	{
+		std::size_t done{ 0 };
+		while (done < size)
+		{
+			auto received = ::recv(fd_, data + done, size - done, 0);
+			if (received < 0 && errno == EINTR)
+				continue;
+			if (received == 0 && done == 0)
+				return false;
+			if (received <= 0)
+				throw std::runtime_error("ShardIPC: connection lost");
+
+			done += static_cast<std::size_t>(received);
+		}
+		return true;
+	}
+
+public:
+	explicit ShardChannel(int fd) :fd_{ fd } {}
+
+	~ShardChannel()
+	{
+		if (fd_ >= 0)
+			::close(fd_);
+	}
+
+	ShardChannel(const ShardChannel&) = delete;
+	ShardChannel& operator=(const ShardChannel&) = delete;
+
+	void Send(ShardMessage type, const MessageBuffer& payload)
+	{
+		char header[sizeof(std::uint32_t) + sizeof(std::uint64_t)];
+		auto code = static_cast<std::uint32_t>(type);
+		std::uint64_t size = payload.Bytes().size();
+		std::memcpy(header, &code, sizeof(code));
+		std::memcpy(header + sizeof(code), &size, sizeof(size));
+
+		WriteAll(header, sizeof(header));
+		WriteAll(payload.Bytes().data(), payload.Bytes().size());
+	}
+
+	// Returns false if the peer closed the connection
+	bool Receive(ShardMessage& type, MessageBuffer& payload)
+	{
+		char header[sizeof(std::uint32_t) + sizeof(std::uint64_t)];
+		if (!ReadAll(header, sizeof(header)))
+			return false;
+
+		std::uint32_t code;
+		std::uint64_t size;
+		std::memcpy(&code, header, sizeof(code));
+		std::memcpy(&size, header + sizeof(code), sizeof(size));
+		type = static_cast<ShardMessage>(code);
+
+		payload.Clear();
+		payload.Bytes().resize(static_cast<std::size_t>(size));
+		if (size > 0 && !ReadAll(payload.Bytes().data(), payload.Bytes().size()))
+			throw std::runtime_error("ShardIPC: connection lost");
+
+		return true;
+	}
+};
+
+inline sockaddr_un LocalAddress(const std::string& path)
+{
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof(address.sun_path))
+		throw std::invalid_argument("ShardIPC: socket path too long: " + path);
+
+	std::memcpy(address.sun_path, path.c_str(), path.size());
+	return address;
+}
+
+// Listening local socket at path (an old socket file is replaced)
+inline int ListenLocal(const std::string& path, int backlog = 16)
+{
+	auto address = LocalAddress(path);
+	::unlink(path.c_str());
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		throw std::runtime_error("ShardIPC: can't create socket");
+
+	if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, backlog) != 0)
+	{
+		::close(fd);
+		throw std::runtime_error("ShardIPC: can't listen on " + path);
+	}
+
+	return fd;
+}
+
+inline int ConnectLocal(const std::string& path)
+{
+	auto address = LocalAddress(path);
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		throw std::runtime_error("ShardIPC: can't create socket");
+
+	if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		::close(fd);
+		throw std::runtime_error("ShardIPC: can't connect to " + path);
+	}
+
+	return fd;
+}
+
+// Server side of a shard
+template<typename T = boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>>
+class ShardServer
+{
+public:
+	// Answer the requests of a connection until the client closes it - Takes ownership of fd
+	// Exceptions of a request are sent back as Error messages
+	static void Serve(LocalShard<T>& shard, int fd)
+	{
+		ShardChannel channel(fd);
+		MessageBuffer request;
+		MessageBuffer response;
+		ShardMessage type;
+
+		while (channel.Receive(type, request))
+		{
+			response.Clear();
+
+			try
+			{
+				switch (type)
+				{
+				case ShardMessage::AddRange:
+				{
+					std::vector<Cloud<T>> clouds(static_cast<std::size_t>(request.Get<std::uint64_t>()), Cloud<T>(0));
+					for (auto& cloud : clouds)
+					{
+						cloud = request.GetCloud<T>();
+					}
+					shard.AddRange(std::move(clouds)).get();
+					break;
+				}
+				case ShardMessage::Remove:
+					response.Put<std::uint8_t>(shard.Remove(request.Get<std::uint32_t>()).get());
+					break;
+
+				case ShardMessage::Replace:
+					response.Put<std::uint8_t>(shard.Replace(request.GetCloud<T>()).get());
+					break;
+
+				case ShardMessage::Publish:
+					shard.Publish().get();
+					break;
+
+				case ShardMessage::Compact:
+					shard.Compact(request.Get<std::uint8_t>() != 0).get();
+					break;
+
+				case ShardMessage::KNN:
+				{
+					auto k = request.Get<std::uint32_t>();
+					auto voting = request.GetVoting();
+					auto radius = request.Get<std::uint32_t>();
+					auto query = request.GetCloud<T>();
+					response.PutResult(shard.KNN(query, k, voting, radius).get());
+					break;
+				}
+				case ShardMessage::KNNBatch:
+				{
+					auto k = request.Get<std::uint32_t>();
+					auto voting = request.GetVoting();
+					auto radius = request.Get<std::uint32_t>();
+					std::vector<Cloud<T>> queries(static_cast<std::size_t>(request.Get<std::uint64_t>()), Cloud<T>(0));
+					for (auto& query : queries)
+					{
+						query = request.GetCloud<T>();
+					}
+
+					auto results = shard.KNNBatch(queries, k, voting, radius).get();
+					response.Put<std::uint64_t>(results.size());
+					for (const auto& result : results)
+					{
+						response.PutResult(result);
+					}
+					break;
+				}
+				case ShardMessage::SizeInBytes:
+					response.Put<std::uint64_t>(shard.SizeInBytes().get());
+					break;
+
+				default:
+					throw std::runtime_error("ShardIPC: unknown request");
+				}
+			}
+			catch (const std::exception& e)
+			{
+				response.Clear();
+				response.Bytes().assign(e.what(), e.what() + std::strlen(e.what()));
+				channel.Send(ShardMessage::Error, response);
+				continue;
+			}
+
+			channel.Send(ShardMessage::Result, response);
+		}
+	}
+
+	// Accept connections on a local socket and serve each on its own thread
+	// Returns once the clients of numConnections connections have closed them
+	static void Listen(LocalShard<T>& shard, const std::string& path, unsigned numConnections = 1)
+	{
+		int listener = ListenLocal(path);
+		std::vector<std::thread> connections;
+
+		for (unsigned i = 0; i < numConnections; i++)
+		{
+			int fd = ::accept(listener, nullptr, nullptr);
+			if (fd < 0)
+			{
+				if (errno == EINTR)
+				{
+					i--;
+					continue;
+				}
+				break;
+			}
+
+			connections.emplace_back([&shard, fd] { Serve(shard, fd); });
+		}
+
+		::close(listener);
+		::unlink(path.c_str());
+
+		for (auto& connection : connections)
+		{
+			connection.join();
+		}
+	}
+};
+
+// Client side of a shard served by a ShardServer - Same interface as LocalShard
+// Requests of a connection are sent one at a time, every call runs on its own thread so the requests
+// to different shards overlap
+template<typename T = boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>>
+class SocketShard
+{
+private:
+	using Result = std::vector<std::pair<unsigned, unsigned>>;
+
+	ShardChannel channel_;
+	std::mutex mutex_;
+
+	// Send a request and wait for its response - Error responses are thrown
+	MessageBuffer Call(ShardMessage type, const MessageBuffer& request)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		channel_.Send(type, request);
+
+		MessageBuffer response;
+		ShardMessage responseType;
+		if (!channel_.Receive(responseType, response))
+			throw std::runtime_error("ShardIPC: server closed the connection");
+
+		if (responseType == ShardMessage::Error)
+			throw std::runtime_error(std::string(response.Bytes().begin(), response.Bytes().end()));
+		if (responseType != ShardMessage::Result)
+			throw std::runtime_error("ShardIPC: unexpected response");
+
+		return response;
+	}
+
+	static MessageBuffer QueryHeader(unsigned k, Voting voting, unsigned radius)
+	{
+		MessageBuffer request;
+		request.Put<std::uint32_t>(k);
+		request.Put<std::uint8_t>(static_cast<std::uint8_t>(voting));
+		request.Put<std::uint32_t>(radius);
+		return request;
+	}
+
+public:
+	// Connected socket - Takes ownership of fd
+	explicit SocketShard(int fd) :channel_(fd) {}
+
+	// Connect to a ShardServer listening at path
+	explicit SocketShard(const std::string& path) :channel_(ConnectLocal(path)) {}
+
+	std::future<void> AddRange(std::vector<Cloud<T>> clouds)
+	{
+		auto request = std::make_shared<MessageBuffer>();
+		request->Put<std::uint64_t>(clouds.size());
+		for (const auto& cloud : clouds)
+		{
+			request->PutCloud(cloud);
+		}
+
+		return std::async(std::launch::async, [this, request] { Call(ShardMessage::AddRange, *request); });
+	}
+
+	std::future<bool> Remove(unsigned id)
+	{
+		return std::async(std::launch::async, [this, id]
+		{
+			MessageBuffer request;
+			request.Put<std::uint32_t>(id);
+			return Call(ShardMessage::Remove, request).template Get<std::uint8_t>() != 0;
+		});
+	}
+
+	std::future<bool> Replace(Cloud<T> cloud)
+	{
+		auto request = std::make_shared<MessageBuffer>();
+		request->PutCloud(cloud);
+
+		return std::async(std::launch::async, [this, request] { return Call(ShardMessage::Replace, *request).template Get<std::uint8_t>() != 0; });
+	}
+
+	std::future<void> Publish()
+	{
+		return std::async(std::launch::async, [this] { Call(ShardMessage::Publish, MessageBuffer()); });
+	}
+
+	std::future<void> Compact(bool weighted = false)
+	{
+		return std::async(std::launch::async, [this, weighted]
+		{
+			MessageBuffer request;
+			request.Put<std::uint8_t>(weighted);
+			Call(ShardMessage::Compact, request);
+		});
+	}
+
+	// queryCloud must outlive the future
+	std::future<Result> KNN(const Cloud<T>& queryCloud, unsigned k, Voting voting = Voting::Points, unsigned radius = 0)
+	{
+		return std::async(std::launch::async, [this, &queryCloud, k, voting, radius]
+		{
+			auto request = QueryHeader(k, voting, radius);
+			request.PutCloud(queryCloud);
+			return Call(ShardMessage::KNN, request).GetResult();
+		});
+	}
+
+	// The whole batch in one request - queryClouds must outlive the future
+	std::future<std::vector<Result>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, unsigned k, Voting voting = Voting::Points, unsigned radius = 0)
+	{
+		return std::async(std::launch::async, [this, &queryClouds, k, voting, radius]
+		{
+			auto request = QueryHeader(k, voting, radius);
+			request.Put<std::uint64_t>(queryClouds.size());
+			for (const auto& query : queryClouds)
+			{
+				request.PutCloud(query);
+			}
+
+			auto response = Call(ShardMessage::KNNBatch, request);
+			std::vector<Result> results(static_cast<std::size_t>(response.template Get<std::uint64_t>()));
+			for (auto& result : results)
+			{
+				result = response.GetResult();
+			}
+			return results;
+		});
+	}
+
+	std::future<std::size_t> SizeInBytes()
+	{
+		return std::async(std::launch::async, [this]
+		{
+			return static_cast<std::size_t>(Call(ShardMessage::SizeInBytes, MessageBuffer()).template Get<std::uint64_t>());
+		});
+	}
+};
+
+#endif
@@ -0,0 +1,451 @@
+#pragma once
+#include "Cloud.h"
+#include "PerformanceReport.h"
+#include "UtilityFunctions.h"
+#include "TopKSelector.h"
+#include "IGI.h"
+#include "Numa.h"
+#include <boost/geometry.hpp>
+#include <vector>
+#include <utility>
+#include <chrono>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+// Sharded Inverted Grid Index for Point Clouds
+// Clouds are partitioned by a hash of their ID into N IGI shards: every cloud lives in a single shard,
+// so a query runs on all shards in parallel (scatter) and the partial top-k lists are merged (gather)
+// with the ranking of VoteCounter::TopK - The result is the one of a single IGI holding every cloud
+// Shard: Backend of every shard, same interface in both cases
+// - LocalShard: IGI in this process, built and queried by worker threads pinned to one NUMA node
+// - SocketShard (ShardIPC.h): IGI served by another process (ShardServer) through a local socket
+// T: Point class(2D)
+
+// Shard of a ShardedIGI held in this process
+// Every change and query of the IGI runs on the workers of a NodeExecutor, so the buffers, segments and
+// compacted posting lists are first touched (allocated) on the node of the shard. Background compactions
+// run on a thread pinned to the same node
+template<typename T = boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>>
+class LocalShard
+{
+private:
+	using Result = std::vector<std::pair<unsigned, unsigned>>;
+
+	// Destroyed in reverse order: the workers run the pending tasks and join, the std::async future
+	// waits for the compaction, then the IGI goes
+	IGI<T> index_;
+	std::mutex compactionMutex_;
+	std::future<void> compaction_;
+	NodeExecutor executor_;
+
+	// Caller runs on a worker
+	void CompactIfNeeded()
+	{
+		if (!index_.NeedsCompaction())
+			return;
+
+		std::lock_guard<std::mutex> lock(compactionMutex_);
+
+		if (compaction_.valid() && compaction_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+
+		auto node = executor_.Node();
+		compaction_ = std::async(std::launch::async, [this, node]
+		{
+			NumaTopology::Get().PinThread(node);
+			index_.Compact();
+		});
+	}
+
+public:
+	// node: NUMA node of the shard (modulo the number of nodes)
+	// numThreads: Workers of the shard - More than one lets queries of a batch run in parallel
+	LocalShard(std::string name, const unsigned cmax, const unsigned delta, const unsigned node, const unsigned numThreads = 1)
+		:index_(name, cmax, delta), executor_(node, numThreads)
+	{
+		index_.SetAutoCompaction(false);
+	}
+
+	unsigned Node() const
+	{
+		return executor_.Node();
+	}
+
+	// Buffer clouds in the IGI of the shard - Searchable after Publish
+	std::future<void> AddRange(std::vector<Cloud<T>> clouds)
+	{
+		auto shared = std::make_shared<std::vector<Cloud<T>>>(std::move(clouds));
+		return executor_.Submit([this, shared] { index_.AddRange(std::begin(*shared), std::end(*shared)); });
+	}
+
+	std::future<bool> Remove(unsigned id)
+	{
+		return executor_.Submit([this, id] { return index_.Remove(id); });
+	}
+
+	std::future<bool> Replace(Cloud<T> cloud)
+	{
+		auto shared = std::make_shared<Cloud<T>>(std::move(cloud));
+		return executor_.Submit([this, shared] { return index_.Replace(*shared); });
+	}
+
+	std::future<void> Publish()
+	{
+		return executor_.Submit([this]
+		{
+			index_.Publish();
+			CompactIfNeeded();
+		});
+	}
+
+	std::future<void> Compact(bool weighted = false)
+	{
+		return executor_.Submit([this, weighted] { index_.Compact(weighted); });
+	}
+
+	// queryCloud must outlive the future
+	std::future<Result> KNN(const Cloud<T>& queryCloud, unsigned k, Voting voting = Voting::Points, unsigned radius = 0)
+	{
+		return executor_.Submit([this, &queryCloud, k, voting, radius] { return index_.KNN(queryCloud, k, voting, radius); });
+	}
+
+	// Queries split between the workers of the shard - queryClouds must outlive the future
+	std::future<std::vector<Result>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, unsigned k, Voting voting = Voting::Points, unsigned radius = 0)
+	{
+		auto results = std::make_shared<std::vector<Result>>(queryClouds.size());
+		auto numTasks = std::min<std::size_t>(executor_.NumThreads(), queryClouds.size());
+
+		std::vector<std::future<void>> tasks;
+		for (std::size_t t = 0; t < numTasks; t++)
+		{
+			tasks.push_back(executor_.Submit([this, &queryClouds, results, t, numTasks, k, voting, radius]
+			{
+				for (auto i = t; i < queryClouds.size(); i += numTasks)
+				{
+					(*results)[i] = index_.KNN(queryClouds[i], k, voting, radius);
+				}
+			}));
+		}
+
+		// Every task references queryClouds: wait for all of them before an exception leaves
+		return std::async(std::launch::deferred, [results](std::vector<std::future<void>> pending)
+		{
+			for (auto& task : pending)
+			{
+				task.wait();
+			}
+			for (auto& task : pending)
+			{
+				task.get();
+			}
+			return std::move(*results);
+		}, std::move(tasks));
+	}
+
+	std::future<std::size_t> SizeInBytes()
+	{
+		return executor_.Submit([this] { return index_.SizeInBytes(); });
+	}
+
+	IGI<T>& Index()
+	{
+		return index_;
+	}
+};
+
+template<typename T = boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>, typename Shard = LocalShard<T>>
+class ShardedIGI
+{
+private:
+	using Result = std::vector<std::pair<unsigned, unsigned>>;
+
+	std::vector<std::unique_ptr<Shard>> shards_;
+	const std::string name_;
+
+	// Gather - Merge the top-k lists of every shard (disjoint IDs) with the ranking of a single index
+	static Result Merge(std::vector<Result>& partials, unsigned k)
+	{
+		thread_local TopKSelector<unsigned, unsigned> selector;
+		selector.Reset(k);
+
+		for (const auto& partial : partials)
+		{
+			for (const auto& pair : partial)
+			{
+				selector.Push(pair.first, pair.second);
+			}
+		}
+
+		return selector.Results();
+	}
+
+	// Wait for every future before the first get - The tasks of the other shards may reference the
+	// caller's clouds, an exception must not leave while they run
+	template<typename Future>
+	static void WaitAll(std::vector<Future>& futures)
+	{
+		for (auto& future : futures)
+		{
+			future.wait();
+		}
+		for (auto& future : futures)
+		{
+			future.get();
+		}
+	}
+
+	// Values of every future, as WaitAll
+	template<typename R>
+	static std::vector<R> GetAll(std::vector<std::future<R>>& futures)
+	{
+		for (auto& future : futures)
+		{
+			future.wait();
+		}
+
+		std::vector<R> values;
+		values.reserve(futures.size());
+		for (auto& future : futures)
+		{
+			values.push_back(future.get());
+		}
+		return values;
+	}
+
+public:
+
+	// Shards in this process - Shard i is placed on NUMA node i modulo the number of nodes
+	// numShards: Number of IGIs
+	// threadsPerShard: Workers of every shard
+	ShardedIGI(std::string name, const unsigned cmax, const unsigned delta, const unsigned numShards, const unsigned threadsPerShard = 1) :name_{ name }
+	{
+		if (numShards == 0)
+			throw std::invalid_argument("ShardedIGI: at least one shard");
+
+		for (unsigned i = 0; i < numShards; i++)
+		{
+			shards_.emplace_back(new Shard(name + "/" + std::to_string(i), cmax, delta, i % NumaTopology::Get().NumNodes(), threadsPerShard));
+		}
+	}
+
+	// Build index from vector of Point Clouds - Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	ShardedIGI(const Clouds& pointClouds, std::string name, const unsigned cmax, const unsigned delta, const unsigned numShards, const unsigned threadsPerShard = 1)
+		:ShardedIGI(name, cmax, delta, numShards, threadsPerShard)
+	{
+		AddRange(std::begin(pointClouds), std::end(pointClouds));
+		Publish();
+	}
+
+	// Shards built elsewhere - e.g. SocketShards connected to ShardServers of other processes
+	// Clouds must have been partitioned with ShardOf
+	ShardedIGI(std::string name, std::vector<std::unique_ptr<Shard>> shards) :shards_(std::move(shards)), name_{ name }
+	{
+		if (shards_.empty())
+			throw std::invalid_argument("ShardedIGI: at least one shard");
+	}
+
+	std::string GetName()
+	{
+		return name_;
+	}
+
+	unsigned NumShards() const
+	{
+		return static_cast<unsigned>(shards_.size());
+	}
+
+	// Shard of a cloud - Multiplicative hash, so runs of consecutive IDs spread over every shard
+	unsigned ShardOf(unsigned id) const
+	{
+		return static_cast<unsigned>((static_cast<std::uint64_t>(id * 2654435761u) * shards_.size()) >> 32);
+	}
+
+	Shard& GetShard(unsigned shard)
+	{
+		return *shards_[shard];
+	}
+
+	// Add PointClouds - Every shard receives its clouds in one batch, searchable after Publish
+	template<typename Iterator>
+	ShardedIGI& AddRange(Iterator first, Iterator last)
+	{
+		std::vector<std::vector<Cloud<T>>> batches(shards_.size());
+		for (; first != last; ++first)
+		{
+			Cloud<T> cloud(first->ID);
+			cloud.Points.assign(std::begin(first->Points), std::end(first->Points));
+			batches[ShardOf(cloud.ID)].push_back(std::move(cloud));
+		}
+
+		std::vector<std::future<void>> futures;
+		for (std::size_t s = 0; s < shards_.size(); s++)
+		{
+			if (!batches[s].empty())
+				futures.push_back(shards_[s]->AddRange(std::move(batches[s])));
+		}
+		WaitAll(futures);
+
+		return *this;
+	}
+
+	template<typename C>
+	ShardedIGI& Add(const C& pointCloud)
+	{
+		return AddRange(&pointCloud, &pointCloud + 1);
+	}
+
+	bool Remove(unsigned id)
+	{
+		return shards_[ShardOf(id)]->Remove(id).get();
+	}
+
+	bool Replace(const Cloud<T>& pointCloud)
+	{
+		return shards_[ShardOf(pointCloud.ID)]->Replace(pointCloud).get();
+	}
+
+	// Publish the buffered changes of every shard - Shards publish independently of each other
+	ShardedIGI& Publish()
+	{
+		std::vector<std::future<void>> futures;
+		for (auto& shard : shards_)
+		{
+			futures.push_back(shard->Publish());
+		}
+		WaitAll(futures);
+
+		return *this;
+	}
+
+	// Compact every shard in parallel
+	ShardedIGI& Compact(bool weighted = false)
+	{
+		std::vector<std::future<void>> futures;
+		for (auto& shard : shards_)
+		{
+			futures.push_back(shard->Compact(weighted));
+		}
+		WaitAll(futures);
+
+		return *this;
+	}
+
+	// End of a streaming build - Same as Compact
+	ShardedIGI& Finalize(bool weighted = false)
+	{
+		return Compact(weighted);
+	}
+
+	// KNN Query - Scatter to every shard, gather the partial top-k
+	// First Parameter: queryCloud =  PointCloud
+	// Second Parameter: k = Nearest Neighbors
+	// Third Parameter: voting = One vote per indexed point (Points) or per cloud (Set) in every cell
+	// Fourth Parameter: radius = Neighbor cells voted, as in IGI::KNN
+	Result KNN(const Cloud<T>& queryCloud, unsigned k, Voting voting = Voting::Points, unsigned radius = 0)
+	{
+		std::vector<std::future<Result>> futures;
+		for (auto& shard : shards_)
+		{
+			futures.push_back(shard->KNN(queryCloud, k, voting, radius));
+		}
+
+		auto partials = GetAll(futures);
+
+		return Merge(partials, k);
+	}
+
+	// Batch KNN Query - The whole batch is sent to every shard at once
+	// Results are returned in the same order as queryClouds
+	std::vector<Result> KNNBatch(const std::vector<Cloud<T>>& queryClouds, unsigned k, Voting voting = Voting::Points, unsigned radius = 0)
+	{
+		std::vector<std::future<std::vector<Result>>> futures;
+		for (auto& shard : shards_)
+		{
+			futures.push_back(shard->KNNBatch(queryClouds, k, voting, radius));
+		}
+
+		auto partials = GetAll(futures);
+
+		std::vector<Result> results(queryClouds.size());
+		std::vector<Result> query(shards_.size());
+		for (std::size_t i = 0; i < queryClouds.size(); i++)
+		{
+			for (std::size_t s = 0; s < shards_.size(); s++)
+			{
+				query[s] = std::move(partials[s][i]);
+			}
+			results[i] = Merge(query, k);
+		}
+
+		return results;
+	}
+
+	// Bytes used by the posting lists of every shard
+	std::size_t SizeInBytes()
+	{
+		std::vector<std::future<std::size_t>> futures;
+		for (auto& shard : shards_)
+		{
+			futures.push_back(shard->SizeInBytes());
+		}
+
+		std::size_t bytes{ 0 };
+		for (auto value : GetAll(futures))
+		{
+			bytes += value;
+		}
+		return bytes;
+	}
+
+	// Performance report on KNN Search
+	// Obtain Recall@
+	// Average query time, Standard deviation query time, max query time and min query time
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: recallAt = Vector for desired Recall@
+	// 4th Parameter: voting = Votes per cell, as in KNN
+	// 5th Parameter: radius = Neighbor cells voted, as in KNN
+	// Allocations of a query include those of its LocalShard tasks on the node workers (the counter is shared by
+	// every thread), a SocketShard allocates in the ShardServer process and is not counted
+	template<typename D = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, unsigned k, const std::vector<unsigned>& recallAt, Voting voting = Voting::Points, unsigned radius = 0)
+	{
+		PerformanceReport performance;
+		performance.QueriesTime.reserve(queryClouds.size());
+		performance.RecallAt.reserve(queryClouds.size());
+		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
+
+		// For every cloud in vector of PointClouds
+		for (const auto& cloud : queryClouds)
+		{
+			// Perform KNN search
+			allocations = AllocationCount();
+			start = std::chrono::high_resolution_clock::now();
+			auto result = KNN(cloud, k, voting, radius);
+			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
+
+			GetRecall(performance, result, recallAt, cloud.ID);
+
+			performance.QueriesTime.push_back(std::chrono::duration_cast<D>(end - start).count());
+		}
+		// Calculate Recall@
+		for (auto& pair : performance.RecallAt)
+		{
+			pair.second = pair.second / static_cast<double>(queryClouds.size());
+		}
+
+		TimePerformance(performance);
+		AllocationPerformance(performance);
+
+		return performance;
+	}
+
+};
@@ -3,6 +3,8 @@
 #include "FingerPrint.h"
 #include "PerformanceReport.h"
 #include "UtilityFunctions.h"
+#include "VoteCounter.h"
+#include "ThreadPool.h"
 #include "ShazamHashParameters.h"
 #include <boost/geometry.hpp>
 #include <boost/geometry/index/rtree.hpp>
@@ -53,7 +55,8 @@ private:
 	std::string name_;
 	ShazamHashParameters parameters;
 
-	std::vector<FingerPrint> GetFingerPrintsSeq(const Cloud<T>& pointCloud, ShazamHashParameters param) const
+	template<typename C>
+	std::vector<FingerPrint> GetFingerPrintsSeq(const C& pointCloud, ShazamHashParameters param) const
 	{
 		std::vector<FingerPrint> fingerPrints;
 		fingerPrints.reserve(pointCloud.Points.size()*param.CombinationLimit);
@@ -115,7 +118,8 @@ private:
 		return fingerPrints;
 	}
 
-	std::vector<FingerPrint> GetFingerPrintsRtree(const Cloud<T>& pointCloud, ShazamHashParameters param) const
+	template<typename C>
+	std::vector<FingerPrint> GetFingerPrintsRtree(const C& pointCloud, ShazamHashParameters param) const
 	{
 		std::vector<FingerPrint> fingerPrints;
 		fingerPrints.reserve(pointCloud.Points.size()*param.CombinationLimit);
@@ -177,17 +181,15 @@ private:
 	}
 
 public:
+	// Empty index - Streaming build: Add clouds one at a time, then Finalize
+	ShazamHash(std::string name, ShazamHashParameters param) :name_{ name }, parameters{ param } {}
+
 	// Build index from vector of Point Clouds
-	ShazamHash(const std::vector<Cloud<T>>& pointClouds, std::string name, ShazamHashParameters param) :name_{ name }, parameters{ param }
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	ShazamHash(const Clouds& pointClouds, std::string name, ShazamHashParameters param) :ShazamHash(name, param)
 	{
-		for (const auto& cloud : pointClouds)
-		{
-			// Get size of all PointCloud for calculate support
-			sizeClouds[cloud.ID] = cloud.Points.size();
-
-			// Add cloud to index
-			Add(cloud, param);
-		}
+		AddRange(std::begin(pointClouds), std::end(pointClouds));
 	}
 
 	std::string GetName()
@@ -198,8 +200,12 @@ public:
 
 
 	// Add PointCloud to Index
-	ShazamHash& Add(const Cloud<T>& pointCloud, ShazamHashParameters param)
+	template<typename C>
+	ShazamHash& Add(const C& pointCloud, ShazamHashParameters param)
 	{
+		// Get size of all PointCloud for calculate support
+		sizeClouds[pointCloud.ID] += static_cast<unsigned>(pointCloud.Points.size());
+
 		auto fingerPrints = GetFingerPrintsRtree(pointCloud, param);
 
 		for (const auto& fingerPrint : fingerPrints)
@@ -210,9 +216,40 @@ public:
 		return *this;
 	}
 
+	// Add PointCloud to Index with the parameters of the index
+	template<typename C>
+	ShazamHash& Add(const C& pointCloud)
+	{
+		return Add(pointCloud, parameters);
+	}
+
+	// Add the clouds of [first, last) - e.g. a range of a CloudSet or a chunk read from a file
+	template<typename Iterator>
+	ShazamHash& AddRange(Iterator first, Iterator last)
+	{
+		for (; first != last; ++first)
+		{
+			Add(*first, parameters);
+		}
+
+		return *this;
+	}
+
+	// End of a streaming build - Release the spare capacity of the posting lists
+	// Clouds can still be added afterwards
+	ShazamHash& Finalize()
+	{
+		for (auto& pair : invertedIndex)
+		{
+			pair.second.shrink_to_fit();
+		}
+
+		return *this;
+	}
+
 	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k, ShazamHashParameters param) const
 	{
-		std::unordered_map<unsigned, unsigned> count;
+		auto& count = VoteCounter<>::Local();
 
 		auto fingerPrints = GetFingerPrintsSeq(queryCloud, param);
 
@@ -223,25 +260,31 @@ public:
 			// Get List from Inverted Index and count frequency of ID's
 			if (it != std::end(invertedIndex))
 			{
-				auto list = it->second;
-				std::for_each(std::begin(list), std::end(list), [&count](unsigned val) { count[val]++; });
+				const auto& list = it->second;
+				std::for_each(std::begin(list), std::end(list), [&count](unsigned val) { count.Add(val); });
 			}
 		}
 
-		auto numberResults = 0;
-
-		if (count.size() > k)
-			numberResults = k;
-		else
-			numberResults = count.size();
+		// Get k approximate nearest neighbors
+		return count.TopK(k);
+	}
 
-		std::vector<std::pair<unsigned, unsigned>> resultsID(numberResults);
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: param = FingerPrint parameters
+	// 4th Parameter: numThreads = Worker threads
+	std::vector<std::vector<std::pair<unsigned, unsigned>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, const unsigned k, ShazamHashParameters param, const unsigned numThreads = DefaultThreads()) const
+	{
+		std::vector<std::vector<std::pair<unsigned, unsigned>>> results(queryClouds.size());
 
-		// Get k approximate nearest neighbors
-		std::partial_sort_copy(std::begin(count), std::end(count), std::begin(resultsID), std::end(resultsID),
-			[](const std::pair<unsigned, unsigned>& left, const std::pair<unsigned, unsigned>& right) {return left.second>right.second; });
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
+		{
+			results[i] = KNN(queryClouds[i], k, param);
+		}, numThreads);
 
-		return resultsID;
+		return results;
 	}
 
 	template<typename D = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, unsigned k, const std::vector<unsigned>& recallAt, ShazamHashParameters param) const
@@ -250,12 +293,15 @@ public:
 		performance.QueriesTime.reserve(queryClouds.size());
 		performance.RecallAt.reserve(queryClouds.size());
 		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
 
 		for (const auto& cloud : queryClouds)
 		{
+			allocations = AllocationCount();
 			start = std::chrono::high_resolution_clock::now();
 			auto result = KNN(cloud, k, param);
 			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
 
 			GetRecall(performance, result, recallAt, cloud.ID);
 
@@ -269,6 +315,7 @@ public:
 		}
 
 		TimePerformance(performance);
+		AllocationPerformance(performance);
 
 		return performance;
 
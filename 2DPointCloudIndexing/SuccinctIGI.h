@@ -2,6 +2,11 @@
 #include "Cloud.h"
 #include "PerformanceReport.h"
 #include "UtilityFunctions.h"
+#include "IndexFile.h"
+#include "VoteCounter.h"
+#include "ThreadPool.h"
+#include "SarrayDecoder.h"
+#include "QueryCells.h"
 #include <boost/geometry.hpp>
 #include <vector>
 #include <unordered_map>
@@ -10,13 +15,28 @@
 #include <cmath>
 #include <string>
 #include <iostream>
-#include <set>
+#include <algorithm>
+#include <sstream>
+#include <memory>
+#include <stdexcept>
+#include <mutex>
+#include <shared_mutex>
+#include <future>
+#include <cstdint>
 #include <sdsl/bit_vectors.hpp>
 
 // Miguel Ramirez Chacon
 // 23/05/17
 
 // Succinct Inverted Grid Index for Point Clouds
+// Clouds can be added and removed at any time (LSM style):
+// - Base layer: one Sarray (sd_vector) of IDs per cell, immutable between merges
+// - Delta layer: plain ID lists of the clouds added since the last merge, searchable right away
+// - Tombstones: removed IDs, skipped by queries in the Sarrays (and in the delta being merged) until a merge
+//   drops them. A removed cloud leaves the delta layer at once, so its ID can be added again right away
+// Merge (or MergeAsync in the background) rebuilds only the Sarrays of the cells touched by the delta layer
+// or by a removed cloud, queries keep running meanwhile on the old Sarrays plus the delta being merged
+// The distinct cells of every cloud are kept (one unsigned per cell of a cloud) to find those cells
 // T: Point class(2D)
 
 template<typename T = boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>>
@@ -26,54 +46,138 @@ private:
 	std::unordered_map<unsigned, sdsl::sd_vector<>> succinctIGI;
 	std::unordered_map<unsigned, unsigned> sizeClouds;
 	std::unordered_map<unsigned, unsigned> onesPerBitmap;
+
+	// Delta layer - IDs of every cell added since the last merge
+	std::unordered_map<unsigned, std::vector<unsigned>> pendingCells_;
+
+	// Delta layer taken by the running merge - Searchable until its Sarrays replace the old ones
+	std::unordered_map<unsigned, std::vector<unsigned>> mergingCells_;
+
+	// Distinct cells of every cloud in the index
+	std::unordered_map<unsigned, std::vector<unsigned>> cloudCells_;
+
+	// Tombstones - removed_[id] for fast checks, removedIds_ in order of removal with the cells of the cloud
+	// The Sarrays are skipped for every removed ID, mergingCells_ only for the IDs removed while a merge runs
+	std::vector<bool> removed_;
+	std::vector<bool> mergingRemoved_;
+	std::vector<unsigned> removedIds_;
+	std::vector<std::vector<unsigned>> removedCells_;
+	bool merging_ = false;
+	unsigned idMax_ = 0;
+
+	// Layers: shared by queries, exclusive for Add, Remove and the swap at the end of a merge
+	// Merge: one merge at a time
+	struct Locks
+	{
+		std::shared_timed_mutex Layers;
+		std::mutex Merge;
+	};
+	std::unique_ptr<Locks> locks_{ new Locks };
+
 	const std::string name_;
 	const unsigned cmax_;
 	const unsigned delta_;
+	const GridQuantizer grid_;
 
-public:
+	bool IsRemoved(unsigned id) const
+	{
+		return id < removed_.size() && removed_[id];
+	}
 
-	SuccinctIGI(const std::vector<Cloud<T>>& pointClouds, std::string name, const unsigned cmax, const unsigned delta) :name_{ name }, cmax_{ cmax }, delta_{ delta }
+	static void SetFlag(std::vector<bool>& flags, unsigned id)
 	{
-		std::unordered_map<unsigned, std::set<unsigned>> tempIGI;
-		std::cout << "Numero de nubes de puntos: " << pointClouds.size() << '\n';
+		if (flags.size() <= id)
+			flags.resize(static_cast<std::size_t>(id) + 1, false);
+		flags[id] = true;
+	}
 
-		unsigned idMax{ 0 };
-		for (const auto& cloud : pointClouds)
+	// Add the votes of the IDs of a cell in every layer
+	template<typename Counter>
+	void Vote(Counter& count, unsigned cell, unsigned times) const
+	{
+		const bool tombstones = !removedIds_.empty();
+
+		auto it = succinctIGI.find(cell);
+
+		// Get Sarray from Inverted Index - Decode its IDs in one pass
+		if (it != std::end(succinctIGI))
 		{
-			if (idMax <= cloud.ID)
+			for (auto id : SarrayPositions(it->second))
 			{
-				idMax = cloud.ID;
+				if (!tombstones || !IsRemoved(static_cast<unsigned>(id)))
+					count.Add(static_cast<unsigned>(id), times);
 			}
-			// Get size of all PointCloud for calculate support
-			sizeClouds[cloud.ID] = cloud.Points.size();
+		}
 
-			// Add cloud to index
-			Add(cloud, tempIGI);
+		auto merging = mergingCells_.find(cell);
+		if (merging != std::end(mergingCells_))
+		{
+			for (auto id : merging->second)
+			{
+				if (id >= mergingRemoved_.size() || !mergingRemoved_[id])
+					count.Add(id, times);
+			}
 		}
 
-		// For every cell
-		for (const auto& pair : tempIGI)
+		// Removed clouds already left the pending delta
+		auto pending = pendingCells_.find(cell);
+		if (pending != std::end(pendingCells_))
 		{
-			// Generate bitmap
-			sdsl::bit_vector bitmap = sdsl::bit_vector(idMax + 1, 0);
+			for (auto id : pending->second)
+			{
+				count.Add(id, times);
+			}
+		}
+	}
 
-			// For every ID in set 
+	// New Sarray of a cell: IDs of the Sarray without the removed IDs and IDs of the merged delta
+	// (the delta only holds clouds added after the tombstones of purge)
+	// Returns false if no ID is left
+	bool RebuildCell(unsigned cell, const std::vector<bool>& purge, sdsl::sd_vector<>& sarray, unsigned& ones) const
+	{
+		std::vector<unsigned> ids;
 
-			for (const auto& id : pair.second)
+		auto it = succinctIGI.find(cell);
+		if (it != std::end(succinctIGI))
+		{
+			for (auto id : SarrayPositions(it->second))
 			{
-
-				bitmap[id] = 1;
+				if (id >= purge.size() || !purge[static_cast<std::size_t>(id)])
+					ids.push_back(static_cast<unsigned>(id));
 			}
+		}
 
+		auto delta = mergingCells_.find(cell);
+		if (delta != std::end(mergingCells_))
+		{
+			ids.insert(std::end(ids), std::begin(delta->second), std::end(delta->second));
+		}
 
-			// Generate SArray from bitmap
-			sdsl::sd_vector<> sarray(bitmap);
-			succinctIGI[pair.first] = sarray;
-			// Number or 1's per bitmap
-			sdsl::sd_vector<>::rank_1_type sarray_rank(&sarray);
-			onesPerBitmap[pair.first] = sarray_rank(sarray.size());
+		std::sort(std::begin(ids), std::end(ids));
+		ids.erase(std::unique(std::begin(ids), std::end(ids)), std::end(ids));
 
-		}
+		ones = static_cast<unsigned>(ids.size());
+		if (ids.empty())
+			return false;
+
+		// Built from the sorted IDs - No bitmap over the whole ID range
+		sarray = sdsl::sd_vector<>(std::begin(ids), std::end(ids));
+		return true;
+	}
+
+public:
+
+	// Empty index - Streaming build: Add clouds one at a time, then Finalize
+	SuccinctIGI(std::string name, const unsigned cmax, const unsigned delta) :name_{ name }, cmax_{ cmax }, delta_{ delta }, grid_{ cmax, delta } {}
+
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	SuccinctIGI(const Clouds& pointClouds, std::string name, const unsigned cmax, const unsigned delta) :SuccinctIGI(name, cmax, delta)
+	{
+		std::cout << "Numero de nubes de puntos: " << pointClouds.size() << '\n';
+
+		AddRange(std::begin(pointClouds), std::end(pointClouds));
+		Finalize();
 	}
 
 	std::string GetName()
@@ -81,20 +185,316 @@ public:
 		return name_;
 	}
 
-	// Add PointCloud to Index
-	void Add(const Cloud<T>& pointCloud, std::unordered_map<unsigned, std::set<unsigned>>& tempIGI)
+	// Write the index to a binary file (format in IndexFile.h)
+	// Sections: cell table (cell, ones, bytes), serialized Sarrays, (ID, size) of every cloud
+	// Only the base layer is written: Merge first if clouds were added or removed since the last merge
+	void Save(const std::string& fileName) const
 	{
-		unsigned px, py, cell;
-		for (const auto& point : pointCloud.Points)
+		std::shared_lock<std::shared_timed_mutex> lock(locks_->Layers);
+
+		if (!pendingCells_.empty() || !mergingCells_.empty() || !removedIds_.empty())
+			throw std::logic_error("SuccinctIGI: Save with unmerged changes");
+
+		std::vector<std::uint64_t> cells;
+		cells.reserve(2 * succinctIGI.size());
+		std::ostringstream sarrays;
+		std::uint64_t totalOnes{ 0 };
+
+		for (const auto& pair : succinctIGI)
 		{
-			// Calculate cell of point
-			px = static_cast<unsigned>(std::floor(boost::geometry::get<0>(point) / delta_));
-			py = static_cast<unsigned>(std::floor(boost::geometry::get<1>(point) / delta_));
-			cell = px + static_cast<unsigned>(cmax_ / delta_)*py;
+			auto ones = onesPerBitmap.find(pair.first)->second;
+			auto before = sarrays.tellp();
+			pair.second.serialize(sarrays);
 
-			// Inverted Index
-			tempIGI[cell].insert(pointCloud.ID);
+			cells.push_back((static_cast<std::uint64_t>(ones) << 32) | pair.first);
+			cells.push_back(static_cast<std::uint64_t>(sarrays.tellp() - before));
+			totalOnes += ones;
+		}
+
+		std::vector<std::uint32_t> clouds;
+		clouds.reserve(2 * sizeClouds.size());
+		for (const auto& pair : sizeClouds)
+		{
+			clouds.push_back(pair.first);
+			clouds.push_back(pair.second);
 		}
+
+		IndexFileWriter writer(fileName, "SIGIINDX", 1);
+		auto& header = writer.Header();
+		header.Cmax = cmax_;
+		header.Delta = delta_;
+		header.NumCells = succinctIGI.size();
+		header.NumPostings = totalOnes;
+		header.NumClouds = sizeClouds.size();
+
+		auto blob = sarrays.str();
+		writer.Write(cells.data(), cells.size() * sizeof(std::uint64_t));
+		writer.Write(blob.data(), blob.size());
+		writer.Write(clouds.data(), clouds.size() * sizeof(std::uint32_t));
+
+		writer.Close();
+	}
+
+	// Open an index written by Save
+	// The file is memory mapped and every Sarray is loaded straight from the mapping
+	// (sdsl keeps its own copy of the bits, so this is a load, not a zero-copy view)
+	// verify: Check the checksum of the whole file before use
+	static SuccinctIGI Open(const std::string& fileName, std::string name, bool verify = false)
+	{
+		MappedFile file(fileName);
+		IndexFileReader reader(file, "SIGIINDX", 1, verify);
+		const auto& header = reader.Header();
+
+		auto numCells = static_cast<std::size_t>(header.NumCells);
+		auto cells = reader.Read<std::uint64_t>(2 * numCells);
+
+		std::uint64_t totalBytes{ 0 };
+		for (std::size_t i = 0; i < numCells; i++)
+		{
+			totalBytes += cells[2 * i + 1];
+		}
+
+		auto sarrays = reader.Read<char>(static_cast<std::size_t>(totalBytes));
+		auto clouds = reader.Read<std::uint32_t>(2 * static_cast<std::size_t>(header.NumClouds));
+
+		SuccinctIGI index(name, header.Cmax, header.Delta);
+		index.succinctIGI.reserve(numCells);
+		index.onesPerBitmap.reserve(numCells);
+
+		IndexSectionBuffer buffer(sarrays, static_cast<std::size_t>(totalBytes));
+		std::istream in(&buffer);
+
+		for (std::size_t i = 0; i < numCells; i++)
+		{
+			auto cell = static_cast<unsigned>(cells[2 * i] & 0xFFFFFFFFu);
+			auto ones = static_cast<unsigned>(cells[2 * i] >> 32);
+
+			index.succinctIGI[cell].load(in);
+			index.onesPerBitmap[cell] = ones;
+		}
+
+		for (std::size_t i = 0; i < header.NumClouds; i++)
+		{
+			index.idMax_ = std::max(index.idMax_, clouds[2 * i]);
+		}
+
+		if (!in)
+			throw std::runtime_error("SuccinctIGI: corrupted Sarrays in " + fileName);
+
+		// Cells of every cloud - Not stored in the file, decoded once from the Sarrays
+		for (const auto& pair : index.succinctIGI)
+		{
+			for (auto id : SarrayPositions(pair.second))
+			{
+				index.cloudCells_[static_cast<unsigned>(id)].push_back(pair.first);
+			}
+		}
+
+		index.sizeClouds.reserve(static_cast<std::size_t>(header.NumClouds));
+		for (std::size_t i = 0; i < header.NumClouds; i++)
+		{
+			index.sizeClouds[clouds[2 * i]] = clouds[2 * i + 1];
+		}
+
+		return index;
+	}
+
+	// Add PointCloud to Index - The cloud goes to the delta layer and is searchable right away
+	// A removed ID can be added again at once (e.g. Remove then Add to replace a cloud)
+	template<typename C>
+	SuccinctIGI& Add(const C& pointCloud)
+	{
+		// Distinct cells of the points
+		thread_local std::vector<unsigned> cells;
+		grid_.Cells(pointCloud.Points, cells);
+		std::sort(std::begin(cells), std::end(cells));
+		cells.erase(std::unique(std::begin(cells), std::end(cells)), std::end(cells));
+
+		std::unique_lock<std::shared_timed_mutex> lock(locks_->Layers);
+
+		idMax_ = std::max(idMax_, pointCloud.ID);
+
+		// Get size of all PointCloud for calculate support
+		sizeClouds[pointCloud.ID] += static_cast<unsigned>(pointCloud.Points.size());
+
+		auto& own = cloudCells_[pointCloud.ID];
+		for (auto cell : cells)
+		{
+			// Inverted Index - Once per cell, also when the ID is added again
+			auto& ids = pendingCells_[cell];
+			if (ids.empty() || ids.back() != pointCloud.ID)
+				ids.push_back(pointCloud.ID);
+
+			if (std::find(std::begin(own), std::end(own), cell) == std::end(own))
+				own.push_back(cell);
+		}
+
+		return *this;
+	}
+
+	// Add the clouds of [first, last) - e.g. a range of a CloudSet or a chunk read from a file
+	template<typename Iterator>
+	SuccinctIGI& AddRange(Iterator first, Iterator last)
+	{
+		for (; first != last; ++first)
+		{
+			Add(*first);
+		}
+
+		return *this;
+	}
+
+	// Remove a PointCloud - It leaves the delta layer, its ID gets a tombstone for the Sarrays (and the delta
+	// being merged) and is no longer returned by queries. The Sarrays still hold it until the next merge,
+	// which rebuilds only the cells of the cloud. The ID can be added again right away
+	// Returns false if the ID is not in the index
+	bool Remove(unsigned id)
+	{
+		std::unique_lock<std::shared_timed_mutex> lock(locks_->Layers);
+
+		if (sizeClouds.erase(id) == 0)
+			return false;
+
+		auto own = cloudCells_.find(id);
+		std::vector<unsigned> cells;
+		if (own != std::end(cloudCells_))
+		{
+			cells = std::move(own->second);
+			cloudCells_.erase(own);
+		}
+
+		for (auto cell : cells)
+		{
+			auto pending = pendingCells_.find(cell);
+			if (pending == std::end(pendingCells_))
+				continue;
+
+			auto& ids = pending->second;
+			ids.erase(std::remove(std::begin(ids), std::end(ids), id), std::end(ids));
+			if (ids.empty())
+				pendingCells_.erase(pending);
+		}
+
+		SetFlag(removed_, id);
+		if (merging_)
+			SetFlag(mergingRemoved_, id);
+
+		removedIds_.push_back(id);
+		removedCells_.push_back(std::move(cells));
+
+		return true;
+	}
+
+	// Merge the delta layer and the tombstones into the Sarrays
+	// Only the cells with added IDs or with a removed ID are rebuilt. Queries, Add and Remove
+	// may run meanwhile: they see the old Sarrays plus the delta being merged until the new Sarrays are swapped in
+	// numThreads: Threads rebuilding the cells (1 leaves the shared ThreadPool to the queries)
+	SuccinctIGI& Merge(const unsigned numThreads = 1)
+	{
+		std::lock_guard<std::mutex> merge(locks_->Merge);
+
+		std::vector<bool> purge;
+		std::size_t numPurged;
+
+		// Cells to rebuild - Cells of the merged delta and cells of the removed clouds
+		// The Sarrays and mergingCells_ only change below, under the lock, so they are read without it later
+		std::vector<unsigned> cells;
+		{
+			std::unique_lock<std::shared_timed_mutex> lock(locks_->Layers);
+
+			if (pendingCells_.empty() && removedIds_.empty())
+				return *this;
+
+			mergingCells_.swap(pendingCells_);
+			purge = removed_;
+			numPurged = removedIds_.size();
+			merging_ = true;
+
+			cells.reserve(mergingCells_.size());
+			for (const auto& pair : mergingCells_)
+			{
+				cells.push_back(pair.first);
+			}
+			for (std::size_t i = 0; i < numPurged; i++)
+			{
+				cells.insert(std::end(cells), std::begin(removedCells_[i]), std::end(removedCells_[i]));
+			}
+		}
+
+		std::sort(std::begin(cells), std::end(cells));
+		cells.erase(std::unique(std::begin(cells), std::end(cells)), std::end(cells));
+
+		std::vector<sdsl::sd_vector<>> sarrays(cells.size());
+		std::vector<unsigned> ones(cells.size());
+		std::vector<char> kept(cells.size());
+
+		ThreadPool::Default().ParallelFor(cells.size(), [&](std::size_t i, unsigned)
+		{
+			kept[i] = RebuildCell(cells[i], purge, sarrays[i], ones[i]);
+		}, numThreads);
+
+		std::unique_lock<std::shared_timed_mutex> lock(locks_->Layers);
+
+		for (std::size_t i = 0; i < cells.size(); i++)
+		{
+			if (kept[i])
+			{
+				succinctIGI[cells[i]] = std::move(sarrays[i]);
+				onesPerBitmap[cells[i]] = ones[i];
+			}
+			else
+			{
+				succinctIGI.erase(cells[i]);
+				onesPerBitmap.erase(cells[i]);
+			}
+		}
+
+		std::unordered_map<unsigned, std::vector<unsigned>>().swap(mergingCells_);
+		std::vector<bool>().swap(mergingRemoved_);
+		merging_ = false;
+
+		// Tombstones of the IDs purged by this merge - IDs removed meanwhile stay (also when removed twice)
+		for (std::size_t i = 0; i < numPurged; i++)
+		{
+			removed_[removedIds_[i]] = false;
+		}
+		removedIds_.erase(std::begin(removedIds_), std::begin(removedIds_) + numPurged);
+		removedCells_.erase(std::begin(removedCells_), std::begin(removedCells_) + numPurged);
+		for (auto id : removedIds_)
+		{
+			removed_[id] = true;
+		}
+
+		return *this;
+	}
+
+	// Merge on a background thread - The index must outlive the returned future
+	std::future<void> MergeAsync(const unsigned numThreads = 1)
+	{
+		return std::async(std::launch::async, [this, numThreads] { Merge(numThreads); });
+	}
+
+	// End of a streaming build - Merge everything added so far on all threads
+	SuccinctIGI& Finalize()
+	{
+		return Merge(DefaultThreads());
+	}
+
+	// IDs waiting in the delta layer, and removed clouds waiting for a merge
+	std::pair<std::size_t, std::size_t> PendingChanges() const
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(locks_->Layers);
+
+		std::size_t ids{ 0 };
+		for (const auto* layer : { &mergingCells_, &pendingCells_ })
+		{
+			for (const auto& pair : *layer)
+			{
+				ids += pair.second.size();
+			}
+		}
+
+		return std::make_pair(ids, removedIds_.size());
 	}
 
 	// KNN Query
@@ -102,53 +502,87 @@ public:
 	// Second Parameter: k = Nearest Neighbors
 	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k) const
 	{
-		std::unordered_map<unsigned, unsigned> count;
+		auto& count = VoteCounter<>::Local();
+		const auto& queryCells = QueryCells(queryCloud.Points, grid_);
+
+		std::shared_lock<std::shared_timed_mutex> lock(locks_->Layers);
+
+		// For every distinct cell of the PointCloud - Votes weighted by its number of points
+		for (const auto& queryCell : queryCells)
+		{
+			Vote(count, queryCell.Cell, queryCell.Count);
+		}
 
-		unsigned px, py, cell;
+		// Get k approximate nearest neighbors
+		return count.TopK(k);
 
-		std::unordered_map<unsigned, sdsl::sd_vector<>> listSarrays;
-		listSarrays.reserve(queryCloud.Points.size());
+	}
 
-		// For every point in the PointCloud
-		for (const auto& point : queryCloud.Points)
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: numThreads = Worker threads
+	std::vector<std::vector<std::pair<unsigned, unsigned>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned numThreads = DefaultThreads()) const
+	{
+		std::vector<std::vector<std::pair<unsigned, unsigned>>> results(queryClouds.size());
+
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
 		{
-			px = static_cast<unsigned>(std::floor(boost::geometry::get<0>(point) / delta_));
-			py = static_cast<unsigned>(std::floor(boost::geometry::get<1>(point) / delta_));
+			results[i] = KNN(queryClouds[i], k);
+		}, numThreads);
 
-			cell = px + static_cast<unsigned>(cmax_ / delta_)*py;
+		return results;
+	}
+
+	// Decode throughput of the posting lists in IDs per second
+	// Every Sarray is decoded repetitions times with a select per ID and with a sequential SarrayIterator
+	// Returns (select, sequential)
+	std::pair<double, double> DecodePerformance(const unsigned repetitions = 10) const
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(locks_->Layers);
 
-			auto it = succinctIGI.find(cell);
+		std::uint64_t sumSelect{ 0 };
+		std::uint64_t sumSequential{ 0 };
+		std::uint64_t ids{ 0 };
 
-			// Get Sarray from Inverted Index
-			if (it != std::end(succinctIGI))
+		auto start = std::chrono::high_resolution_clock::now();
+		for (unsigned r = 0; r < repetitions; r++)
+		{
+			for (const auto& pair : succinctIGI)
 			{
-				sdsl::sd_vector<>::select_1_type select_sarray(&(it->second));
-				auto it = onesPerBitmap.find(cell);
-				auto ones = it->second;
-				unsigned i{ 1 };
-				while (i<ones)
+				sdsl::sd_vector<>::select_1_type select_sarray(&pair.second);
+				auto ones = onesPerBitmap.find(pair.first)->second;
+
+				for (unsigned i = 1; i <= ones; i++)
 				{
-					count[select_sarray(i)]++;
-					i++;
+					sumSelect += select_sarray(i);
 				}
+				ids += ones;
 			}
 		}
+		auto middle = std::chrono::high_resolution_clock::now();
 
-		auto numberResults = 0;
-
-		if (count.size() > k)
-			numberResults = k;
-		else
-			numberResults = count.size();
-
-		std::vector<std::pair<unsigned, unsigned>> resultsID(numberResults);
+		for (unsigned r = 0; r < repetitions; r++)
+		{
+			for (const auto& pair : succinctIGI)
+			{
+				for (auto id : SarrayPositions(pair.second))
+				{
+					sumSequential += id;
+				}
+			}
+		}
+		auto end = std::chrono::high_resolution_clock::now();
 
-		// Get k approximate nearest neighbors
-		std::partial_sort_copy(std::begin(count), std::end(count), std::begin(resultsID), std::end(resultsID),
-			[](const std::pair<unsigned, unsigned>& left, const std::pair<unsigned, unsigned>& right) {return left.second>right.second; });
+		// Both decoders must see the same IDs (also keeps the loops from being optimized away)
+		if (sumSelect != sumSequential)
+			throw std::logic_error("SuccinctIGI: select and sequential decoding differ");
 
-		return resultsID;
+		auto selectSeconds = std::chrono::duration<double>(middle - start).count();
+		auto sequentialSeconds = std::chrono::duration<double>(end - middle).count();
 
+		return std::make_pair(selectSeconds > 0 ? ids / selectSeconds : 0.0, sequentialSeconds > 0 ? ids / sequentialSeconds : 0.0);
 	}
 
 	// Performance report on KNN Search
@@ -163,14 +597,17 @@ public:
 		performance.QueriesTime.reserve(queryClouds.size());
 		performance.RecallAt.reserve(queryClouds.size());
 		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
 
 		// For every cloud in vector of PointClouds
-		for (const auto cloud : queryClouds)
+		for (const auto& cloud : queryClouds)
 		{
 			// Perform KNN search
+			allocations = AllocationCount();
 			start = std::chrono::high_resolution_clock::now();
 			auto result = KNN(cloud, k);
 			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
 
 			GetRecall(performance, result, recallAt, cloud.ID);
 
@@ -183,6 +620,7 @@ public:
 		}
 
 		TimePerformance(performance);
+		AllocationPerformance(performance);
 
 		return performance;
 	}
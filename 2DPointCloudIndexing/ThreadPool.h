@@ -0,0 +1,185 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <exception>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+// Fixed pool of worker threads for parallel queries and index construction
+// The calling thread takes part in the work as worker 0
+// Calls from inside a running task execute serially on the calling thread (no nested parallelism)
+
+// Number of hardware threads (at least 1)
+inline unsigned DefaultThreads()
+{
+	auto threads = std::thread::hardware_concurrency();
+	return threads == 0 ? 1 : threads;
+}
+
+class ThreadPool
+{
+private:
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::mutex runMutex_;
+	std::condition_variable wake_;
+	std::condition_variable done_;
+	const std::function<void(unsigned)>* job_ = nullptr;
+	std::size_t generation_ = 0;
+	unsigned active_ = 0;
+	unsigned pending_ = 0;
+	bool stop_ = false;
+
+	// True while the current thread is running a task of a pool
+	static bool& InsideTask()
+	{
+		thread_local bool inside{ false };
+		return inside;
+	}
+
+	void WorkerLoop(unsigned worker)
+	{
+		InsideTask() = true;
+		std::size_t seen{ 0 };
+
+		while (true)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+
+			if (stop_)
+				return;
+
+			seen = generation_;
+			if (worker > active_)
+				continue;
+
+			auto job = job_;
+			lock.unlock();
+
+			(*job)(worker);
+
+			lock.lock();
+			if (--pending_ == 0)
+				done_.notify_all();
+		}
+	}
+
+public:
+
+	// numThreads: Total threads including the caller
+	explicit ThreadPool(unsigned numThreads = DefaultThreads())
+	{
+		for (unsigned worker = 1; worker < numThreads; worker++)
+		{
+			workers_.emplace_back([this, worker] { WorkerLoop(worker); });
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		wake_.notify_all();
+
+		for (auto& worker : workers_)
+		{
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Pool shared by all the indexes
+	static ThreadPool& Default()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	// Total threads including the caller
+	unsigned Size() const
+	{
+		return static_cast<unsigned>(workers_.size()) + 1;
+	}
+
+	// Run job(worker) once on each of numThreads threads and wait for all of them
+	// worker: Index in [0, numThreads) - Use it to select per-thread scratch buffers
+	// job must not throw
+	void Run(const std::function<void(unsigned)>& job, unsigned numThreads)
+	{
+		numThreads = std::min(numThreads, Size());
+
+		if (numThreads <= 1 || InsideTask())
+		{
+			auto inside = InsideTask();
+			InsideTask() = true;
+			job(0);
+			InsideTask() = inside;
+			return;
+		}
+
+		std::lock_guard<std::mutex> run(runMutex_);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			job_ = &job;
+			active_ = numThreads - 1;
+			pending_ = numThreads - 1;
+			generation_++;
+		}
+		wake_.notify_all();
+
+		InsideTask() = true;
+		job(0);
+		InsideTask() = false;
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		done_.wait(lock, [&] { return pending_ == 0; });
+		job_ = nullptr;
+	}
+
+	// Run task(i, worker) for every i in [0, count)
+	// Items are handed out one at a time, so threads that finish early take the remaining work
+	// The first exception thrown by a task is rethrown in the caller
+	template<typename Task>
+	void ParallelFor(std::size_t count, const Task& task, unsigned numThreads = DefaultThreads())
+	{
+		if (count == 0)
+			return;
+
+		std::atomic<std::size_t> next{ 0 };
+		std::exception_ptr error;
+		std::mutex errorMutex;
+
+		std::function<void(unsigned)> job = [&](unsigned worker)
+		{
+			try
+			{
+				for (auto i = next++; i < count; i = next++)
+				{
+					task(i, worker);
+				}
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error)
+					error = std::current_exception();
+				next = count;
+			}
+		};
+
+		auto threads = static_cast<unsigned>(std::min<std::size_t>(std::max(numThreads, 1u), count));
+		Run(job, threads);
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+};
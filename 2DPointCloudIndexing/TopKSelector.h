@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+
+// Bounded selection of the k best (ID, score) pairs of a stream
+// Keeps a heap of the k best items seen so far with the worst one on top: every new item is compared with it
+// and most are rejected by that single comparison, O(n log k) time and O(k) memory whatever the number of candidates
+// Equal scores are ranked by increasing ID, so the result does not depend on the order of the stream
+// minScore: Items scoring below it are never kept - Cuts the long tail of candidates with a few votes
+// Id: Cloud ID type
+// Score: Vote or score type
+template<typename Id = unsigned, typename Score = unsigned>
+class TopKSelector
+{
+private:
+	std::vector<std::pair<Id, Score>> heap_;
+	std::size_t k_;
+	Score minScore_;
+
+	// Ranking order - Higher score first, then lower ID
+	static bool Better(const std::pair<Id, Score>& left, const std::pair<Id, Score>& right)
+	{
+		return left.second > right.second || (!(right.second > left.second) && left.first < right.first);
+	}
+
+public:
+	TopKSelector(std::size_t k = 0, Score minScore = Score()) :k_{ k }, minScore_{ minScore } {}
+
+	// Start a new selection, the buffer is reused
+	void Reset(std::size_t k, Score minScore = Score())
+	{
+		heap_.clear();
+		k_ = k;
+		minScore_ = minScore;
+	}
+
+	// Offer an item - Returns true if it is among the k best so far
+	bool Push(Id id, Score score)
+	{
+		if (score < minScore_ || k_ == 0)
+			return false;
+
+		auto item = std::make_pair(id, score);
+
+		if (heap_.size() < k_)
+		{
+			heap_.push_back(item);
+			std::push_heap(std::begin(heap_), std::end(heap_), Better);
+			return true;
+		}
+
+		// Worst kept item on top
+		if (!Better(item, heap_.front()))
+			return false;
+
+		std::pop_heap(std::begin(heap_), std::end(heap_), Better);
+		heap_.back() = item;
+		std::push_heap(std::begin(heap_), std::end(heap_), Better);
+
+		return true;
+	}
+
+	std::size_t Size() const
+	{
+		return heap_.size();
+	}
+
+	// Score an item needs to be kept - The worst kept score once k items are kept, minScore before
+	Score Threshold() const
+	{
+		return heap_.size() < k_ || heap_.empty() ? minScore_ : heap_.front().second;
+	}
+
+	// Selected items, best first - Ends the selection
+	std::vector<std::pair<Id, Score>> Results()
+	{
+		std::sort_heap(std::begin(heap_), std::end(heap_), Better);
+		std::vector<std::pair<Id, Score>> results(std::begin(heap_), std::end(heap_));
+		heap_.clear();
+		return results;
+	}
+};
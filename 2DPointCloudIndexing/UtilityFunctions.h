@@ -1,5 +1,6 @@
 #pragma once
 #include "PerformanceReport.h"
+#include "AllocationCounter.h"
 #include <algorithm>
 #include <cmath>
 #include <numeric>
@@ -75,6 +76,20 @@ void TimePerformance(PerformanceReport& report)
 	report.SDQueryTime = std::sqrt(var);
 }
 
+// Function to get Average and Max heap allocations per query
+void AllocationPerformance(PerformanceReport& report)
+{
+	report.AverageAllocations = 0;
+	report.MaxAllocations = 0;
+
+	if (report.QueriesAllocations.empty())
+		return;
+
+	auto sum = std::accumulate(std::begin(report.QueriesAllocations), std::end(report.QueriesAllocations), static_cast<std::size_t>(0));
+	report.AverageAllocations = static_cast<double>(sum) / report.QueriesAllocations.size();
+	report.MaxAllocations = *std::max_element(std::begin(report.QueriesAllocations), std::end(report.QueriesAllocations));
+}
+
 void PrintPerformanceReport(PerformanceReport& report, std::string name, std::string timeUnits)
 {
 	std::cout << "-------------------------------------------------------------" << '\n';
@@ -84,6 +99,14 @@ void PrintPerformanceReport(PerformanceReport& report, std::string name, std::st
 	std::cout << "Query Time - Standard Deviation: " << report.SDQueryTime << " " << timeUnits << '\n';
 	std::cout << "Query Time - Maximum: " << report.MaxQueryTime << " " << timeUnits << '\n';
 	std::cout << "Query Time - Minimum: " << report.MinQueryTime << " " << timeUnits << '\n';
+	if (AllocationCountEnabled())
+	{
+		std::cout << "-------------------------------------------------------------" << '\n';
+		std::cout << name << '\n';
+		std::cout << "Heap Allocations: Performance" << '\n';
+		std::cout << "Allocations per Query - Average: " << report.AverageAllocations << '\n';
+		std::cout << "Allocations per Query - Maximum: " << report.MaxAllocations << '\n';
+	}
 	std::cout << "-------------------------------------------------------------" << '\n';
 	std::cout << name << '\n';
 	std::cout << "Recall - Performance" << '\n';
@@ -1,8 +1,12 @@
 #pragma once
 #include <utility>
 #include "UtilityFunctions.h"
+#include "VoteCounter.h"
+#include "ThreadPool.h"
+#include "Scoring.h"
 #include <unordered_map>
 #include <string>
+#include <stdexcept>
 #include <chrono>
 #include <functional>
 #include "vp-tree.h"
@@ -27,12 +31,41 @@ private:
 	std::unordered_map<unsigned, unsigned> sizeClouds;
 	std::string name_;
 
+	// Votes of the internalK nearest points of every query point, searched in the VPT
+	// The points are split over numThreads threads
+	VoteCounter<>& Vote(const Cloud<T>& queryCloud, const unsigned internalK, const unsigned numThreads) const
+	{
+		const auto& points = queryCloud.Points;
+
+		return VoteCounter<>::Parallel(points.size(), numThreads, [&](std::size_t first, std::size_t last, VoteCounter<>& partial)
+		{
+			std::vector<PointIdx> results;
+			std::vector<double> distances;
+
+			// K queries for every point in the PointCloud
+			for (auto i = first; i < last; i++)
+			{
+				vpt.KNN(std::make_pair(points[i], 1), internalK, results, distances);
+
+				// Count the frequencies for the Clouds ID
+				for (const auto& item : results)
+				{
+					partial.Add(item.second);
+				}
+				results.clear();
+				distances.clear();
+			}
+		});
+	}
+
 public:
 
 	VPT(std::string name) :name_{ name } {}
 
 	// Build index from vector of Point Clouds
-	void Build(const std::vector<Cloud<T>>& pointClouds, std::function<double(const std::pair<T, unsigned>&, const std::pair<T, unsigned>&)> dist)
+	// Clouds: std::vector<Cloud<T>> or CloudSet<T>
+	template<typename Clouds>
+	void Build(const Clouds& pointClouds, std::function<double(const std::pair<T, unsigned>&, const std::pair<T, unsigned>&)> dist)
 	{
 		std::vector<PointIdx> data;
 		int totalPoints = 0;
@@ -66,40 +99,48 @@ public:
 	// 1st Parameter: Query =  PointCloud
 	// 2nd Parameter: K = K Nearest Neighbors PointClouds
 	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
-	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k, const unsigned internalK) const
+	// 4th Parameter: numThreads = Threads sharing the points of the query (for very large query clouds)
+	std::vector<std::pair<unsigned, unsigned>> KNN(const Cloud<T>& queryCloud, const unsigned k, const unsigned internalK, const unsigned numThreads = 1) const
 	{
-		std::vector<PointIdx> results;
-		std::vector<double> distances;
-		std::unordered_map<unsigned, unsigned> count;
-		auto i = 0;
-		// K queries for every point in the PointCloud
-		for (const auto& point : queryCloud.Points)
-		{
-			vpt.KNN(std::make_pair(point, 1), internalK, results, distances);
+		auto& count = Vote(queryCloud, internalK, numThreads);
 
-			// Count the frequencies for the Clouds ID
-			for (const auto& item : results)
-			{
-				count[item.second]++;
-			}
-			results.clear();
-			distances.clear();
-		}
+		// Get only the first K Point Clouds based in ID frequency.
+		return count.TopK(k);
+	}
+
+	// KNN Query ranked by a normalized score instead of raw votes (Scoring.h)
+	// 1st Parameter: Query =  PointCloud
+	// 2nd Parameter: K = K Nearest Neighbors PointClouds
+	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
+	// 4th Parameter: scoring = Votes, Support or Jaccard - TfIdf needs the cells of a grid index
+	// 5th Parameter: numThreads = Threads sharing the points of the query (for very large query clouds)
+	std::vector<std::pair<unsigned, double>> KNNScored(const Cloud<T>& queryCloud, const unsigned k, const unsigned internalK, Scoring scoring, const unsigned numThreads = 1) const
+	{
+		if (scoring == Scoring::TfIdf)
+			throw std::invalid_argument("VPT: TfIdf scoring needs a grid index");
 
-		auto numberResults = 0;
+		auto& count = Vote(queryCloud, internalK, numThreads);
 
-		if (count.size() > k)
-			numberResults = k;
-		else
-			numberResults = count.size();
+		// Get the k clouds with best score
+		return count.TopK(k, CloudScore<>(sizeClouds, scoring, queryCloud.Points.size() * internalK));
+	}
 
-		std::vector<std::pair<unsigned, unsigned>> resultsID(numberResults);
+	// Batch KNN Query - Queries run in parallel on the shared ThreadPool
+	// Results are returned in the same order as queryClouds
+	// 1st Parameter: Vector of Queries Point Clouds
+	// 2nd Parameter: k = Nearest Neighbors
+	// 3rd Parameter: internalK = internalK-NN queries per point in PointCloud
+	// 4th Parameter: numThreads = Worker threads
+	std::vector<std::vector<std::pair<unsigned, unsigned>>> KNNBatch(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const unsigned numThreads = DefaultThreads()) const
+	{
+		std::vector<std::vector<std::pair<unsigned, unsigned>>> results(queryClouds.size());
 
-		// Get only the first K Point Clouds based in ID frequency.
-		std::partial_sort_copy(std::begin(count), std::end(count), std::begin(resultsID), std::end(resultsID),
-			[](const std::pair<unsigned, unsigned>& left, const std::pair<unsigned, unsigned>& right) {return left.second>right.second; });
+		ThreadPool::Default().ParallelFor(queryClouds.size(), [&](std::size_t i, unsigned)
+		{
+			results[i] = KNN(queryClouds[i], k, internalK);
+		}, numThreads);
 
-		return resultsID;
+		return results;
 	}
 
 	// Performance report on KNN Search
@@ -109,22 +150,34 @@ public:
 	// 2nd Parameter: k = Nearest Neighbors	
 	// 3rd Parameter: internalK = internalK-NN
 	// 3rd Parameter: recallAt = Vector for desired Recall@
-	template<typename Duration = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const std::vector<unsigned>& recallAt) const
+	// 5th Parameter: scoring = Ranking of the clouds, as in KNNScored (Votes: KNN)
+	template<typename Duration = std::chrono::milliseconds>PerformanceReport KNNPerformanceReport(const std::vector<Cloud<T>>& queryClouds, const unsigned k, const unsigned internalK, const std::vector<unsigned>& recallAt, Scoring scoring = Scoring::Votes) const
 	{
 		PerformanceReport performance;
 		performance.QueriesTime.reserve(queryClouds.size());
 		performance.RecallAt.reserve(queryClouds.size());
 		std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
+		std::size_t allocations;
+		std::vector<std::pair<unsigned, unsigned>> result;
+		std::vector<std::pair<unsigned, double>> resultScored;
 
 		// For every cloud in vector of PointClouds
 		for (const auto& cloud : queryClouds)
 		{
 			// Perform KNN search
+			allocations = AllocationCount();
 			start = std::chrono::high_resolution_clock::now();
-			auto result = KNN(cloud, k, internalK);
+			if (scoring == Scoring::Votes)
+				result = KNN(cloud, k, internalK);
+			else
+				resultScored = KNNScored(cloud, k, internalK, scoring);
 			end = std::chrono::high_resolution_clock::now();
+			performance.QueriesAllocations.push_back(AllocationCount() - allocations);
 
-			GetRecall(performance, result, recallAt, cloud.ID);
+			if (scoring == Scoring::Votes)
+				GetRecall(performance, result, recallAt, cloud.ID);
+			else
+				GetRecall(performance, resultScored, recallAt, cloud.ID);
 
 			performance.QueriesTime.push_back(std::chrono::duration_cast<Duration>(end - start).count());
 		}
@@ -134,6 +187,7 @@ public:
 			pair.second = pair.second / static_cast<double>(queryClouds.size());
 		}
 		TimePerformance(performance);
+		AllocationPerformance(performance);
 		return performance;
 	}
 
@@ -0,0 +1,277 @@
+#pragma once
+#include "ThreadPool.h"
+#include "TopKSelector.h"
+#include "BitUtility.h"
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// Vote accumulator for KNN queries
+// Cloud IDs are dense small integers: one counter per ID in a flat array
+// plus the list of touched IDs, so a reset costs O(touched) instead of O(IDs)
+// A bit per ID marks the touched IDs, so sets of IDs given as 64 bit words (bitmaps, runs) are voted
+// word by word: the IDs touched for the first time are the bits missing from the mark word
+// Id: Cloud ID type
+// Count: Vote type
+template<typename Id = unsigned, typename Count = unsigned>
+class VoteCounter
+{
+private:
+	std::vector<Count> counts_;
+	std::vector<Id> touched_;
+
+	// Bit i of word w: ID 64 * w + i is in touched_
+	std::vector<std::uint64_t> marks_;
+
+	// Room for IDs [0, end) - Sizes are kept multiples of 64, so every mark word has its 64 counters
+	void Reserve(std::size_t end)
+	{
+		if (end <= counts_.size())
+			return;
+
+		auto size = (std::max(end, 2 * counts_.size()) + 63) & ~std::size_t{ 63 };
+		counts_.resize(size, Count());
+		marks_.resize(size / 64, 0);
+	}
+
+	// Record the IDs base + i of the set bits of fresh as touched
+	void Touch(std::size_t base, std::uint64_t fresh)
+	{
+		while (fresh != 0)
+		{
+			touched_.push_back(static_cast<Id>(base + CountTrailingZeros(fresh)));
+			fresh &= fresh - 1;
+		}
+	}
+
+public:
+	using CountType = Count;
+
+	// Accumulator of the calling thread, reused across queries
+	static VoteCounter& Local()
+	{
+		thread_local VoteCounter counter;
+		counter.Clear();
+		return counter;
+	}
+
+	// Split the votes of a single query over numThreads threads
+	// Items are voted in chunks, every thread accumulates in its own counter
+	// and the partial counts are merged into the counter of the calling thread
+	// The partial counters belong to the calling thread: the thread_local counters of the pool threads
+	// are cleared by any query they run meanwhile, so they can't hold votes past the ParallelFor
+	// vote(first, last, counter): Add the votes of items [first, last) to counter
+	template<typename Vote>
+	static VoteCounter& Parallel(std::size_t items, unsigned numThreads, const Vote& vote)
+	{
+		const std::size_t chunk{ 256 };
+
+		auto& count = Local();
+
+		if (numThreads <= 1 || items <= chunk)
+		{
+			vote(std::size_t{ 0 }, items, count);
+			return count;
+		}
+
+		// Grown once per calling thread, reused across queries
+		thread_local std::vector<VoteCounter> partials;
+		if (partials.size() < numThreads)
+			partials.resize(numThreads);
+
+		// Votes of the previous query, or left over by a vote that threw
+		for (auto& partial : partials)
+		{
+			partial.Clear();
+		}
+
+		// Taken here: partials named in the task would be the (empty) vector of the pool thread
+		auto counters = partials.data();
+
+		ThreadPool::Default().ParallelFor((items + chunk - 1) / chunk, [&](std::size_t c, unsigned worker)
+		{
+			vote(c * chunk, std::min(items, (c + 1) * chunk), counters[worker]);
+		}, numThreads);
+
+		// Merge partial vote tables
+		for (unsigned worker = 0; worker < numThreads; worker++)
+		{
+			for (auto id : counters[worker].Touched())
+			{
+				count.Add(id, counters[worker].Get(id));
+			}
+		}
+
+		return count;
+	}
+
+	// Add votes to a Cloud ID
+	void Add(Id id, Count votes = 1)
+	{
+		if (votes == Count())
+			return;
+
+		auto index = static_cast<std::size_t>(id);
+		Reserve(index + 1);
+
+		if (counts_[index] == Count())
+		{
+			touched_.push_back(id);
+			marks_[index >> 6] |= std::uint64_t{ 1 } << (index & 63);
+		}
+
+		counts_[index] += votes;
+	}
+
+	// Add votes to the IDs base + i for every set bit i of word - base: multiple of 64
+	// IDs touched for the first time are found for the whole word, the counts of full words are added
+	// without branches (vectorized) and the other words scan their set bits
+	void AddWord(Id base, std::uint64_t word, Count votes = 1)
+	{
+		if (votes == Count() || word == 0)
+			return;
+
+		auto index = static_cast<std::size_t>(base);
+		Reserve(index + 64);
+
+		auto& marks = marks_[index >> 6];
+		Touch(index, word & ~marks);
+		marks |= word;
+
+		auto counts = counts_.data() + index;
+
+		if (word == ~std::uint64_t{ 0 })
+		{
+			for (unsigned i = 0; i < 64; i++)
+			{
+				counts[i] += votes;
+			}
+			return;
+		}
+
+		while (word != 0)
+		{
+			counts[CountTrailingZeros(word)] += votes;
+			word &= word - 1;
+		}
+	}
+
+	// Add votes to every Cloud ID in [first, last) - e.g. a run of consecutive IDs
+	// Voted as mask words: full words add to 64 counters at once
+	void AddRange(Id first, Id last, Count votes = 1)
+	{
+		if (votes == Count() || !(first < last))
+			return;
+
+		auto begin = static_cast<std::size_t>(first);
+		auto end = static_cast<std::size_t>(last);
+		Reserve(end);
+
+		for (auto base = begin & ~std::size_t{ 63 }; base < end; base += 64)
+		{
+			auto word = ~std::uint64_t{ 0 };
+			if (begin > base)
+				word &= ~std::uint64_t{ 0 } << (begin - base);
+			if (end < base + 64)
+				word &= ~std::uint64_t{ 0 } >> (base + 64 - end);
+
+			AddWord(static_cast<Id>(base), word, votes);
+		}
+	}
+
+	Count Get(Id id) const
+	{
+		auto index = static_cast<std::size_t>(id);
+		return index < counts_.size() ? counts_[index] : Count();
+	}
+
+	// IDs with at least one vote
+	const std::vector<Id>& Touched() const
+	{
+		return touched_;
+	}
+
+	std::size_t Size() const
+	{
+		return touched_.size();
+	}
+
+	// Get the k IDs with most votes - Only the touched IDs are ranked, in a bounded heap (TopKSelector)
+	// minVotes: IDs with fewer votes are skipped
+	std::vector<std::pair<Id, Count>> TopK(std::size_t k, Count minVotes = Count()) const
+	{
+		thread_local TopKSelector<Id, Count> selector;
+		selector.Reset(k, minVotes);
+
+		// Most IDs are below the worst kept count: rejected without touching the heap
+		auto threshold = selector.Threshold();
+
+		for (auto id : touched_)
+		{
+			auto votes = counts_[static_cast<std::size_t>(id)];
+			if (votes < threshold)
+				continue;
+
+			if (selector.Push(id, votes))
+				threshold = selector.Threshold();
+		}
+
+		return selector.Results();
+	}
+
+	// Get the k IDs with best score - score(id, votes) is evaluated once for every touched ID
+	// e.g. votes normalized by the size of the cloud (CloudScore in Scoring.h)
+	// minScore: IDs scoring less are skipped
+	template<typename Score>
+	std::vector<std::pair<Id, double>> TopK(std::size_t k, const Score& score, double minScore = 0.0) const
+	{
+		thread_local TopKSelector<Id, double> selector;
+		selector.Reset(k, minScore);
+
+		auto threshold = selector.Threshold();
+		for (auto id : touched_)
+		{
+			auto value = static_cast<double>(score(id, static_cast<double>(counts_[static_cast<std::size_t>(id)])));
+			if (value < threshold)
+				continue;
+
+			if (selector.Push(id, value))
+				threshold = selector.Threshold();
+		}
+
+		return selector.Results();
+	}
+
+	// Reset all votes
+	void Clear()
+	{
+		for (auto id : touched_)
+		{
+			counts_[static_cast<std::size_t>(id)] = Count();
+			marks_[static_cast<std::size_t>(id) >> 6] = 0;
+		}
+		touched_.clear();
+	}
+};
+
+// Counter adapter that drops the votes of the IDs for which skip(id) is true - e.g. the removed clouds of an index
+// Passed wherever a VoteCounter is voted (PostingSpan::Vote), skipped IDs never reach the counter
+template<typename Counter, typename Skip>
+class SkipVotes
+{
+private:
+	Counter& count_;
+	const Skip& skip_;
+
+public:
+	SkipVotes(Counter& count, const Skip& skip) :count_(count), skip_(skip) {}
+
+	template<typename Votes>
+	void Add(unsigned id, Votes votes)
+	{
+		if (!skip_(id))
+			count_.Add(id, votes);
+	}
+};
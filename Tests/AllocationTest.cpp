@@ -0,0 +1,92 @@
+#define COUNT_ALLOCATIONS
+#include "AllocationCounter.h"
+#include "IGI.h"
+#include "ShazamHash.h"
+#include "TestUtility.h"
+#include <cstdint>
+#include <new>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Heap allocations of the queries - Posting lists are read in place: a query allocates the same on an index
+// holding every cloud as on an empty one (same cells and fingerprints probed), but the result
+
+const unsigned cmax = 1000;
+const unsigned delta = 10;
+
+// Allocations of query() - Run once before to let the thread local buffers grow
+template<typename Query>
+std::size_t Allocations(const Query& query)
+{
+	query();
+
+	auto before = AllocationCount();
+	query();
+	return AllocationCount() - before;
+}
+
+int main()
+{
+	std::mt19937 random(2);
+	auto clouds = RandomClouds(1000, random);
+	auto queries = RandomClouds(50, random, 5000);
+
+	CHECK(AllocationCountEnabled());
+	auto before = AllocationCount();
+	::operator delete(::operator new(16));
+	CHECK(AllocationCount() == before + 1);
+
+	// Array, nothrow and aligned forms are counted too - Called directly, new expressions may be elided
+	::operator delete[](::operator new[](16));
+	::operator delete(::operator new(16, std::nothrow), std::nothrow);
+	::operator delete[](::operator new[](16, std::nothrow), std::nothrow);
+	CHECK(AllocationCount() == before + 4);
+#if defined(__cpp_aligned_new)
+	const std::align_val_t alignment{ 64 };
+	auto line = ::operator new(100, alignment);
+	CHECK(reinterpret_cast<std::uintptr_t>(line) % 64 == 0);
+	::operator delete(line, alignment);
+	::operator delete[](::operator new[](100, alignment, std::nothrow), alignment, std::nothrow);
+	CHECK(AllocationCount() == before + 6);
+#endif
+
+	// Every thread counts in the same counter
+	before = AllocationCount();
+	std::thread([] { delete new int; }).join();
+	CHECK(AllocationCount() >= before + 1);
+
+	IGI<TestPoint> igi(clouds, "IGI", cmax, delta);
+	igi.Compact();
+	IGI<TestPoint> emptyIgi("Empty", cmax, delta);
+	emptyIgi.Compact();
+
+	ShazamHashParameters parameters(1, 0, 500, 500, 10);
+	ShazamHash<TestPoint> shazam(clouds, "Shazam", parameters);
+	ShazamHash<TestPoint> emptyShazam("Empty", parameters);
+
+	for (const auto& query : queries)
+	{
+		// The result vector is the only allocation of IGI queries
+		CHECK(Allocations([&] { igi.KNN(query, 10); }) <= 1);
+		CHECK(Allocations([&] { igi.KNN(query, 10, Voting::Set, 1); }) <= 1);
+		CHECK(Allocations([&] { igi.KNNScored(query, 10, Scoring::TfIdf); }) <= 1);
+		CHECK(Allocations([&] { emptyIgi.KNN(query, 10); }) == 0);
+
+		// Fingerprints of the query allocate, the lists they hit don't
+		auto full = Allocations([&] { shazam.KNN(query, 10, parameters); });
+		auto empty = Allocations([&] { emptyShazam.KNN(query, 10, parameters); });
+		CHECK(full <= empty + 1);
+	}
+
+	// Allocations of every query in the reports
+	auto report = igi.KNNPerformanceReport(queries, 10, { 1 });
+	CHECK(report.QueriesAllocations.size() == queries.size());
+	CHECK(report.MaxAllocations <= 1);
+
+	auto shazamReport = shazam.KNNPerformanceReport(queries, 10, { 1 }, parameters);
+	CHECK(shazamReport.QueriesAllocations.size() == queries.size());
+	CHECK(shazamReport.MaxAllocations > 0);
+
+	return CheckResult("AllocationTest");
+}
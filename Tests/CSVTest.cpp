@@ -0,0 +1,157 @@
+#include "GetCloudsCSV.h"
+#include "TestUtility.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// CSV reading - ParseCSVNumber must give the value of strtod, and ReadCSV the same clouds with any number of chunks:
+// every point of a cloud in file order across chunk boundaries, bad rows skipped, \r\n lines and no final newline
+
+using Points = std::map<unsigned, std::vector<TestPoint>>;
+
+const char* fileName = "CSVTest.csv";
+const int cmin = 0;
+const int cmax = 1000;
+
+bool Parse(const std::string& text, double& value, std::size_t& length)
+{
+	const char* p = text.data();
+	bool parsed = ParseCSVNumber(p, text.data() + text.size(), value);
+	length = p - text.data();
+	return parsed;
+}
+
+// Number followed by a comma - Same value as strtod, p left on the comma
+void CheckNumber(const std::string& number, double tolerance = 0.0)
+{
+	auto text = number + ",9";
+	double value;
+	std::size_t length;
+	CHECK(Parse(text, value, length));
+	CHECK(length == number.size());
+
+	auto expected = std::strtod(number.c_str(), nullptr);
+	CHECK(tolerance == 0.0 ? value == expected : std::abs(value - expected) <= tolerance * std::abs(expected));
+}
+
+void CheckNumbers()
+{
+	for (const char* number : { "0", "42", "-3.25", "+7", "+0.5", "0.1", ".5", "5.", "123456789.123", "999.999",
+		"1.5e3", "2E-2", "-6.02e+23", "1e-5", "7e22", "  12.5 \t", "0000012" })
+	{
+		CheckNumber(number);
+	}
+
+	// More than 19 digits and exponents out of the exact powers
+	for (const char* number : { "12345678901234567890123", "0.12345678901234567890123", "-98765432109876543210.5",
+		"1.5e40", "3e-30", "+12345678901234567890e-10" })
+	{
+		CheckNumber(number, 1e-15);
+	}
+
+	// Exponent without digits is not part of the number
+	double value;
+	std::size_t length;
+	CHECK(Parse("3e,1", value, length) && value == 3.0 && length == 1);
+	CHECK(Parse("3e+", value, length) && value == 3.0 && length == 1);
+
+	for (const char* text : { "", "+", "-", ".", "-.e5", "abc", " ,1" })
+	{
+		CHECK(!Parse(text, value, length));
+	}
+}
+
+// Rows of random clouds interleaved, so every cloud spreads over every chunk, with bad rows in between
+// Returns the points expected for every cloud, in file order
+Points WriteCSV(std::mt19937& random, unsigned numRows)
+{
+	std::uniform_int_distribution<unsigned> coordinate(0, 1000000);
+	std::ofstream out(fileName, std::ios::binary);
+	out << "ID,X,Y\n";
+
+	Points expected;
+	char line[128];
+	for (unsigned i = 0; i < numRows; i++)
+	{
+		auto id = static_cast<unsigned>(random() % 500);
+		auto x = coordinate(random) / 1000.0;
+		auto y = coordinate(random) / 1000.0;
+		std::snprintf(line, sizeof(line), "%u,%.3f,%.3f", id, x, y);
+		expected[id].push_back(TestPoint(std::strtod(std::strchr(line, ',') + 1, nullptr), std::strtod(std::strrchr(line, ',') + 1, nullptr)));
+		out << line;
+
+		switch (random() % 8)
+		{
+		case 0:
+			out << "\r\n";
+			break;
+		case 1:
+			out << ",extra column\n";
+			break;
+		case 2:
+			out << "\n" << id << ",1001,5\n";
+			break;
+		case 3:
+			out << "\n-1,5,5\n" << id << ",5\n";
+			break;
+		case 4:
+			out << "\nnot,a,row\n\n";
+			break;
+		default:
+			out << "\n";
+		}
+	}
+
+	// Last row without a newline
+	out << "7,1.5,2.5";
+	expected[7].push_back(TestPoint(1.5f, 2.5f));
+
+	return expected;
+}
+
+void CheckReadCSV(const Points& expected, unsigned numThreads)
+{
+	auto clouds = ReadCSV<TestPoint>(fileName, cmin, cmax, true, numThreads);
+	CHECK(clouds.size() == expected.size());
+
+	std::size_t wrong{ 0 };
+	for (const auto& cloud : clouds)
+	{
+		auto it = expected.find(cloud.ID);
+		if (it == std::end(expected) || it->second.size() != cloud.Points.size())
+		{
+			wrong++;
+			continue;
+		}
+
+		for (std::size_t i = 0; i < cloud.Points.size(); i++)
+		{
+			wrong += boost::geometry::get<0>(cloud.Points[i]) != boost::geometry::get<0>(it->second[i]) ||
+				boost::geometry::get<1>(cloud.Points[i]) != boost::geometry::get<1>(it->second[i]);
+		}
+	}
+	CHECK(wrong == 0);
+}
+
+int main()
+{
+	CheckNumbers();
+
+	// Several MB: split in chunks of at least 1 MB
+	std::mt19937 random(8);
+	auto expected = WriteCSV(random, 300000);
+	for (unsigned numThreads : { 1u, 2u, 3u, 4u, 7u })
+	{
+		CheckReadCSV(expected, numThreads);
+	}
+
+	std::remove(fileName);
+	CHECK(ReadCSV<TestPoint>(fileName, cmin, cmax, true, 4).empty());
+
+	return CheckResult("CSVTest");
+}
@@ -0,0 +1,186 @@
+#include "CloudFile.h"
+#include "TestUtility.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// WriteClouds and CloudSet - A mapped file must give back the IDs and points written, in order, also when it is
+// written from a CloudSet or converted from a CSV file. Damaged cloud tables, truncated files and flipped bits
+// (with verify) must be rejected
+
+const char* fileName = "CloudFileTest.clouds";
+const char* copyName = "CloudFileTest.copy.clouds";
+const char* damagedName = "CloudFileTest.damaged.clouds";
+const char* csvName = "CloudFileTest.csv";
+
+std::vector<char> ReadBytes(const char* name)
+{
+	std::ifstream in(name, std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void WriteBytes(const char* name, const std::vector<char>& bytes)
+{
+	std::ofstream out(name, std::ios::binary);
+	out.write(bytes.data(), bytes.size());
+}
+
+template<typename Points>
+bool SamePoints(const Points& points, const std::vector<TestPoint>& expected)
+{
+	if (points.size() != expected.size())
+		return false;
+
+	std::size_t i{ 0 };
+	for (const auto& point : points)
+	{
+		if (boost::geometry::get<0>(point) != boost::geometry::get<0>(expected[i]) || boost::geometry::get<1>(point) != boost::geometry::get<1>(expected[i]))
+			return false;
+		i++;
+	}
+	return true;
+}
+
+void CheckSame(const CloudSet<TestPoint>& set, const std::vector<Cloud<TestPoint>>& clouds)
+{
+	CHECK(set.size() == clouds.size());
+	CHECK(set.empty() == clouds.empty());
+
+	std::size_t numPoints{ 0 };
+	std::size_t wrong{ 0 };
+	for (std::size_t i = 0; i < clouds.size() && i < set.size(); i++)
+	{
+		numPoints += clouds[i].Points.size();
+		auto view = set[i];
+		wrong += view.ID != clouds[i].ID || !SamePoints(view.Points, clouds[i].Points);
+
+		// Random access to the points
+		for (std::size_t j = 0; j < clouds[i].Points.size(); j++)
+		{
+			wrong += boost::geometry::get<0>(view.Points[j]) != boost::geometry::get<0>(clouds[i].Points[j]);
+			wrong += boost::geometry::get<1>(*(std::begin(view.Points) + j)) != boost::geometry::get<1>(clouds[i].Points[j]);
+		}
+	}
+	CHECK(wrong == 0);
+	CHECK(set.NumPoints() == numPoints);
+
+	// Iteration and copies
+	std::size_t i{ 0 };
+	for (const auto& view : set)
+	{
+		CHECK(i < clouds.size() && view.ID == clouds[i].ID);
+		i++;
+	}
+	CHECK(std::end(set) - std::begin(set) == static_cast<std::ptrdiff_t>(clouds.size()));
+
+	auto copies = set.ToClouds();
+	CHECK(copies.size() == clouds.size());
+	for (std::size_t j = 0; j < copies.size() && j < clouds.size(); j++)
+	{
+		CHECK(copies[j].ID == clouds[j].ID && SamePoints(copies[j].Points, clouds[j].Points));
+	}
+}
+
+void CheckDamaged(const std::vector<Cloud<TestPoint>>& clouds)
+{
+	WriteClouds(fileName, clouds);
+	auto bytes = ReadBytes(fileName);
+
+	// Cloud table right after the 64 byte header
+	const std::size_t table{ sizeof(IndexFileHeader) };
+	std::size_t last = table + (clouds.size() - 1) * sizeof(CloudFileEntry);
+
+	// Points past the end of the columns
+	auto damaged = bytes;
+	std::uint32_t numPoints = static_cast<std::uint32_t>(clouds.back().Points.size() + 1);
+	std::memcpy(damaged.data() + last + offsetof(CloudFileEntry, NumPoints), &numPoints, sizeof(numPoints));
+	WriteBytes(damagedName, damaged);
+	CHECK_THROWS(CloudSet<TestPoint>{ damagedName }, std::runtime_error);
+
+	// Offset past the end, and one that would wrap around with the points added
+	for (auto offset : { std::uint64_t{ 1 } << 40, ~std::uint64_t{ 0 } - 5 })
+	{
+		damaged = bytes;
+		std::memcpy(damaged.data() + last + offsetof(CloudFileEntry, Offset), &offset, sizeof(offset));
+		WriteBytes(damagedName, damaged);
+		CHECK_THROWS(CloudSet<TestPoint>{ damagedName }, std::runtime_error);
+	}
+
+	// Truncated
+	damaged.assign(std::begin(bytes), std::end(bytes) - 16);
+	WriteBytes(damagedName, damaged);
+	CHECK_THROWS(CloudSet<TestPoint>{ damagedName }, std::runtime_error);
+
+	// Flipped bit in a coordinate - Found by the checksum only
+	damaged = bytes;
+	damaged[table + clouds.size() * sizeof(CloudFileEntry) + 2] ^= 0x10;
+	WriteBytes(damagedName, damaged);
+	CHECK_THROWS(CloudSet<TestPoint>(damagedName, true), std::runtime_error);
+	CHECK(CloudSet<TestPoint>(damagedName).size() == clouds.size());
+
+	CHECK_THROWS(CloudSet<TestPoint>{ "CloudFileTest.missing.clouds" }, std::runtime_error);
+}
+
+void CheckCSV(const std::vector<Cloud<TestPoint>>& clouds)
+{
+	{
+		std::ofstream out(csvName);
+		out << "ID,X,Y\n";
+		for (const auto& cloud : clouds)
+		{
+			for (const auto& point : cloud.Points)
+			{
+				out << cloud.ID << ',' << boost::geometry::get<0>(point) << ',' << boost::geometry::get<1>(point) << '\n';
+			}
+		}
+	}
+
+	CHECK(ConvertCSVToClouds(csvName, fileName, 0, 1000, true) == clouds.size());
+
+	// ReadCSV gives the clouds in no particular order
+	CloudSet<TestPoint> set(fileName);
+	CHECK(set.size() == clouds.size());
+	std::size_t wrong{ 0 };
+	for (const auto& view : set)
+	{
+		wrong += view.ID >= clouds.size() || !SamePoints(view.Points, clouds[view.ID].Points);
+	}
+	CHECK(wrong == 0);
+}
+
+int main()
+{
+	std::mt19937 random(9);
+	auto clouds = RandomClouds(300, random, 50);
+	clouds.emplace_back(1000);
+	clouds.push_back(RandomCloud(7, random));
+
+	WriteClouds(fileName, clouds);
+	CloudSet<TestPoint> set(fileName, true);
+	CheckSame(set, clouds);
+
+	// Written again from the mapping
+	WriteClouds(copyName, set);
+	CheckSame(CloudSet<TestPoint>(copyName, true), clouds);
+	CHECK(ReadBytes(copyName) == ReadBytes(fileName));
+
+	WriteClouds(copyName, std::vector<Cloud<TestPoint>>());
+	CheckSame(CloudSet<TestPoint>(copyName, true), std::vector<Cloud<TestPoint>>());
+
+	CheckDamaged(clouds);
+	CheckCSV(RandomClouds(100, random));
+
+	std::remove(fileName);
+	std::remove(copyName);
+	std::remove(damagedName);
+	std::remove(csvName);
+
+	return CheckResult("CloudFileTest");
+}
@@ -0,0 +1,63 @@
+#include "TestUtility.h"
+#include "CompressedIGI.h"
+#include "IGI.h"
+#include <thread>
+
+// CompressedIGI: results equal to IGI with Set voting, concurrent queries with per-thread codecs, codec names
+// Needs SIMDCompressionLib - Run under -fsanitize=thread to check that threads share no codec
+
+int main()
+{
+	std::mt19937 random(12);
+	auto clouds = RandomClouds(3000, random);
+	auto queries = RandomClouds(200, random, 100000);
+
+	IGI<TestPoint> igi(clouds, "IGI", 1000, 10);
+	igi.Compact();
+
+	for (const auto codec : { "s4-fastpfor-d1", "s4-bp128-d4" })
+	{
+		CompressedIGI<TestPoint> compressed(clouds, "CompressedIGI", 1000, 10, codec);
+
+		// One vote per cloud in a cell, as IGI with Set voting
+		for (const auto& query : queries)
+		{
+			CHECK(compressed.KNN(query, 20) == igi.KNN(query, 20, Voting::Set));
+		}
+
+		// Every worker decodes with its own codec
+		auto batch = compressed.KNNBatch(queries, 20, 4);
+		for (std::size_t i = 0; i < queries.size(); i++)
+		{
+			CHECK(batch[i] == compressed.KNN(queries[i], 20));
+		}
+
+		// Concurrent KNN calls from threads of the caller
+		std::vector<std::vector<std::vector<std::pair<unsigned, unsigned>>>> concurrent(4, std::vector<std::vector<std::pair<unsigned, unsigned>>>(queries.size()));
+		std::vector<std::thread> threads;
+		for (std::size_t t = 0; t < concurrent.size(); t++)
+		{
+			threads.emplace_back([&, t]
+			{
+				for (std::size_t i = 0; i < queries.size(); i++)
+				{
+					concurrent[t][i] = compressed.KNN(queries[i], 20);
+				}
+			});
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+		for (const auto& results : concurrent)
+		{
+			CHECK(results == batch);
+		}
+	}
+
+	// Unknown names are rejected instead of falling back to "copy", which has no differential coding either
+	CHECK_THROWS(CompressedIGI<TestPoint>("CompressedIGI", 1000, 10, "no-such-codec"), std::invalid_argument);
+	CHECK_THROWS(CompressedIGI<TestPoint>("CompressedIGI", 1000, 10, "copy"), std::invalid_argument);
+
+	return CheckResult("CompressedIGITest");
+}
@@ -0,0 +1,167 @@
+#include "GridQuantizer.h"
+#include "CloudFile.h"
+#include "TestUtility.h"
+#include <boost/geometry.hpp>
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <random>
+#include <vector>
+
+// GridQuantizer - Every entry point must return floor(x / delta) + (cmax / delta) * floor(y / delta) exactly,
+// on cell borders and just below them too. The kernel is chosen at compile time: build with -mavx2 and
+// with -msse4.1 as well to check every one. Double points are not rounded to float: a double right below a
+// cell border stays in its cell
+
+using DoublePoint = boost::geometry::model::point<double, 2, boost::geometry::cs::cartesian>;
+
+// Floor division computed in double - Products of integers by delta are exact, so the correction is exact
+unsigned ExactAxis(double v, unsigned delta)
+{
+	auto q = std::floor(v / delta);
+	if (q * delta > v)
+		q -= 1.0;
+	if ((q + 1.0) * delta <= v)
+		q += 1.0;
+	return static_cast<unsigned>(q);
+}
+
+unsigned ExactCell(double x, double y, unsigned cmax, unsigned delta)
+{
+	return ExactAxis(x, delta) + (cmax / delta) * ExactAxis(y, delta);
+}
+
+// Random coordinates, cell borders and the floats right below them
+std::vector<float> Coordinates(unsigned cmax, unsigned delta, std::mt19937& random)
+{
+	std::vector<float> values;
+	std::uniform_real_distribution<float> uniform(0.0f, static_cast<float>(cmax));
+	for (unsigned i = 0; i < 2000; i++)
+	{
+		values.push_back(uniform(random));
+	}
+
+	for (unsigned border = 0; border < cmax; border += delta)
+	{
+		values.push_back(static_cast<float>(border));
+		if (border > 0)
+			values.push_back(std::nextafter(static_cast<float>(border), 0.0f));
+	}
+
+	std::shuffle(std::begin(values), std::end(values), random);
+	return values;
+}
+
+// Doubles right below the cell borders, rounded up to the border as floats
+void CheckDoubleBorders(unsigned cmax, unsigned delta)
+{
+	GridQuantizer grid(cmax, delta);
+
+	std::vector<DoublePoint> points;
+	std::deque<DoublePoint> sequence;
+	std::vector<unsigned> expected;
+	for (unsigned border = delta; border < cmax; border += delta)
+	{
+		auto below = std::nextafter(static_cast<double>(border), 0.0);
+		CHECK(static_cast<float>(below) == static_cast<float>(border));
+
+		for (const auto& point : { DoublePoint(below, border), DoublePoint(border, below), DoublePoint(below - 1e-7, below) })
+		{
+			points.push_back(point);
+			sequence.push_back(point);
+			expected.push_back(ExactCell(boost::geometry::get<0>(point), boost::geometry::get<1>(point), cmax, delta));
+		}
+	}
+
+	std::size_t wrong{ 0 };
+	for (std::size_t i = 0; i < points.size(); i++)
+	{
+		wrong += grid.Cell(points[i]) != expected[i];
+	}
+	CHECK(wrong == 0);
+
+	std::vector<unsigned> cells;
+	grid.Cells(points, cells);
+	CHECK(cells == expected);
+
+	grid.Cells(sequence, cells);
+	CHECK(cells == expected);
+}
+
+void CheckGrid(unsigned cmax, unsigned delta, std::mt19937& random)
+{
+	GridQuantizer grid(cmax, delta);
+	CHECK(grid.CellsPerRow() == cmax / delta);
+
+	auto xs = Coordinates(cmax, delta, random);
+	auto ys = xs;
+	std::shuffle(std::begin(ys), std::end(ys), random);
+
+	// Odd count: the scalar tail follows the vector blocks
+	auto n = xs.size() | 1;
+	xs.resize(n, 0.0f);
+	ys.resize(n, 0.0f);
+
+	std::vector<unsigned> expected(n);
+	std::vector<float> interleaved;
+	std::vector<TestPoint> points;
+	std::vector<DoublePoint> doublePoints;
+	std::deque<TestPoint> sequence;
+	for (std::size_t i = 0; i < n; i++)
+	{
+		expected[i] = ExactCell(xs[i], ys[i], cmax, delta);
+		interleaved.push_back(xs[i]);
+		interleaved.push_back(ys[i]);
+		points.emplace_back(xs[i], ys[i]);
+		doublePoints.emplace_back(xs[i], ys[i]);
+		sequence.emplace_back(xs[i], ys[i]);
+	}
+
+	std::size_t wrong{ 0 };
+	for (std::size_t i = 0; i < n; i++)
+	{
+		wrong += grid.Cell(xs[i], ys[i]) != expected[i];
+		wrong += grid.Cell(points[i]) != expected[i];
+	}
+	CHECK(wrong == 0);
+
+	std::vector<unsigned> cells(n);
+	grid.Cells(xs.data(), ys.data(), n, cells.data());
+	CHECK(cells == expected);
+
+	std::fill(std::begin(cells), std::end(cells), 0);
+	grid.CellsInterleaved(interleaved.data(), n, cells.data());
+	CHECK(cells == expected);
+
+	// Float points read in place, double points and other sequences gathered in blocks
+	grid.Cells(points, cells);
+	CHECK(cells == expected);
+
+	grid.Cells(doublePoints, cells);
+	CHECK(cells == expected);
+
+	grid.Cells(sequence, cells);
+	CHECK(cells == expected);
+
+	// x and y columns of a CloudSet
+	grid.Cells(CloudPoints<TestPoint>(xs.data(), ys.data(), n), cells);
+	CHECK(cells == expected);
+}
+
+int main()
+{
+	std::mt19937 random(16);
+
+	CheckGrid(1000, 1, random);
+	CheckGrid(1000, 3, random);
+	CheckGrid(1000, 10, random);
+	CheckGrid(1000, 250, random);
+	CheckGrid(20000, 7, random);
+	CheckGrid(100000, 100, random);
+
+	CheckDoubleBorders(1000, 3);
+	CheckDoubleBorders(1000, 10);
+	CheckDoubleBorders(100000, 100);
+
+	return CheckResult("GridQuantizerTest");
+}
@@ -0,0 +1,64 @@
+#include "TestUtility.h"
+#include "IGIRtree.h"
+#include "IGI.h"
+#include <cmath>
+
+// IGIRtree TfIdf scoring: cell frequencies count distinct clouds, whatever the number of Finalize calls
+// and of Adds per cloud - internalK covers whole cells, so the votes equal those of IGI with Points voting
+
+bool SameScores(const std::vector<std::pair<unsigned, double>>& left, const std::vector<std::pair<unsigned, double>>& right)
+{
+	if (left.size() != right.size())
+		return false;
+
+	for (std::size_t i = 0; i < left.size(); i++)
+	{
+		if (std::abs(left[i].second - right[i].second) > 1e-9 * std::max(1.0, std::abs(right[i].second)))
+			return false;
+	}
+	return true;
+}
+
+int main()
+{
+	std::mt19937 random(19);
+	auto clouds = RandomClouds(600, random);
+	auto queries = RandomClouds(100, random, 100000);
+	const unsigned internalK = 100000;
+
+	// Whole clouds in a single Finalize
+	IGIRtree<TestPoint> once(clouds, "IGIRtree", 1000, 100);
+
+	// Three Finalize rounds, cloud 7 added in halves by two rounds
+	IGIRtree<TestPoint> rounds("IGIRtree", 1000, 100);
+	Cloud<TestPoint> first(7), second(7);
+	first.Points.assign(clouds[7].Points.begin(), clouds[7].Points.begin() + clouds[7].Points.size() / 2);
+	second.Points.assign(clouds[7].Points.begin() + clouds[7].Points.size() / 2, clouds[7].Points.end());
+
+	for (unsigned round = 0; round < 3; round++)
+	{
+		for (std::size_t i = round; i < clouds.size(); i += 3)
+		{
+			if (i != 7)
+				rounds.Add(clouds[i]);
+		}
+		if (round == 0)
+			rounds.Add(first);
+		if (round == 2)
+			rounds.Add(second);
+		rounds.Finalize();
+	}
+
+	// Exact cell frequencies: weighted postings count every cloud once per cell
+	IGI<TestPoint> igi(clouds, "IGI", 1000, 100);
+	igi.Compact(true);
+
+	for (const auto& query : queries)
+	{
+		auto expected = igi.KNNScored(query, 10, Scoring::TfIdf);
+		CHECK(SameScores(once.KNNScored(query, 10, internalK, Scoring::TfIdf), expected));
+		CHECK(SameScores(rounds.KNNScored(query, 10, internalK, Scoring::TfIdf), expected));
+	}
+
+	return CheckResult("IGIRtreeTest");
+}
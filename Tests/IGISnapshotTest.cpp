@@ -0,0 +1,173 @@
+#include "IGI.h"
+#include "TestUtility.h"
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+// IGI snapshots - Queries running during Add, Replace, Publish and background compactions see every published
+// batch whole or not at all. Meant to run with -fsanitize=thread as well
+
+const unsigned cmax = 1000;
+const unsigned delta = 20;
+const unsigned cellsPerRow = cmax / delta;
+const unsigned batchSize = 10;
+const unsigned numBatches = 200;
+
+// Point in the middle of a grid cell - Every batch lives in a cell of its own
+TestPoint CellPoint(unsigned cell)
+{
+	return TestPoint(static_cast<float>(cell % cellsPerRow * delta + delta / 2), static_cast<float>(cell / cellsPerRow * delta + delta / 2));
+}
+
+Cloud<TestPoint> CellCloud(unsigned id, unsigned cell)
+{
+	Cloud<TestPoint> cloud(id);
+	cloud.Add(CellPoint(cell));
+	cloud.Add(CellPoint(cell));
+	return cloud;
+}
+
+// Cell of a batch before and after its Replace
+unsigned FirstCell(unsigned batch) { return batch; }
+unsigned MovedCell(unsigned batch) { return cellsPerRow * cellsPerRow - 1 - batch; }
+
+// Query in a cell must find all the clouds of its batch or none, each with a vote per query point
+bool WholeBatch(const IGI<TestPoint>& igi, unsigned batch, unsigned cell)
+{
+	auto result = igi.KNN(CellCloud(0, cell), batchSize + 5, Voting::Set);
+	if (result.empty())
+		return true;
+
+	if (result.size() != batchSize)
+		return false;
+
+	for (unsigned i = 0; i < batchSize; i++)
+	{
+		if (result[i].first != batch * batchSize + i || result[i].second != 2)
+			return false;
+	}
+	return true;
+}
+
+void CheckConcurrentQueries()
+{
+	IGI<TestPoint> igi("IGI", cmax, delta);
+	igi.Compact();
+	igi.SetSegments(0, 4);
+
+	std::atomic<bool> done{ false };
+	std::atomic<unsigned> published{ 0 };
+	std::atomic<unsigned> broken{ 0 };
+	std::atomic<std::size_t> queries{ 0 };
+
+	std::vector<std::thread> readers;
+	for (unsigned r = 0; r < 3; r++)
+	{
+		readers.emplace_back([&, r]
+		{
+			std::mt19937 random(r);
+			while (!done)
+			{
+				auto batch = random() % numBatches;
+				if (!WholeBatch(igi, batch, FirstCell(batch)) || !WholeBatch(igi, batch, MovedCell(batch)))
+					broken++;
+
+				// A published batch is never lost again
+				if (batch < published && igi.KNN(CellCloud(0, FirstCell(batch)), 1, Voting::Set).empty() && igi.KNN(CellCloud(0, MovedCell(batch)), 1, Voting::Set).empty())
+					broken++;
+
+				queries++;
+			}
+		});
+	}
+
+	// Writer: a batch per Publish, every third batch moves the one added two Publish before with Replace
+	for (unsigned batch = 0; batch < numBatches; batch++)
+	{
+		for (unsigned i = 0; i < batchSize; i++)
+		{
+			igi.Add(CellCloud(batch * batchSize + i, FirstCell(batch)));
+		}
+
+		if (batch % 3 == 2)
+		{
+			auto moved = batch - 2;
+			for (unsigned i = 0; i < batchSize; i++)
+			{
+				igi.Replace(CellCloud(moved * batchSize + i, MovedCell(moved)));
+			}
+		}
+
+		igi.Publish();
+		published = batch + 1;
+	}
+
+	igi.WaitCompaction();
+	done = true;
+	for (auto& reader : readers)
+	{
+		reader.join();
+	}
+
+	CHECK(broken == 0);
+	CHECK(queries > 0);
+
+	for (unsigned batch = 0; batch < numBatches; batch++)
+	{
+		bool moved = batch % 3 == 0 && batch / 3 * 3 + 2 < numBatches;
+		CHECK(igi.KNN(CellCloud(0, moved ? MovedCell(batch) : FirstCell(batch)), batchSize, Voting::Set).size() == batchSize);
+		CHECK(igi.KNN(CellCloud(0, moved ? FirstCell(batch) : MovedCell(batch)), batchSize, Voting::Set).empty());
+	}
+}
+
+// Segments store the cells they have, not the whole grid
+void CheckSparseSegments()
+{
+	IGI<TestPoint> igi("IGI", 20000, 10);
+	igi.Add(CellCloud(1, 0));
+	igi.Compact();
+	auto baseBytes = igi.SizeInBytes();
+
+	// Last cell of a 2000 x 2000 grid - Dense offsets would take 32 MB
+	Cloud<TestPoint> corner(2);
+	corner.Add(TestPoint(19999.0f, 19999.0f));
+	igi.Add(corner).Publish();
+
+	CHECK(igi.NumLayers() == 2);
+	CHECK(igi.SizeInBytes() - baseBytes < 1024);
+	CHECK(igi.KNN(corner, 1).size() == 1 && igi.KNN(corner, 1)[0].first == 2);
+}
+
+// Moving an index waits for its background compaction
+void CheckMove()
+{
+	std::mt19937 random(23);
+	auto clouds = RandomClouds(2000, random);
+
+	IGI<TestPoint> igi("IGI", cmax, delta);
+	igi.AddRange(std::begin(clouds), std::begin(clouds) + 1000).Compact();
+	igi.SetSegments(0, 0);
+
+	igi.AddRange(std::begin(clouds) + 1000, std::end(clouds)).Publish();
+	auto moved = std::move(igi);
+	moved.WaitCompaction();
+
+	IGI<TestPoint> reference(clouds, "Reference", cmax, delta);
+	reference.Compact();
+
+	CHECK(moved.IsCompacted());
+	for (std::size_t i = 0; i < clouds.size(); i += 100)
+	{
+		CHECK(moved.KNN(clouds[i], 10) == reference.KNN(clouds[i], 10));
+	}
+}
+
+int main()
+{
+	CheckConcurrentQueries();
+	CheckSparseSegments();
+	CheckMove();
+
+	return CheckResult("IGISnapshotTest");
+}
@@ -0,0 +1,184 @@
+#include "IGI.h"
+#include "TestUtility.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <vector>
+
+// IGI Remove, Replace and compaction - Results must equal an index built from scratch with the clouds left
+// Jaccard scores must be the intersection of the cells of the query and the cloud (as multisets) over their union
+
+using Clouds = std::map<unsigned, Cloud<TestPoint>>;
+
+const unsigned cmax = 1000;
+const unsigned delta = 20;
+
+IGI<TestPoint> Reference(const Clouds& clouds)
+{
+	IGI<TestPoint> igi("Reference", cmax, delta);
+	for (const auto& pair : clouds)
+	{
+		igi.Add(pair.second);
+	}
+	igi.Compact();
+	return igi;
+}
+
+// Points of a cloud in every cell
+std::map<unsigned, unsigned> CellCounts(const Cloud<TestPoint>& cloud)
+{
+	GridQuantizer grid(cmax, delta);
+	std::map<unsigned, unsigned> counts;
+	for (const auto& point : cloud.Points)
+	{
+		counts[grid.Cell(point)]++;
+	}
+	return counts;
+}
+
+double Jaccard(const Cloud<TestPoint>& query, const Cloud<TestPoint>& cloud)
+{
+	auto cloudCounts = CellCounts(cloud);
+	double intersection{ 0.0 };
+	for (const auto& pair : CellCounts(query))
+	{
+		auto it = cloudCounts.find(pair.first);
+		if (it != std::end(cloudCounts))
+			intersection += std::min(pair.second, it->second);
+	}
+	return intersection / (query.Points.size() + cloud.Points.size() - intersection);
+}
+
+// Jaccard scores of KNNScored, and the best one found
+void CheckJaccard(const IGI<TestPoint>& igi, const Clouds& clouds, const Cloud<TestPoint>& query)
+{
+	double best{ 0.0 };
+	for (const auto& pair : clouds)
+	{
+		best = std::max(best, Jaccard(query, pair.second));
+	}
+
+	for (auto voting : { Voting::Points, Voting::Set })
+	{
+		auto result = igi.KNNScored(query, 10, Scoring::Jaccard, voting);
+		CHECK(!result.empty() || best == 0.0);
+		if (!result.empty())
+			CHECK(std::abs(result[0].second - best) < 1e-9);
+
+		for (const auto& pair : result)
+		{
+			auto cloud = clouds.find(pair.first);
+			CHECK(cloud != std::end(clouds) && std::abs(pair.second - Jaccard(query, cloud->second)) < 1e-9);
+		}
+	}
+}
+
+// Same KNN results as the reference for every voting
+void CheckSame(const IGI<TestPoint>& igi, const Clouds& clouds, const std::vector<Cloud<TestPoint>>& queries)
+{
+	auto reference = Reference(clouds);
+	for (const auto& query : queries)
+	{
+		CHECK(igi.KNN(query, 10, Voting::Points) == reference.KNN(query, 10, Voting::Points));
+		CHECK(igi.KNN(query, 10, Voting::Set) == reference.KNN(query, 10, Voting::Set));
+		CheckJaccard(igi, clouds, query);
+	}
+}
+
+int main()
+{
+	std::mt19937 random(22);
+
+	Clouds clouds;
+	for (auto& cloud : RandomClouds(300, random))
+	{
+		clouds.emplace(cloud.ID, cloud);
+	}
+
+	IGI<TestPoint> igi("IGI", cmax, delta);
+	igi.SetAutoCompaction(false);
+	for (const auto& pair : clouds)
+	{
+		igi.Add(pair.second);
+	}
+	igi.Compact();
+	CHECK(igi.IsCompacted());
+
+	// Queries: clouds of the index, removed and replaced ones included, and random clouds
+	std::vector<Cloud<TestPoint>> queries;
+	for (unsigned id = 0; id < 40; id++)
+	{
+		queries.push_back(clouds.at(id));
+	}
+	for (auto& cloud : RandomClouds(20, random, 1000))
+	{
+		queries.push_back(cloud);
+	}
+
+	// Remove and Replace are not visible before Publish
+	auto before = clouds;
+	for (unsigned id = 0; id < 20; id += 2)
+	{
+		CHECK(igi.Remove(id));
+		clouds.erase(id);
+	}
+	for (unsigned id = 1; id < 20; id += 2)
+	{
+		auto cloud = RandomCloud(id, random);
+		CHECK(igi.Replace(cloud));
+		clouds.at(id) = cloud;
+	}
+	CHECK(!igi.Remove(0));
+	CHECK(!igi.Remove(5000));
+	CheckSame(igi, before, queries);
+
+	igi.Publish();
+	CheckSame(igi, clouds, queries);
+	CHECK(!igi.IsCompacted());
+	CHECK(igi.GarbageRatio() > 0.0);
+
+	igi.Compact();
+	CheckSame(igi, clouds, queries);
+	CHECK(igi.IsCompacted());
+	CHECK(igi.GarbageRatio() == 0.0);
+
+	// Remove only: no segment is published, the compaction must still cover the tombstones
+	// and the next one have nothing to do
+	CHECK(igi.Remove(100));
+	clouds.erase(100);
+	igi.Publish();
+	CHECK(igi.NumLayers() == 1);
+	CHECK(!igi.IsCompacted());
+	CheckSame(igi, clouds, queries);
+
+	igi.Compact();
+	CHECK(igi.IsCompacted());
+	CHECK(igi.NumLayers() == 1);
+	igi.Compact();
+	CHECK(igi.IsCompacted());
+	CHECK(igi.NumLayers() == 1);
+	CheckSame(igi, clouds, queries);
+
+	// A removal after that compaction is still skipped in the base
+	CHECK(igi.Remove(101));
+	clouds.erase(101);
+	igi.Publish();
+	CheckSame(igi, clouds, queries);
+
+	// A cloud removed by a remove-only publish comes back alive in the next segment
+	CHECK(igi.Remove(102));
+	igi.Publish();
+	auto back = RandomCloud(102, random);
+	CHECK(!igi.Replace(back));
+	clouds.at(102) = back;
+	igi.Publish();
+	CHECK(igi.NumLayers() == 2);
+	CheckSame(igi, clouds, queries);
+
+	igi.Compact();
+	CHECK(igi.IsCompacted());
+	CheckSame(igi, clouds, queries);
+
+	return CheckResult("IGITest");
+}
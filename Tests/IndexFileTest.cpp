@@ -0,0 +1,176 @@
+#include "IGI.h"
+#include "SuccinctIGI.h"
+#include "TestUtility.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Save and Open - Indexes opened from a file must answer as the saved ones, and damaged files
+// (cell offsets out of order or out of range, truncated, flipped bits with verify) must be rejected
+
+const unsigned cmax = 1000;
+const unsigned delta = 10;
+
+const char* fileName = "IndexFileTest.idx";
+const char* damagedName = "IndexFileTest.damaged.idx";
+
+std::vector<char> ReadBytes(const char* name)
+{
+	std::ifstream in(name, std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void WriteBytes(const char* name, const std::vector<char>& bytes)
+{
+	std::ofstream out(name, std::ios::binary);
+	out.write(bytes.data(), bytes.size());
+}
+
+template<typename V>
+V Get(const std::vector<char>& bytes, std::size_t position)
+{
+	V value;
+	std::memcpy(&value, bytes.data() + position, sizeof(V));
+	return value;
+}
+
+template<typename V>
+void Set(std::vector<char>& bytes, std::size_t position, V value)
+{
+	std::memcpy(bytes.data() + position, &value, sizeof(V));
+}
+
+template<typename Index>
+void CheckSame(const Index& index, const Index& opened, const std::vector<Cloud<TestPoint>>& queries)
+{
+	for (const auto& query : queries)
+	{
+		CHECK(opened.KNN(query, 20) == index.KNN(query, 20));
+	}
+}
+
+void CheckIGI(const std::vector<Cloud<TestPoint>>& clouds, const std::vector<Cloud<TestPoint>>& queries)
+{
+	for (auto weighted : { false, true })
+	{
+		IGI<TestPoint> igi(clouds, "IGI", cmax, delta);
+		igi.Compact(weighted);
+		igi.Save(fileName);
+
+		auto opened = IGI<TestPoint>::Open(fileName, "Opened", true);
+		CHECK(opened.IsCompacted());
+		CHECK(opened.SizeInBytes() == igi.SizeInBytes());
+		CheckSame(igi, opened, queries);
+		for (const auto& query : queries)
+		{
+			CHECK(opened.KNN(query, 20, Voting::Set) == igi.KNN(query, 20, Voting::Set));
+		}
+	}
+
+	// Layers and removed clouds are merged on the fly
+	IGI<TestPoint> igi("IGI", cmax, delta);
+	igi.SetAutoCompaction(false);
+	igi.AddRange(std::begin(clouds), std::begin(clouds) + 500).Compact();
+	igi.AddRange(std::begin(clouds) + 500, std::end(clouds));
+	for (unsigned id = 0; id < clouds.size(); id += 7)
+	{
+		igi.Remove(id);
+	}
+	igi.Publish();
+	CHECK(igi.NumLayers() == 2);
+
+	igi.Save(fileName);
+	CheckSame(igi, IGI<TestPoint>::Open(fileName, "Opened"), queries);
+}
+
+// Offsets section right after the 64 byte header: numCells + 1 offsets
+void CheckDamagedIGI(const std::vector<Cloud<TestPoint>>& clouds)
+{
+	IGI<TestPoint> igi(clouds, "IGI", cmax, delta);
+	igi.Compact();
+	igi.Save(fileName);
+
+	auto bytes = ReadBytes(fileName);
+	const std::size_t header{ sizeof(IndexFileHeader) };
+	auto numCells = Get<std::uint64_t>(bytes, offsetof(IndexFileHeader, NumCells));
+	auto numPostings = Get<std::uint64_t>(bytes, offsetof(IndexFileHeader, NumPostings));
+
+	// First cell with postings - Its end offset moved before its start
+	std::size_t cell{ 0 };
+	while (cell < numCells && Get<std::uint64_t>(bytes, header + 8 * (cell + 1)) == 0)
+	{
+		cell++;
+	}
+	CHECK(cell + 1 < numCells);
+
+	auto damaged = bytes;
+	Set<std::uint64_t>(damaged, header + 8 * (cell + 1), 0);
+	Set<std::uint64_t>(damaged, header + 8 * cell, 1);
+	WriteBytes(damagedName, damaged);
+	CHECK_THROWS(IGI<TestPoint>::Open(damagedName, "Damaged"), std::runtime_error);
+
+	// Offset past the postings
+	damaged = bytes;
+	Set<std::uint64_t>(damaged, header + 8 * (cell + 1), numPostings + 1000);
+	WriteBytes(damagedName, damaged);
+	CHECK_THROWS(IGI<TestPoint>::Open(damagedName, "Damaged"), std::runtime_error);
+
+	// Cell count that would wrap around
+	damaged = bytes;
+	Set<std::uint64_t>(damaged, offsetof(IndexFileHeader, NumCells), ~std::uint64_t{ 0 });
+	WriteBytes(damagedName, damaged);
+	CHECK_THROWS(IGI<TestPoint>::Open(damagedName, "Damaged"), std::runtime_error);
+
+	// Truncated
+	damaged.assign(std::begin(bytes), std::end(bytes) - 64);
+	WriteBytes(damagedName, damaged);
+	CHECK_THROWS(IGI<TestPoint>::Open(damagedName, "Damaged"), std::runtime_error);
+
+	// Flipped bit in a posting ID - Found by the checksum only
+	damaged = bytes;
+	damaged[header + 8 * (numCells + 1) + 5] ^= 0x10;
+	WriteBytes(damagedName, damaged);
+	CHECK_THROWS(IGI<TestPoint>::Open(damagedName, "Damaged", true), std::runtime_error);
+	IGI<TestPoint>::Open(damagedName, "Damaged");
+}
+
+void CheckSuccinctIGI(const std::vector<Cloud<TestPoint>>& clouds, const std::vector<Cloud<TestPoint>>& queries)
+{
+	SuccinctIGI<TestPoint> succinct(clouds, "Succinct", cmax, delta);
+	succinct.Save(fileName);
+	CheckSame(succinct, SuccinctIGI<TestPoint>::Open(fileName, "Opened", true), queries);
+
+	// Only merged indexes are saved
+	succinct.Remove(0);
+	CHECK_THROWS(succinct.Save(fileName), std::logic_error);
+	succinct.Merge().Save(fileName);
+	CheckSame(succinct, SuccinctIGI<TestPoint>::Open(fileName, "Opened"), queries);
+
+	auto damaged = ReadBytes(fileName);
+	damaged.resize(damaged.size() / 2);
+	WriteBytes(damagedName, damaged);
+	CHECK_THROWS(SuccinctIGI<TestPoint>::Open(damagedName, "Damaged"), std::runtime_error);
+}
+
+int main()
+{
+	std::mt19937 random(7);
+	auto clouds = RandomClouds(1000, random);
+	auto queries = RandomClouds(50, random, 100000);
+
+	CheckIGI(clouds, queries);
+	CheckDamagedIGI(clouds);
+	CheckSuccinctIGI(clouds, queries);
+
+	std::remove(fileName);
+	std::remove(damagedName);
+
+	return CheckResult("IndexFileTest");
+}
@@ -0,0 +1,84 @@
+#include "Numa.h"
+#include "IGI.h"
+#include "Rtree.h"
+#include "TestUtility.h"
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// NumaReplicas - Batches answered by the workers of every node with every placement must equal the results
+// of a single index. On a machine with one node every placement has one copy, the routing is still exercised
+
+const unsigned cmax = 1000;
+const unsigned delta = 10;
+
+int main()
+{
+	std::mt19937 random(25);
+	auto clouds = RandomClouds(3000, random);
+	auto queries = RandomClouds(200, random, 100000);
+
+	CHECK(NumaTopology::Get().NumNodes() >= 1);
+
+	// Tasks of a NodeExecutor return their value or their exception through the future
+	NodeExecutor executor(0, 2);
+	CHECK(executor.Submit([] { return std::string("node"); }).get() == "node");
+	CHECK_THROWS(executor.Submit([]() -> int { throw std::runtime_error("task"); }).get(), std::runtime_error);
+
+	IGI<TestPoint> reference(clouds, "Reference", cmax, delta);
+	reference.Compact();
+
+	auto knn = [](const IGI<TestPoint>& index, const Cloud<TestPoint>& query) { return index.KNN(query, 10); };
+
+	for (auto placement : { NumaPlacement::Single, NumaPlacement::Interleaved, NumaPlacement::Replicated })
+	{
+		NumaReplicas<IGI<TestPoint>> replicas([&clouds]
+		{
+			IGI<TestPoint> igi(clouds, "Replica", cmax, delta);
+			igi.Compact();
+			return igi;
+		}, placement, 2);
+
+		CHECK(replicas.Placement() == placement);
+		CHECK(replicas.NumNodes() == NumaTopology::Get().NumNodes());
+
+		auto results = replicas.KNNBatch(queries, knn);
+		CHECK(results.size() == queries.size());
+		for (std::size_t i = 0; i < queries.size() && i < results.size(); i++)
+		{
+			CHECK(results[i] == reference.KNN(queries[i], 10));
+		}
+
+		auto throughput = replicas.LocalRemoteThroughput(queries, knn, 1);
+		CHECK(throughput.first > 0.0 && throughput.second > 0.0);
+	}
+
+	// Any index class - Rtree
+	Rtree<TestPoint> rtree("Rtree");
+	rtree.Build(clouds);
+	NumaReplicas<Rtree<TestPoint>> rtrees([&clouds]
+	{
+		Rtree<TestPoint> replica("Rtree");
+		replica.Build(clouds);
+		return replica;
+	});
+
+	auto rtreeKnn = [](const Rtree<TestPoint>& index, const Cloud<TestPoint>& query) { return index.KNN(query, 5, 5); };
+	auto rtreeResults = rtrees.KNNBatch(queries, rtreeKnn);
+	for (std::size_t i = 0; i < queries.size(); i += 10)
+	{
+		CHECK(rtreeResults[i] == rtree.KNN(queries[i], 5, 5));
+	}
+
+	// Exceptions of the build and of a query reach the caller
+	CHECK_THROWS(NumaReplicas<Rtree<TestPoint>>([]() -> Rtree<TestPoint> { throw std::runtime_error("build"); }), std::runtime_error);
+	CHECK_THROWS(rtrees.KNNBatch(queries, [](const Rtree<TestPoint>&, const Cloud<TestPoint>& query) -> int
+	{
+		if (query.Points.size() > 40)
+			throw std::runtime_error("query");
+		return 1;
+	}), std::runtime_error);
+
+	return CheckResult("NumaReplicasTest");
+}
@@ -0,0 +1,91 @@
+#include "Rtree.h"
+#include "VPT.h"
+#include "TestUtility.h"
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Votes of a query split over several threads (VoteCounter::Parallel) - Queries run at the same time from
+// different threads, each over several pool threads, must give the single threaded results.
+// Needs at least two hardware threads to share the pool. Meant to run with -fsanitize=thread as well
+
+using PointIdx = std::pair<TestPoint, unsigned>;
+
+double DistL2(const PointIdx& p1, const PointIdx& p2)
+{
+	auto dx = boost::geometry::get<0>(p1.first) - boost::geometry::get<0>(p2.first);
+	auto dy = boost::geometry::get<1>(p1.first) - boost::geometry::get<1>(p2.first);
+	return std::sqrt(static_cast<double>(dx) * dx + static_cast<double>(dy) * dy);
+}
+
+// Query clouds large enough to be split in chunks
+std::vector<Cloud<TestPoint>> LargeClouds(unsigned count, std::mt19937& random)
+{
+	std::uniform_real_distribution<float> uniform(0.0f, 1000.0f);
+	std::vector<Cloud<TestPoint>> clouds;
+	for (unsigned id = 0; id < count; id++)
+	{
+		Cloud<TestPoint> cloud(100000 + id);
+		for (unsigned i = 0; i < 1500 + 100 * id; i++)
+		{
+			cloud.Add(TestPoint(uniform(random), uniform(random)));
+		}
+		clouds.push_back(cloud);
+	}
+	return clouds;
+}
+
+// Two threads querying with numThreads each, compared with the single threaded results
+template<typename Query>
+void CheckConcurrent(const std::vector<Cloud<TestPoint>>& queries, const Query& query)
+{
+	std::vector<decltype(query(queries[0], 1u))> expected;
+	for (const auto& cloud : queries)
+	{
+		expected.push_back(query(cloud, 1u));
+	}
+
+	std::atomic<unsigned> wrong{ 0 };
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < 2; t++)
+	{
+		threads.emplace_back([&, t]
+		{
+			for (unsigned r = 0; r < 5; r++)
+			{
+				for (std::size_t i = 0; i < queries.size(); i++)
+				{
+					auto q = (i + t) % queries.size();
+					if (query(queries[q], 4u) != expected[q])
+						wrong++;
+				}
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	CHECK(wrong == 0);
+}
+
+int main()
+{
+	std::mt19937 random(5);
+	auto clouds = RandomClouds(1000, random);
+	auto queries = LargeClouds(6, random);
+
+	Rtree<TestPoint> rtree("Rtree");
+	rtree.Build(clouds);
+	CheckConcurrent(queries, [&rtree](const Cloud<TestPoint>& cloud, unsigned numThreads) { return rtree.KNN(cloud, 20, 5, numThreads); });
+
+	VPT<TestPoint> vpt("VPT");
+	vpt.Build(clouds, DistL2);
+	CheckConcurrent(queries, [&vpt](const Cloud<TestPoint>& cloud, unsigned numThreads) { return vpt.KNN(cloud, 20, 5, numThreads); });
+
+	return CheckResult("ParallelVotesTest");
+}
@@ -0,0 +1,83 @@
+#include "IGI.h"
+#include "PyramidIGI.h"
+#include "TestUtility.h"
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+// PyramidIGI - Every level must answer as an IGI with cells of its side, and the refinement must give the
+// exact result of the finest level when every cloud survives the coarse levels
+
+const unsigned cmax = 1000;
+const unsigned delta = 10;
+const unsigned levels = 3;
+
+int main()
+{
+	std::mt19937 random(18);
+	auto clouds = RandomClouds(2000, random);
+	auto queries = RandomClouds(100, random, 100000);
+
+	PyramidIGI<TestPoint> pyramid(clouds, "Pyramid", cmax, delta, levels);
+	CHECK(pyramid.NumLevels() == levels);
+
+	// Streaming build gives the same lists
+	PyramidIGI<TestPoint> streamed("Streamed", cmax, delta, levels);
+	streamed.AddRange(std::begin(clouds), std::end(clouds));
+	CHECK_THROWS(streamed.KNN(queries[0], 10), std::logic_error);
+	streamed.Finalize();
+	CHECK_THROWS(streamed.Add(queries[0]), std::logic_error);
+
+	for (unsigned level = 0; level < levels; level++)
+	{
+		CHECK(streamed.NumPostings(level) == pyramid.NumPostings(level));
+		if (level > 0)
+			CHECK(pyramid.NumPostings(level) <= pyramid.NumPostings(level - 1));
+
+		IGI<TestPoint> igi(clouds, "IGI", cmax, delta << level);
+		igi.Compact();
+		for (const auto& query : queries)
+		{
+			CHECK(pyramid.KNNLevel(query, 20, level) == igi.KNN(query, 20));
+			CHECK(pyramid.KNNLevel(query, 20, level, Voting::Set) == igi.KNN(query, 20, Voting::Set));
+		}
+	}
+	CHECK_THROWS(pyramid.KNNLevel(queries[0], 10, levels), std::out_of_range);
+
+	// Every cloud voted by the coarsest level survives: refinement ends on the finest level votes
+	auto allClouds = static_cast<unsigned>(clouds.size());
+	for (const auto& query : queries)
+	{
+		CHECK(pyramid.KNN(query, 20, allClouds) == pyramid.KNNLevel(query, 20, 0));
+		CHECK(pyramid.KNN(query, 20, allClouds, Voting::Set) == pyramid.KNNLevel(query, 20, 0, Voting::Set));
+		CHECK(streamed.KNN(query, 20) == pyramid.KNN(query, 20));
+	}
+
+	// Fewer candidates: still k results at most, with votes of the finest level
+	for (const auto& query : queries)
+	{
+		auto result = pyramid.KNN(query, 5, 8);
+		CHECK(result.size() <= 5);
+		auto exact = pyramid.KNNLevel(query, static_cast<unsigned>(clouds.size()), 0);
+		for (const auto& pair : result)
+		{
+			bool found = false;
+			for (const auto& match : exact)
+			{
+				found = found || match == pair;
+			}
+			CHECK(found);
+		}
+	}
+
+	auto results = pyramid.KNNBatch(queries, 10);
+	CHECK(results.size() == queries.size());
+	for (std::size_t i = 0; i < queries.size() && i < results.size(); i++)
+	{
+		CHECK(results[i] == pyramid.KNN(queries[i], 10));
+	}
+
+	CHECK_THROWS(PyramidIGI<TestPoint>("Too coarse", cmax, 300, levels), std::invalid_argument);
+
+	return CheckResult("PyramidIGITest");
+}
@@ -0,0 +1,84 @@
+#include "TestUtility.h"
+#include "RoaringIGI.h"
+#include "IGI.h"
+#include <set>
+
+// RoaringIGI: results equal to IGI with Set voting over array, bitmap and run containers
+// VoteCounter word kernels (AddWord, AddRange): same counts and touched IDs as one Add per ID
+
+int main()
+{
+	std::mt19937 random(13);
+
+	// Word kernels against one Add per ID
+	for (int round = 0; round < 200; round++)
+	{
+		VoteCounter<> words;
+		VoteCounter<> reference;
+
+		for (int op = 0; op < 20; op++)
+		{
+			unsigned votes = 1 + random() % 3;
+
+			if (random() % 2 == 0)
+			{
+				unsigned base = 64 * (random() % 40);
+				std::uint64_t word = (static_cast<std::uint64_t>(random()) << 32) | random();
+				word = random() % 4 == 0 ? ~std::uint64_t{ 0 } : (random() % 2 == 0 ? word & (word >> 7) : word);
+				words.AddWord(base, word, votes);
+				for (unsigned i = 0; i < 64; i++)
+				{
+					if ((word >> i) & 1)
+						reference.Add(base + i, votes);
+				}
+			}
+			else
+			{
+				unsigned first = random() % 2500;
+				unsigned last = first + random() % 300;
+				words.AddRange(first, last, votes);
+				for (auto id = first; id < last; id++)
+				{
+					reference.Add(id, votes);
+				}
+			}
+		}
+
+		CHECK(std::set<unsigned>(words.Touched().begin(), words.Touched().end()) == std::set<unsigned>(reference.Touched().begin(), reference.Touched().end()));
+		CHECK(words.Size() == reference.Size());
+		for (auto id : reference.Touched())
+		{
+			CHECK(words.Get(id) == reference.Get(id));
+		}
+
+		// Cleared counters start from scratch
+		words.Clear();
+		words.AddWord(0, 0x5, 2);
+		CHECK(words.Size() == 2 && words.Get(0) == 2 && words.Get(1) == 0 && words.Get(2) == 2);
+	}
+
+	// Few coarse cells: dense chunks (bitmaps) - Clouds of the next chunk with consecutive IDs in one cell (runs)
+	// and a second point in one of a few cells (arrays)
+	auto clouds = RandomClouds(20000, random);
+	for (unsigned id = 70000; id < 74000; id++)
+	{
+		clouds.push_back(Cloud<TestPoint>(id).Add(TestPoint(555.0f, 555.0f)).Add(TestPoint(static_cast<float>(random() % 1000), 5.0f)));
+	}
+	auto queries = RandomClouds(200, random, 100000);
+	queries.push_back(Cloud<TestPoint>(100000).Add(TestPoint(556.0f, 556.0f)));
+
+	RoaringIGI<TestPoint> roaring(clouds, "RoaringIGI", 1000, 250);
+	IGI<TestPoint> igi(clouds, "IGI", 1000, 250);
+	igi.Compact();
+
+	CHECK(roaring.NumContainers(RoaringBitmap::Kind::Array) > 0);
+	CHECK(roaring.NumContainers(RoaringBitmap::Kind::Bitmap) > 0);
+	CHECK(roaring.NumContainers(RoaringBitmap::Kind::Run) > 0);
+
+	for (const auto& query : queries)
+	{
+		CHECK(roaring.KNN(query, 30) == igi.KNN(query, 30, Voting::Set));
+	}
+
+	return CheckResult("RoaringIGITest");
+}
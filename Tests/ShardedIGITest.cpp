@@ -0,0 +1,230 @@
+#include "ShardIPC.h"
+#include "TestUtility.h"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+
+// ShardedIGI - Results of local shards and of shards served over local sockets must equal a single IGI
+// holding every cloud, before and after Remove, Replace and Compact. A shard that fails must not let the
+// query return while the other shards still read it
+
+const unsigned cmax = 1000;
+const unsigned delta = 10;
+
+// Same KNN and KNNBatch results as the reference for every voting and radius
+template<typename Sharded>
+void CheckSame(IGI<TestPoint>& reference, Sharded& sharded, std::mt19937& random)
+{
+	auto queries = RandomClouds(30, random, 100000);
+	for (const auto& query : queries)
+	{
+		CHECK(sharded.KNN(query, 20) == reference.KNN(query, 20));
+		CHECK(sharded.KNN(query, 20, Voting::Set) == reference.KNN(query, 20, Voting::Set));
+		CHECK(sharded.KNN(query, 20, Voting::Points, 1) == reference.KNN(query, 20, Voting::Points, 1));
+	}
+
+	auto results = sharded.KNNBatch(queries, 10, Voting::Set);
+	CHECK(results.size() == queries.size());
+	for (std::size_t i = 0; i < queries.size() && i < results.size(); i++)
+	{
+		CHECK(results[i] == reference.KNN(queries[i], 10, Voting::Set));
+	}
+}
+
+// Same changes on the reference and on the sharded index
+template<typename Sharded>
+void CheckChanges(IGI<TestPoint>& reference, Sharded& sharded, std::mt19937& random)
+{
+	CheckSame(reference, sharded, random);
+
+	for (unsigned i = 0; i < 300; i++)
+	{
+		auto id = static_cast<unsigned>(random() % 2500);
+		if (random() % 2 == 0)
+		{
+			CHECK(sharded.Remove(id) == reference.Remove(id));
+		}
+		else
+		{
+			auto cloud = RandomCloud(id, random);
+			CHECK(sharded.Replace(cloud) == reference.Replace(cloud));
+		}
+	}
+
+	reference.Publish();
+	sharded.Publish();
+	CheckSame(reference, sharded, random);
+
+	reference.Compact();
+	sharded.Compact();
+	CheckSame(reference, sharded, random);
+}
+
+void CheckLocalShards(const std::vector<Cloud<TestPoint>>& clouds)
+{
+	std::mt19937 random(24);
+	IGI<TestPoint> reference(clouds, "Reference", cmax, delta);
+	ShardedIGI<TestPoint> sharded(clouds, "Sharded", cmax, delta, 4, 2);
+
+	CHECK(sharded.NumShards() == 4);
+	CheckChanges(reference, sharded, random);
+}
+
+#ifndef _WIN32
+
+// Shards served by ShardServers on one end of socket pairs, queried through SocketShards on the other end
+void CheckSocketShards(const std::vector<Cloud<TestPoint>>& clouds)
+{
+	std::mt19937 random(25);
+	IGI<TestPoint> reference(clouds, "Reference", cmax, delta);
+
+	std::vector<std::unique_ptr<LocalShard<TestPoint>>> servers;
+	std::vector<std::unique_ptr<SocketShard<TestPoint>>> clients;
+	std::vector<std::thread> serving;
+
+	for (unsigned i = 0; i < 3; i++)
+	{
+		int fds[2];
+		if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		{
+			CHECK(!"socketpair");
+			return;
+		}
+
+		servers.emplace_back(new LocalShard<TestPoint>("Server", cmax, delta, i));
+		auto server = servers.back().get();
+		auto fd = fds[0];
+		serving.emplace_back([server, fd] { ShardServer<TestPoint>::Serve(*server, fd); });
+		clients.emplace_back(new SocketShard<TestPoint>(fds[1]));
+	}
+
+	{
+		ShardedIGI<TestPoint, SocketShard<TestPoint>> sharded("Sockets", std::move(clients));
+		sharded.AddRange(std::begin(clouds), std::end(clouds)).Publish();
+
+		CheckChanges(reference, sharded, random);
+
+		// A voting byte that is not a Voting comes back as an Error, the connection keeps serving
+		auto query = RandomCloud(100000, random);
+		CHECK_THROWS(sharded.GetShard(0).KNN(query, 5, static_cast<Voting>(7)).get(), std::runtime_error);
+		CHECK_THROWS(sharded.GetShard(1).KNNBatch(std::vector<Cloud<TestPoint>>(1, query), 5, static_cast<Voting>(2)).get(), std::runtime_error);
+		CHECK(sharded.KNN(query, 20) == reference.KNN(query, 20));
+	}
+
+	// Clients closed: every server returns
+	for (auto& thread : serving)
+	{
+		thread.join();
+	}
+}
+
+#endif
+
+using Result = std::vector<std::pair<unsigned, unsigned>>;
+
+// Shard answering on a thread of its own: fails right away, or reads the query after a while
+class ProbeShard
+{
+private:
+	bool fail_;
+	const std::atomic<bool>& returned_;
+	std::atomic<unsigned>& late_;
+	std::vector<std::thread> threads_;
+
+	template<typename R, typename Read>
+	std::future<R> Answer(const Read& read)
+	{
+		auto promise = std::make_shared<std::promise<R>>();
+		auto future = promise->get_future();
+
+		threads_.emplace_back([this, promise, read]
+		{
+			if (fail_)
+			{
+				promise->set_exception(std::make_exception_ptr(std::runtime_error("shard")));
+				return;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			if (returned_)
+				late_++;
+			promise->set_value(read());
+		});
+
+		return future;
+	}
+
+public:
+	ProbeShard(bool fail, const std::atomic<bool>& returned, std::atomic<unsigned>& late) :fail_{ fail }, returned_(returned), late_(late) {}
+
+	~ProbeShard()
+	{
+		for (auto& thread : threads_)
+		{
+			thread.join();
+		}
+	}
+
+	std::future<Result> KNN(const Cloud<TestPoint>& queryCloud, unsigned, Voting, unsigned)
+	{
+		return Answer<Result>([&queryCloud] { return Result(1, std::make_pair(queryCloud.ID, 1u)); });
+	}
+
+	std::future<std::vector<Result>> KNNBatch(const std::vector<Cloud<TestPoint>>& queryClouds, unsigned, Voting, unsigned)
+	{
+		return Answer<std::vector<Result>>([&queryClouds] { return std::vector<Result>(queryClouds.size()); });
+	}
+};
+
+// The caller's query is released (returned set) as soon as KNN throws: no shard may read it after that
+void CheckFailingShard(std::mt19937& random)
+{
+	std::atomic<bool> returned{ false };
+	std::atomic<unsigned> late{ 0 };
+
+	std::vector<std::unique_ptr<ProbeShard>> shards;
+	shards.emplace_back(new ProbeShard(true, returned, late));
+	shards.emplace_back(new ProbeShard(false, returned, late));
+	ShardedIGI<TestPoint, ProbeShard> sharded("Probe", std::move(shards));
+
+	// Held past the delay of the slow shard
+	auto released = [&returned]
+	{
+		returned = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		returned = false;
+	};
+
+	auto query = RandomCloud(1, random);
+	CHECK_THROWS(sharded.KNN(query, 5), std::runtime_error);
+	released();
+
+	std::vector<Cloud<TestPoint>> queries(3, query);
+	CHECK_THROWS(sharded.KNNBatch(queries, 5), std::runtime_error);
+	released();
+
+	CHECK(late == 0);
+}
+
+int main()
+{
+	std::mt19937 random(26);
+	auto clouds = RandomClouds(2000, random);
+
+	CheckLocalShards(clouds);
+	CheckFailingShard(random);
+#ifndef _WIN32
+	CheckSocketShards(clouds);
+#endif
+
+	return CheckResult("ShardedIGITest");
+}
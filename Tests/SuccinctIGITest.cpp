@@ -0,0 +1,186 @@
+#include "SuccinctIGI.h"
+#include "TestUtility.h"
+#include <atomic>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// SuccinctIGI delta layer - Clouds added, removed and added again after Finalize must give the results of an
+// index rebuilt from the live clouds, before the merge (delta layer and tombstones), during MergeAsync and after it
+
+const unsigned cmax = 1000;
+const unsigned delta = 10;
+
+// Index built from scratch with the live clouds
+SuccinctIGI<TestPoint> Reference(const std::map<unsigned, Cloud<TestPoint>>& live)
+{
+	std::vector<Cloud<TestPoint>> clouds;
+	for (const auto& pair : live)
+	{
+		clouds.push_back(pair.second);
+	}
+	return SuccinctIGI<TestPoint>(clouds, "Reference", cmax, delta);
+}
+
+void CheckSame(const SuccinctIGI<TestPoint>& succinct, const std::map<unsigned, Cloud<TestPoint>>& live, const std::vector<Cloud<TestPoint>>& queries)
+{
+	auto reference = Reference(live);
+	for (const auto& query : queries)
+	{
+		CHECK(succinct.KNN(query, 20) == reference.KNN(query, 20));
+	}
+
+	auto results = succinct.KNNBatch(queries, 10);
+	CHECK(results.size() == queries.size());
+	for (std::size_t i = 0; i < queries.size() && i < results.size(); i++)
+	{
+		CHECK(results[i] == reference.KNN(queries[i], 10));
+	}
+}
+
+int main()
+{
+	std::mt19937 random(21);
+	auto clouds = RandomClouds(1500, random);
+	auto queries = RandomClouds(50, random, 100000);
+
+	std::map<unsigned, Cloud<TestPoint>> live;
+	for (unsigned id = 0; id < 1000; id++)
+	{
+		live.emplace(id, clouds[id]);
+	}
+
+	SuccinctIGI<TestPoint> succinct(std::vector<Cloud<TestPoint>>(std::begin(clouds), std::begin(clouds) + 1000), "Succinct", cmax, delta);
+	CHECK(succinct.PendingChanges() == std::make_pair(std::size_t{ 0 }, std::size_t{ 0 }));
+	CheckSame(succinct, live, queries);
+
+	// Delta layer - Searchable right away
+	for (unsigned id = 1000; id < 1500; id++)
+	{
+		succinct.Add(clouds[id]);
+		live.emplace(id, clouds[id]);
+	}
+	CHECK(succinct.PendingChanges().first > 0);
+	CheckSame(succinct, live, queries);
+
+	// Tombstones - In the Sarrays and in the delta layer
+	std::size_t removed{ 0 };
+	for (unsigned i = 0; i < 300; i++)
+	{
+		auto id = static_cast<unsigned>(random() % 1500);
+		bool found = live.erase(id) > 0;
+		CHECK(succinct.Remove(id) == found);
+		removed += found;
+	}
+	CHECK(!succinct.Remove(5000));
+	CHECK(succinct.PendingChanges().second == removed);
+	CheckSame(succinct, live, queries);
+
+	// A removed ID comes back right away, from the Sarrays or from the delta layer, also removed twice
+	for (unsigned id : { 3u, 1200u })
+	{
+		if (live.count(id) > 0)
+		{
+			succinct.Remove(id);
+			live.erase(id);
+		}
+
+		auto cloud = RandomCloud(id, random);
+		succinct.Add(cloud);
+		live.emplace(id, cloud);
+		CheckSame(succinct, live, queries);
+
+		CHECK(succinct.Remove(id));
+		cloud = RandomCloud(id, random);
+		succinct.Add(cloud);
+		live.at(id) = cloud;
+		CheckSame(succinct, live, queries);
+	}
+
+	succinct.Merge();
+	CHECK(succinct.PendingChanges() == std::make_pair(std::size_t{ 0 }, std::size_t{ 0 }));
+	CheckSame(succinct, live, queries);
+
+	// Replace - Remove then Add without a merge between, merged in the background while queries run on the same results
+	for (unsigned i = 0; i < 200; i++)
+	{
+		auto id = static_cast<unsigned>(random() % 1500);
+		if (live.erase(id) > 0)
+			succinct.Remove(id);
+	}
+
+	for (unsigned id = 0; id < 1500; id++)
+	{
+		if (live.count(id) == 0 && id % 2 == 0)
+		{
+			auto cloud = RandomCloud(id, random);
+			succinct.Add(cloud);
+			live.emplace(id, cloud);
+		}
+	}
+
+	auto reference = Reference(live);
+	std::atomic<bool> done{ false };
+	std::atomic<unsigned> wrong{ 0 };
+	std::thread reader([&]
+	{
+		do
+		{
+			for (const auto& query : queries)
+			{
+				if (succinct.KNN(query, 20) != reference.KNN(query, 20))
+					wrong++;
+			}
+		} while (!done);
+	});
+
+	succinct.MergeAsync(2).get();
+	done = true;
+	reader.join();
+
+	CHECK(wrong == 0);
+	CHECK(succinct.PendingChanges() == std::make_pair(std::size_t{ 0 }, std::size_t{ 0 }));
+	CheckSame(succinct, live, queries);
+
+	// Removes and Adds while a merge runs - Clouds of the Sarrays, of the delta being merged and of the new delta
+	for (unsigned id = 1500; id < 1700; id++)
+	{
+		auto cloud = RandomCloud(id, random);
+		succinct.Add(cloud);
+		live.emplace(id, cloud);
+	}
+
+	auto merge = succinct.MergeAsync(2);
+	for (unsigned id = 0; id < 1700; id += 3)
+	{
+		if (live.erase(id) > 0)
+			CHECK(succinct.Remove(id));
+
+		if (id % 2 == 0)
+		{
+			auto cloud = RandomCloud(id, random);
+			succinct.Add(cloud);
+			live.emplace(id, cloud);
+		}
+	}
+	merge.get();
+	CheckSame(succinct, live, queries);
+
+	succinct.Merge();
+	CHECK(succinct.PendingChanges() == std::make_pair(std::size_t{ 0 }, std::size_t{ 0 }));
+	CheckSame(succinct, live, queries);
+
+	// Points of a cloud going back and forth between two cells - One vote per cell, as in the Sarrays
+	Cloud<TestPoint> zigzag(2000);
+	for (unsigned i = 0; i < 10; i++)
+	{
+		zigzag.Add(TestPoint(i % 2 == 0 ? 5.0f : 15.0f, 5.0f));
+	}
+	succinct.Add(zigzag);
+	live.emplace(zigzag.ID, zigzag);
+	CheckSame(succinct, live, { zigzag });
+
+	return CheckResult("SuccinctIGITest");
+}
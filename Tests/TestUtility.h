@@ -0,0 +1,52 @@
+#pragma once
+#include "Cloud.h"
+#include <boost/geometry.hpp>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Checks shared by the test programs
+// Every test is a standalone program: it prints the failed checks and returns 1 if any failed
+
+using TestPoint = boost::geometry::model::point<float, 2, boost::geometry::cs::cartesian>;
+
+inline int& CheckFailures()
+{
+	static int failures{ 0 };
+	return failures;
+}
+
+#define CHECK(condition) do { if (!(condition)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << '\n'; CheckFailures()++; } } while (0)
+
+// Expression must throw Exception
+#define CHECK_THROWS(expression, Exception) do { bool thrown{ false }; try { expression; } catch (const Exception&) { thrown = true; } CHECK(thrown && #expression); } while (0)
+
+// Exit code of the test program
+inline int CheckResult(const char* test)
+{
+	std::cout << test << (CheckFailures() == 0 ? ": passed" : ": FAILED") << '\n';
+	return CheckFailures() == 0 ? 0 : 1;
+}
+
+// Cloud of 10 to 49 random points in [0, extent)^2
+inline Cloud<TestPoint> RandomCloud(unsigned id, std::mt19937& random, unsigned extent = 1000)
+{
+	Cloud<TestPoint> cloud(id);
+	auto numPoints = 10 + random() % 40;
+	for (unsigned i = 0; i < numPoints; i++)
+	{
+		cloud.Add(TestPoint(static_cast<float>(random() % extent), static_cast<float>(random() % extent)));
+	}
+	return cloud;
+}
+
+inline std::vector<Cloud<TestPoint>> RandomClouds(unsigned count, std::mt19937& random, unsigned firstID = 0, unsigned extent = 1000)
+{
+	std::vector<Cloud<TestPoint>> clouds;
+	clouds.reserve(count);
+	for (unsigned i = 0; i < count; i++)
+	{
+		clouds.push_back(RandomCloud(firstID + i, random, extent));
+	}
+	return clouds;
+}